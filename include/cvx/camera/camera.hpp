@@ -2,6 +2,7 @@
 #define CVX_CAMERA_HPP
 
 #include <vector>
+#include <memory>
 #include <opencv2/opencv.hpp>
 #include <Eigen/Core>
 
@@ -12,7 +13,7 @@ class PinholeCamera
 public:
     PinholeCamera() {}
     PinholeCamera(double fx, double fy, double cx, double cy, const cv::Size &isz, const cv::Mat &dist = cv::Mat::zeros(5, 1, CV_64F)):
-        fx_(fx), fy_(fy), cx_(cx), cy_(cy), sz_(isz), dist_(dist) {}
+        fx_(fx), fy_(fy), cx_(cx), cy_(cy), dist_(dist.clone()), sz_(isz), has_distortion_(isDistorted(dist)) {}
 
     cv::Mat getMatrix() const {
         cv::Mat_<double> mat = cv::Mat_<double>::zeros(3, 3) ;
@@ -22,33 +23,48 @@ public:
         return mat ;
     }
 
+    // a copy, so that editing it does not bypass setDistortion
     cv::Mat getDistortion() const {
-        return dist_ ;
+        return dist_.clone() ;
     }
 
     void setMatrix(const cv::Mat &m) {
         cv::Mat_<double> mat(m) ;
         fx_ = mat(0, 0) ; fy_ = mat(1, 1) ;
         cx_ = mat(0, 2) ; cy_ = mat(1, 2) ;
+        maps_.reset() ;
     }
 
     void setDistortion(const cv::Mat &m) {
-        dist_ = m ;
+        dist_ = m.clone() ;
+        has_distortion_ = isDistorted(m) ;
+        maps_.reset() ;
     }
 
     void setSize(const cv::Size &sz) {
         sz_ = sz ;
+        maps_.reset() ;
     }
 
+    // true if there are non-zero distortion coefficients
+    bool hasDistortion() const { return has_distortion_ ; }
+
     cv::Point2d project(const cv::Point3d& xyz) const {
         return cv::Point2d(fx_ * xyz.x / xyz.z + cx_, fy_ * xyz.y / xyz.z + cy_) ;
     }
 
+    // ray through the (raw, distorted) pixel uv, at unit depth
     cv::Point3d backProject(const cv::Point2d& uv) const {
-        return cv::Point3d((uv.x - cx_)/fx_, (uv.y - cy_)/fy_, 1.0) ;
+        cv::Point2d p = has_distortion_ ? rectifyPoint(uv) : uv ;
+        return cv::Point3d((p.x - cx_)/fx_, (p.y - cy_)/fy_, 1.0) ;
     }
 
+    // point at depth Z seen at pixel (x, y); for many pixels use the ray maps below
     Eigen::Vector3f backProject(float x, float y, float Z) const {
+        if ( has_distortion_ ) {
+            cv::Point3d ray = backProject(cv::Point2d(x, y)) ;
+            return Eigen::Vector3f(Z * ray.x, Z * ray.y, Z) ;
+        }
         return Eigen::Vector3f(Z*(x - cx_)/fx_, Z*(y - cy_)/fy_, Z) ;
     }
 
@@ -58,6 +74,12 @@ public:
     cv::Point2d rectifyPoint(const cv::Point2d &uv_raw) const ;
     cv::Point2d unrectifyPoint(const cv::Point2d &uv_rect) const ;
 
+    // Rays (x/z, y/z) at unit depth through every pixel of the raw image, taking the distortion into account, as two
+    // CV_32FC1 images of the camera size. Like the remap tables used by rectifyImage/unrectifyImage they are computed
+    // on first use and cached until the intrinsics change; copies of the camera share them.
+    const cv::Mat &rayMapX() const { return maps().ray_x_ ; }
+    const cv::Mat &rayMapY() const { return maps().ray_y_ ; }
+
     double fx() const { return fx_ ; }
     double fy() const { return fy_ ; }
     double cx() const { return cx_ ; }
@@ -87,6 +109,9 @@ public:
         cx_ = intrinsics.at<double>(0, 2) ;
         cy_ = intrinsics.at<double>(1, 2) ;
 
+        has_distortion_ = isDistorted(dist_) ;
+        maps_.reset() ;
+
         return true ;
 
     }
@@ -109,9 +134,21 @@ public:
 
 protected:
 
+    struct Maps {
+        cv::Mat rect_map1_, rect_map2_ ; // raw to rectified, fixed point
+        cv::Mat unrect_x_, unrect_y_ ;   // rectified to raw
+        cv::Mat ray_x_, ray_y_ ;
+    } ;
+
+    static bool isDistorted(const cv::Mat &dist) { return !dist.empty() && cv::countNonZero(dist) > 0 ; }
+
+    const Maps &maps() const ;
+
     double fx_, fy_, cx_, cy_ ;
     cv::Mat dist_ ;
     cv::Size sz_ ;
+    bool has_distortion_ = false ;
+    mutable std::shared_ptr<const Maps> maps_ ;
 
 };
 
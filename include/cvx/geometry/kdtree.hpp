@@ -8,9 +8,30 @@
 #include <cvx/geometry/point_list.hpp>
 
 // 2D/3D point cloud Search (wrapper over nanoflann)
+//
+// An index trained on a point list owns its points: an lvalue list is copied and an rvalue one moved into the tree.
+// The points are borrowed instead when given as an Eigen map or a raw pointer, or passed to borrow(), and the caller
+// must then keep them alive (and unmodified) for the lifetime of the tree.
+//
+// All distances, including the search radius, are squared Euclidean distances.
 
 namespace cvx {
 
+// Index and search parameters. With the defaults the search is exact.
+
+struct KDTreeParameters {
+    uint leaf_size_ ;   // maximum number of points in a leaf node
+    float eps_ ;        // approximate search, the returned neighbours are within (1 + eps) of the true ones
+    uint max_checks_ ;  // maximum number of distance evaluations per query (0 for unlimited), knn queries may then
+                        // return fewer than k neighbours
+
+    KDTreeParameters():
+        leaf_size_(10),
+        eps_(0),
+        max_checks_(0)
+    {}
+} ;
+
 class KDTreeIndex3 ;
 
 class KDTree3
@@ -20,26 +41,102 @@ public:
     typedef Eigen::Vector3f point_t ;
     typedef PointList3f point_list_t ;
 
+    typedef KDTreeParameters Parameters ;
+
     KDTree3() {}
-    KDTree3(const point_list_t &data) ;
+    KDTree3(const point_list_t &data, const Parameters &params = Parameters()) ;
+    KDTree3(point_list_t &&data, const Parameters &params = Parameters()) ;
+    KDTree3(const ConstMap<float, 3> &data, const Parameters &params = Parameters()) ;
+    // n points with coordinates at data + i * stride (stride is given in floats)
+    KDTree3(const float *data, size_t n, size_t stride = 3, const Parameters &params = Parameters()) ;
 
-    void train(const point_list_t &data) ;
+    void train(const point_list_t &data, const Parameters &params = Parameters()) ;
+    void train(point_list_t &&data, const Parameters &params = Parameters()) ;
+    void train(const ConstMap<float, 3> &data, const Parameters &params = Parameters()) ;
+    void train(const float *data, size_t n, size_t stride = 3, const Parameters &params = Parameters()) ;
+
+    // index the points in place, without a copy
+    void borrow(const point_list_t &data, const Parameters &params = Parameters()) ;
+    void borrow(point_list_t &&data, const Parameters &params = Parameters()) = delete ;
 
     // nearest point
-    uint nearest(const point_t &q) ;
-    uint nearest(const point_t &q, float &dist) ;
+    uint nearest(const point_t &q) const ;
+    uint nearest(const point_t &q, float &dist) const ;
+
+    // nearest point closer than max_dist to q, returns false if there is none. Cells further than max_dist are never
+    // visited so a tight bound makes the search terminate early. Does not allocate.
+    bool nearest(const point_t &q, float max_dist, uint &idx, float &dist) const ;
+
+    void knearest(const point_t &q, uint k, std::vector<uint> &indexes) const ;
+    void knearest(const point_t &q, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const ;
+
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) const ;
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes, std::vector<float> &distances) const ;
 
-    void knearest(const point_t &q, uint k, std::vector<uint> &indexes) ;
-    void knearest(const point_t &q, uint k, std::vector<uint> &indexes, std::vector<float> &distances) ;
+    // batched queries, processed in parallel
 
-    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) ;
-    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes, std::vector<float> &distances) ;
+    // k nearest neighbours of each query. The output buffers should have room for queries.size() * k elements and the
+    // neighbours of query i are stored sorted by distance at [i*k, (i+1)*k). If the tree holds fewer than k points, the
+    // missing entries are filled with index -1 and distance FLT_MAX
+    void knearest(const point_list_t &queries, uint k, uint *indexes, float *distances) const ;
+    void knearest(const point_list_t &queries, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const ;
+
+    // points within radius of each query in compressed row layout i.e. the neighbours of query i are stored sorted by distance
+    // at [offsets[i], offsets[i+1])
+    void withinRadius(const point_list_t &queries, float radius, std::vector<size_t> &offsets,
+                      std::vector<uint> &indexes, std::vector<float> &distances) const ;
 
 private:
 
     std::shared_ptr<KDTreeIndex3> index_ ;
 } ;
 
+class DynamicKDTreeIndex3 ;
+
+// Incremental 3D point index for clouds that grow (and shrink) over time. The points are held in a logarithmic
+// forest of static kd-trees: each inserted batch becomes a new tree which is merged with the previous one while that
+// is at most twice its size, so a point is re-indexed O(log n) times and an update costs roughly the size of the batch.
+// Removed points are masked out of the results and purged when more than half of the tree holding them is removed.
+//
+// Points are identified by the id assigned on insertion. Ids are consecutive in insertion order and are never reused.
+
+class DynamicKDTree3
+{
+public:
+
+    typedef Eigen::Vector3f point_t ;
+    typedef PointList3f point_list_t ;
+
+    DynamicKDTree3() ;
+
+    // insert a batch of points, returns the id of the first point; the rest are numbered consecutively
+    uint insert(const point_list_t &data) ;
+
+    // remove points with the given ids; unknown or already removed ids are ignored
+    void remove(const std::vector<uint> &ids) ;
+
+    // number of points currently in the index
+    size_t size() const ;
+
+    // coordinates of the point with given id, which must be in the index
+    const point_t &point(uint id) const ;
+
+    // same as in KDTree3 but returning point ids
+    uint nearest(const point_t &q) const ;
+    uint nearest(const point_t &q, float &dist) const ;
+    bool nearest(const point_t &q, float max_dist, uint &id, float &dist) const ;
+
+    void knearest(const point_t &q, uint k, std::vector<uint> &ids) const ;
+    void knearest(const point_t &q, uint k, std::vector<uint> &ids, std::vector<float> &distances) const ;
+
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &ids) const ;
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &ids, std::vector<float> &distances) const ;
+
+private:
+
+    std::shared_ptr<DynamicKDTreeIndex3> index_ ;
+} ;
+
 class KDTreeIndex2 ;
 
 class KDTree2
@@ -48,20 +145,50 @@ public:
     typedef Eigen::Vector2f point_t ;
     typedef PointList2f point_list_t ;
 
+    typedef KDTreeParameters Parameters ;
+
     KDTree2() {}
-    KDTree2(const point_list_t &data) ;
+    KDTree2(const point_list_t &data, const Parameters &params = Parameters()) ;
+    KDTree2(point_list_t &&data, const Parameters &params = Parameters()) ;
+    KDTree2(const ConstMap<float, 2> &data, const Parameters &params = Parameters()) ;
+    // n points with coordinates at data + i * stride (stride is given in floats)
+    KDTree2(const float *data, size_t n, size_t stride = 2, const Parameters &params = Parameters()) ;
+
+    void train(const point_list_t &data, const Parameters &params = Parameters()) ;
+    void train(point_list_t &&data, const Parameters &params = Parameters()) ;
+    void train(const ConstMap<float, 2> &data, const Parameters &params = Parameters()) ;
+    void train(const float *data, size_t n, size_t stride = 2, const Parameters &params = Parameters()) ;
 
-    void train(const point_list_t &data) ;
+    // index the points in place, without a copy
+    void borrow(const point_list_t &data, const Parameters &params = Parameters()) ;
+    void borrow(point_list_t &&data, const Parameters &params = Parameters()) = delete ;
 
     // nearest point
-    uint nearest(const point_t &q) ;
-    uint nearest(const point_t &q, float &dist) ;
+    uint nearest(const point_t &q) const ;
+    uint nearest(const point_t &q, float &dist) const ;
+
+    // nearest point closer than max_dist to q, returns false if there is none. Cells further than max_dist are never
+    // visited so a tight bound makes the search terminate early. Does not allocate.
+    bool nearest(const point_t &q, float max_dist, uint &idx, float &dist) const ;
+
+    void knearest(const point_t &q, uint k, std::vector<uint> &indexes) const ;
+    void knearest(const point_t &q, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const ;
+
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) const ;
+    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes, std::vector<float> &distances) const ;
+
+    // batched queries, processed in parallel
 
-    void knearest(const point_t &q, uint k, std::vector<uint> &indexes) ;
-    void knearest(const point_t &q, uint k, std::vector<uint> &indexes, std::vector<float> &distances) ;
+    // k nearest neighbours of each query. The output buffers should have room for queries.size() * k elements and the
+    // neighbours of query i are stored sorted by distance at [i*k, (i+1)*k). If the tree holds fewer than k points, the
+    // missing entries are filled with index -1 and distance FLT_MAX
+    void knearest(const point_list_t &queries, uint k, uint *indexes, float *distances) const ;
+    void knearest(const point_list_t &queries, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const ;
 
-    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) ;
-    void withinRadius(const point_t &q, float radius, std::vector<uint> &indexes, std::vector<float> &distances) ;
+    // points within radius of each query in compressed row layout i.e. the neighbours of query i are stored sorted by distance
+    // at [offsets[i], offsets[i+1])
+    void withinRadius(const point_list_t &queries, float radius, std::vector<size_t> &offsets,
+                      std::vector<uint> &indexes, std::vector<float> &distances) const ;
 
 private:
 
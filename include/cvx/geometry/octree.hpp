@@ -2,8 +2,14 @@
 #define CVX_OCTREE_HPP
 
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <vector>
 #include <functional>
+#include <type_traits>
+#include <cstdint>
+#include <limits>
+#include <algorithm>
+#include <cmath>
 
 #include <cvx/geometry/point_list.hpp>
 
@@ -24,6 +30,72 @@ inline bool operator < (const Vector3f &a, const Vector3f &b) {
 
 namespace cvx {
 
+class PinholeCamera ;
+
+// overlap of a query volume with an axis aligned cell
+enum class Overlap { Outside, Partial, Inside } ;
+
+inline Overlap boxOverlap(const Vector3f &qmin, const Vector3f &qmax, const Vector3f &bmin, const Vector3f &bmax) {
+    if ( ( bmax.array() < qmin.array() ).any() || ( bmin.array() > qmax.array() ).any() ) return Overlap::Outside ;
+    if ( ( bmin.array() >= qmin.array() ).all() && ( bmax.array() <= qmax.array() ).all() ) return Overlap::Inside ;
+    return Overlap::Partial ;
+}
+
+// squared distance of p to the cell, zero if inside
+inline float boxDistance(const Vector3f &p, const Vector3f &bmin, const Vector3f &bmax) {
+    return ( p - p.cwiseMax(bmin).cwiseMin(bmax) ).squaredNorm() ;
+}
+
+inline Overlap sphereOverlap(const Vector3f &center, float radius, const Vector3f &bmin, const Vector3f &bmax) {
+    float r2 = radius * radius ;
+    if ( boxDistance(center, bmin, bmax) > r2 ) return Overlap::Outside ;
+    // furthest corner of the cell
+    Vector3f corner = ( center - bmin ).cwiseAbs().cwiseMax(( center - bmax ).cwiseAbs()) ;
+    return ( corner.squaredNorm() <= r2 ) ? Overlap::Inside : Overlap::Partial ;
+}
+
+// View frustum of a pinhole camera placed at pose (camera to world transform), clipped between depths znear and zfar.
+// Lens distortion is ignored.
+
+class Frustum {
+public:
+
+    Frustum(const PinholeCamera &cam, const Eigen::Isometry3f &pose, float znear, float zfar) ;
+
+    bool contains(const Vector3f &p) const {
+        for( int i=0 ; i<6 ; i++ )
+            if ( normals_[i].dot(p) + offsets_[i] < 0 ) return false ;
+        return true ;
+    }
+
+    Overlap overlap(const Vector3f &bmin, const Vector3f &bmax) const {
+        bool inside = true ;
+        for( int i=0 ; i<6 ; i++ ) {
+            const Vector3f &n = normals_[i] ;
+            // corners of the cell furthest along and against the plane normal
+            Vector3f pv = ( n.array() >= 0 ).select(bmax, bmin) ;
+            Vector3f nv = ( n.array() >= 0 ).select(bmin, bmax) ;
+            if ( n.dot(pv) + offsets_[i] < 0 ) return Overlap::Outside ;
+            if ( n.dot(nv) + offsets_[i] < 0 ) inside = false ;
+        }
+        return inside ? Overlap::Inside : Overlap::Partial ;
+    }
+
+private:
+
+    // inside half-spaces n.p + d >= 0
+    Vector3f normals_[6] ;
+    float offsets_[6] ;
+} ;
+
+// Position of an octree payload used by spatial queries. Defined for point payloads; for other payloads (e.g. indices
+// into a cloud) pass a functor to the query.
+template<typename U> struct OctreePosition ;
+
+template<> struct OctreePosition<Vector3f> {
+    const Vector3f &operator()(const Vector3f &p) const { return p ; }
+} ;
+
 // Octree data structure parameterized by datatype U i.e. data representation for each point (it can be an index to an external container )
 template<typename U>
 class Octree
@@ -96,8 +168,137 @@ public:
         traverseRecursive(callback, bmin_, bmax_, root_);
     }
 
+    // Spatial queries. Results are written into the caller's buffer, which is cleared first so that it can be reused
+    // across queries without reallocation. Subtrees are pruned by their bounds and those entirely inside the query
+    // volume are collected without testing individual points. Distances are Euclidean (not squared).
+
+    // points inside the box [qmin, qmax]
+    template <class Pos = OctreePosition<U>>
+    void boxQuery(const Vector3f &qmin, const Vector3f &qmax, vector<U> &res, Pos pos = Pos()) const {
+        res.clear() ;
+        query(root_, bmin_, bmax_,
+              [&](const Vector3f &cmin, const Vector3f &cmax) { return boxOverlap(qmin, qmax, cmin, cmax) ; },
+              [&](const Vector3f &p) { return ( p.array() >= qmin.array() ).all() && ( p.array() <= qmax.array() ).all() ; },
+              res, pos) ;
+    }
+
+    // points within radius of center
+    template <class Pos = OctreePosition<U>>
+    void radiusQuery(const Vector3f &center, float radius, vector<U> &res, Pos pos = Pos()) const {
+        res.clear() ;
+        query(root_, bmin_, bmax_,
+              [&](const Vector3f &cmin, const Vector3f &cmax) { return sphereOverlap(center, radius, cmin, cmax) ; },
+              [&](const Vector3f &p) { return ( p - center ).squaredNorm() <= radius * radius ; },
+              res, pos) ;
+    }
+
+    // points inside the view frustum
+    template <class Pos = OctreePosition<U>>
+    void frustumQuery(const Frustum &frustum, vector<U> &res, Pos pos = Pos()) const {
+        res.clear() ;
+        query(root_, bmin_, bmax_,
+              [&](const Vector3f &cmin, const Vector3f &cmax) { return frustum.overlap(cmin, cmax) ; },
+              [&](const Vector3f &p) { return frustum.contains(p) ; },
+              res, pos) ;
+    }
+
+    // nearest point to q closer than max_dist, returns false if there is none
+    template <class Pos = OctreePosition<U>>
+    bool nearest(const Vector3f &q, U &res, float &dist, float max_dist = std::numeric_limits<float>::max(), Pos pos = Pos()) const {
+        return knearest(q, 1, &res, &dist, max_dist, pos) == 1 ;
+    }
+
+    // up to k nearest points to q closer than max_dist, sorted by distance. The buffers should have room for k elements,
+    // returns the number of points found
+    template <class Pos = OctreePosition<U>>
+    uint knearest(const Vector3f &q, uint k, U *res, float *dist, float max_dist = std::numeric_limits<float>::max(), Pos pos = Pos()) const {
+        if ( k == 0 || !root_ ) return 0 ;
+        uint count = 0 ;
+        // work with squared distances, bounded by max_dist until k points are found
+        float bound = ( max_dist < std::sqrt(std::numeric_limits<float>::max()) ) ? max_dist * max_dist : std::numeric_limits<float>::max() ;
+        knearestRecursive(root_, bmin_, bmax_, q, k, res, dist, count, bound, pos) ;
+        for( uint i=0 ; i<count ; i++ ) dist[i] = std::sqrt(dist[i]) ;
+        return count ;
+    }
+
 private:
 
+    static void childBounds(int i, const Vector3f &cmin, const Vector3f &cmax, const Vector3f &mid, Vector3f &bmin, Vector3f &bmax) {
+        bmin = Vector3f(( i & 1 ) ? mid.x() : cmin.x(), ( i & 2 ) ? mid.y() : cmin.y(), ( i & 4 ) ? mid.z() : cmin.z()) ;
+        bmax = Vector3f(( i & 1 ) ? cmax.x() : mid.x(), ( i & 2 ) ? cmax.y() : mid.y(), ( i & 4 ) ? cmax.z() : mid.z()) ;
+    }
+
+    static void collect(const Node *node, vector<U> &res) {
+        res.insert(res.end(), node->data_.begin(), node->data_.end()) ;
+        for( int i=0 ; i<8 ; i++ )
+            if ( node->children_[i] ) collect(node->children_[i], res) ;
+    }
+
+    template <class Classify, class Accept, class Pos>
+    static void query(const Node *node, const Vector3f &cmin, const Vector3f &cmax, const Classify &classify,
+                      const Accept &accept, vector<U> &res, const Pos &pos) {
+        if ( !node ) return ;
+
+        Overlap o = classify(cmin, cmax) ;
+        if ( o == Overlap::Outside ) return ;
+        if ( o == Overlap::Inside ) {
+            collect(node, res) ;
+            return ;
+        }
+
+        for( const U &d: node->data_ )
+            if ( accept(pos(d)) ) res.push_back(d) ;
+
+        Vector3f mid = ( cmax - cmin ) * 0.5f + cmin ;
+        for( int i=0 ; i<8 ; i++ ) {
+            if ( !node->children_[i] ) continue ;
+            Vector3f bmin, bmax ;
+            childBounds(i, cmin, cmax, mid, bmin, bmax) ;
+            query(node->children_[i], bmin, bmax, classify, accept, res, pos) ;
+        }
+    }
+
+    // bound is the squared distance of the k-th neighbour found so far (or of max_dist)
+    template <class Pos>
+    static void knearestRecursive(const Node *node, const Vector3f &cmin, const Vector3f &cmax, const Vector3f &q, uint k,
+                                  U *res, float *dist, uint &count, float &bound, const Pos &pos) {
+        for( const U &d: node->data_ ) {
+            float dd = ( pos(d) - q ).squaredNorm() ;
+            if ( dd >= bound ) continue ;
+
+            uint i = std::min(count, k - 1) ;
+            for( ; i>0 && dist[i-1] > dd ; --i ) {
+                dist[i] = dist[i-1] ;
+                res[i] = res[i-1] ;
+            }
+            dist[i] = dd ;
+            res[i] = d ;
+            if ( count < k ) ++count ;
+            if ( count == k ) bound = dist[k-1] ;
+        }
+
+        // visit children closest first
+        Vector3f mid = ( cmax - cmin ) * 0.5f + cmin ;
+        std::pair<float, int> order[8] ;
+        Vector3f bmin[8], bmax[8] ;
+        int n_children = 0 ;
+
+        for( int i=0 ; i<8 ; i++ ) {
+            if ( !node->children_[i] ) continue ;
+            childBounds(i, cmin, cmax, mid, bmin[i], bmax[i]) ;
+            std::pair<float, int> c(boxDistance(q, bmin[i], bmax[i]), i) ;
+            int j = n_children++ ;
+            for( ; j>0 && order[j-1].first > c.first ; --j ) order[j] = order[j-1] ;
+            order[j] = c ;
+        }
+
+        for( int c=0 ; c<n_children ; c++ ) {
+            if ( order[c].first >= bound ) break ;
+            int i = order[c].second ;
+            knearestRecursive(node->children_[i], bmin[i], bmax[i], q, k, res, dist, count, bound, pos) ;
+        }
+    }
+
     void traverseRecursive(const std::function<bool (const Vector3f &, const Vector3f &, const vector<U> &)> &callback,
                            const Vector3f& currMin, const Vector3f& currMax,
                            Node* currNode)  {
@@ -120,6 +321,172 @@ private:
 typedef Octree<Vector3f> OctreeCloud ; // points are stored inside the nodes
 typedef Octree<uint> OctreeIndexed ;   // indexes to data stored ;
 
+// Linear octree: same subdivision as Octree (cells are halved while larger than the cell size) but built in bulk by
+// sorting the Morton codes of the leaf cells. Nodes are stored in a flat array in depth-first order and the payloads of
+// the points in another array sorted by leaf, so the payloads of any subtree are contiguous. Child order is the same as
+// in Octree (bit 1 for x, 2 for y and 4 for z), hence traversal order is preserved.
+
+class LinearOctreeBase
+{
+public:
+
+    struct Node {
+        uint64_t code_ ;    // Morton code of the cell at its level
+        uint32_t level_ ;   // 0 for the root
+        uint32_t next_ ;    // index of the node following the subtree
+        uint32_t first_leaf_, last_leaf_ ; // range of leaves under the node
+    } ;
+
+    LinearOctreeBase(const Vector3f &bmin, const Vector3f &bmax, const Vector3f &cell) ;
+
+    // number of subdivisions from the root to the leaves (at most 21)
+    uint depth() const { return depth_ ; }
+
+    size_t numNodes() const { return nodes_.size() ; }
+    const Node &node(size_t i) const { return nodes_[i] ; }
+
+    size_t numLeaves() const { return leaf_codes_.size() ; }
+
+    // bounds of node or leaf
+    void cellBounds(const Node &node, Vector3f &bmin, Vector3f &bmax) const { cellBounds(node.code_, node.level_, bmin, bmax) ; }
+    void leafBounds(size_t leaf, Vector3f &bmin, Vector3f &bmax) const { cellBounds(leaf_codes_[leaf], depth_, bmin, bmax) ; }
+
+    // Morton code of the leaf cell containing p. Points outside the bounds are clamped to the border cells
+    uint64_t leafCode(const Vector3f &p) const ;
+
+protected:
+
+    // sort points by leaf and build the node hierarchy, perm receives the sorted order of the points
+    void index(const PointList3f &pos, std::vector<uint> &perm) ;
+
+    void cellBounds(uint64_t code, uint level, Vector3f &bmin, Vector3f &bmax) const ;
+
+    Vector3f bmin_, bmax_, cell_ ;
+    uint depth_ ;
+    std::vector<uint64_t> leaf_codes_ ;
+    std::vector<uint> leaf_offsets_ ;   // payloads of leaf i are at [leaf_offsets_[i], leaf_offsets_[i+1])
+    std::vector<Node> nodes_ ;
+} ;
+
+template<typename U>
+class LinearOctree: public LinearOctreeBase
+{
+public:
+
+    // contiguous range of payloads
+    struct Range {
+        const U *begin_, *end_ ;
+
+        const U *begin() const { return begin_ ; }
+        const U *end() const { return end_ ; }
+        size_t size() const { return end_ - begin_ ; }
+        bool empty() const { return begin_ == end_ ; }
+        const U &operator[](size_t i) const { return begin_[i] ; }
+    } ;
+
+    struct Leaf {
+        Vector3f bmin_, bmax_ ;
+        Range data_ ;
+    } ;
+
+    class const_iterator {
+    public:
+        const_iterator(const LinearOctree<U> &tree, size_t leaf): tree_(tree), leaf_(leaf) {}
+
+        Leaf operator * () const {
+            Leaf l ;
+            tree_.leafBounds(leaf_, l.bmin_, l.bmax_) ;
+            l.data_ = tree_.leafData(leaf_) ;
+            return l ;
+        }
+
+        const_iterator &operator ++ () { ++leaf_ ; return *this ; }
+        bool operator != (const const_iterator &other) const { return leaf_ != other.leaf_ ; }
+        bool operator == (const const_iterator &other) const { return leaf_ == other.leaf_ ; }
+
+    private:
+        const LinearOctree<U> &tree_ ;
+        size_t leaf_ ;
+    } ;
+
+    // create octree with given bounds and cell size
+    LinearOctree(const Vector3f &bmin, const Vector3f &bmax, const Vector3f &cell): LinearOctreeBase(bmin, bmax, cell) {}
+
+    // queue a point and associated data; the tree is updated on build()
+    void insert(const Vector3f &pos, const U &data) {
+        pos_.push_back(pos) ;
+        pending_.push_back(data) ;
+    }
+
+    // (re)build the tree from all inserted points
+    void build() {
+        std::vector<uint> perm ;
+        index(pos_, perm) ;
+        data_.resize(perm.size()) ;
+
+#pragma omp parallel for
+        for( size_t i=0 ; i<perm.size() ; i++ )
+            data_[i] = pending_[perm[i]] ;
+    }
+
+    // build in one go from positions and their data, discarding any inserted points
+    void build(const PointList3f &pos, const std::vector<U> &data) {
+        assert( pos.size() == data.size() ) ;
+        std::vector<uint> perm ;
+        index(pos, perm) ;
+        data_.resize(perm.size()) ;
+
+#pragma omp parallel for
+        for( size_t i=0 ; i<perm.size() ; i++ )
+            data_[i] = data[perm[i]] ;
+
+        pos_.clear() ;
+        pending_.clear() ;
+    }
+
+    // build from positions using the point indices as data (for integral U, e.g. LinearOctreeIndexed)
+    void build(const PointList3f &pos) {
+        static_assert(std::is_integral<U>::value, "point indices require an integral payload type") ;
+        std::vector<uint> perm ;
+        index(pos, perm) ;
+        data_.assign(perm.begin(), perm.end()) ;
+        pos_.clear() ;
+        pending_.clear() ;
+    }
+
+    // data of the points in the subtree of a node or in a leaf
+    Range nodeData(const Node &node) const { return range(leaf_offsets_[node.first_leaf_], leaf_offsets_[node.last_leaf_]) ; }
+    Range leafData(size_t leaf) const { return range(leaf_offsets_[leaf], leaf_offsets_[leaf+1]) ; }
+
+    // iteration over the non-empty leaves in depth-first order
+    const_iterator begin() const { return const_iterator(*this, 0) ; }
+    const_iterator end() const { return const_iterator(*this, numLeaves()) ; }
+
+    // Visit nodes depth-first, calling visitor(bmin, bmax, data) with the bounds of the node and its payloads (empty for
+    // internal nodes, as in Octree::traverse). The children of a node are skipped if the visitor returns false
+    template <class Visitor>
+    void traverse(Visitor &&visitor) const {
+        size_t i = 0 ;
+        while ( i < nodes_.size() ) {
+            const Node &n = nodes_[i] ;
+            Vector3f cmin, cmax ;
+            cellBounds(n, cmin, cmax) ;
+            Range data = ( n.level_ == depth_ ) ? leafData(n.first_leaf_) : range(0, 0) ;
+            i = visitor(cmin, cmax, data) ? i + 1 : n.next_ ;
+        }
+    }
+
+private:
+
+    Range range(size_t first, size_t last) const { return Range{data_.data() + first, data_.data() + last} ; }
+
+    PointList3f pos_ ;
+    std::vector<U> pending_ ;
+    std::vector<U> data_ ;
+} ;
+
+typedef LinearOctree<uint> LinearOctreeIndexed ;
+
 // Subsampling of pointcloud be means of octree. The average of points inside each leaf node is computed and then the point closest to it is selected.
 void sampleCloudCenters(const PointList3f &cloud, float min_cell_size_, PointList3f &res, const Vector3f &rmin, const Vector3f &rmax) ;
 
@@ -2,6 +2,7 @@
 #define CVX_IMGPROC_CONCOMP_HPP
 
 #include <memory>
+#include <vector>
 #include <opencv2/opencv.hpp>
 
 namespace cvx {
@@ -11,56 +12,84 @@ namespace cvx {
 
 unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, int nc = 8) ;
 
+// statistics of a region computed while labelling
+
+struct RegionStats {
+    unsigned int label_ ;
+    unsigned int area_ ;
+    cv::Rect rect_ ;                // bounding rectangle
+    cv::Point2d centroid_ ;
+    double mu20_, mu11_, mu02_ ;    // second order central moments divided by the area
+    unsigned int first_run_, n_runs_ ; // range of the region in the run-length encoding, if requested
+} ;
+
+// pixels [x0, x1) of row y
+struct RegionRun {
+    int y_, x0_, x1_ ;
+} ;
+
+// As above but also returns the statistics of each region in a vector indexed by label. If runs is given it receives
+// the run-length encoding of the regions, grouped by region and in raster order within each region.
+
+unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, std::vector<RegionStats> &stats, int nc = 8,
+                                 std::vector<RegionRun> *runs = nullptr) ;
+
 // class for iterating over regions/blobs returned by connected components
 
 class RegionIterator {
 
 public:
 
-    RegionIterator(const cv::Mat &src): src_(src) {
-        reset(src) ;
-    }
+    // regions of a label image (32-bit, any label values, INT_MAX for background) by increasing label as unsigned,
+    // gathered in a single pass
+    RegionIterator(const cv::Mat &src) ;
+
+    // regions of the output of connectedComponents
+    RegionIterator(const cv::Mat &labels, std::vector<RegionStats> &&stats, std::vector<RegionRun> &&runs) ;
 
-    RegionIterator(const RegionIterator &other): src_(other.src_), data_(other.data_), it_(other.it_) {}
-    RegionIterator(): src_(cv::Mat()), data_(new ContainerType), it_(data_->end()) {}
+    RegionIterator(): data_(new Regions), idx_(0) {}
 
-    bool operator == (const RegionIterator &other) const { return it_ == other.it_ ; }
-    bool operator != (const RegionIterator &other) const { return it_ != other.it_ ; }
+    bool operator == (const RegionIterator &other) const { return data_ == other.data_ && idx_ == other.idx_ ; }
+    bool operator != (const RegionIterator &other) const { return !( *this == other ) ; }
 
-    operator int () const { return it_ != data_->end() ; }
-    RegionIterator & operator++()  { ++it_ ; return *this ; }
-    RegionIterator operator++(int) { RegionIterator tmp(*this) ; ++it_; return tmp ; }
+    operator int () const { return idx_ < data_->stats_.size() ; }
+    RegionIterator & operator++()  { ++idx_ ; return *this ; }
+    RegionIterator operator++(int) { RegionIterator tmp(*this) ; ++idx_ ; return tmp ; }
 
     // return area of the region
-    unsigned int area() const { return it_->second.area_ ; }
+    unsigned int area() const { return stats().area_ ; }
 
     // return outer contour of the region
     std::vector<cv::Point> contour() const ;
 
     // return label of the region
-    unsigned int label() const { return it_->second.label_; }
+    unsigned int label() const { return stats().label_ ; }
 
     // return bounding rectangle
-    cv::Rect rect() const { return it_->second.rect_ ; }
+    cv::Rect rect() const { return stats().rect_ ; }
+
+    cv::Point2d centroid() const { return stats().centroid_ ; }
+
+    const RegionStats &stats() const { return data_->stats_[idx_] ; }
 
     // return mask of the same size as the source image with region pixels set to 255
     cv::Mat mask() const ;
 
 private:
 
-    void reset(const cv::Mat &src) ;
+    friend RegionIterator findLargestBlob(const cv::Mat &, unsigned int) ;
 
-    struct RegionData {
-        unsigned int label_ ;
-        cv::Rect rect_ ;
-        unsigned int area_ ;
-    };
+    struct Regions {
+        cv::Mat labels_ ;
+        std::vector<RegionStats> stats_ ;
+        std::vector<RegionRun> runs_ ;
+    } ;
 
-    typedef std::map<unsigned int, RegionData> ContainerType ;
+    // mask of the region with a one pixel border around its bounding rectangle
+    cv::Mat localMask() const ;
 
-    std::shared_ptr<ContainerType> data_ ;
-    ContainerType::const_iterator it_ ;
-    cv::Mat src_ ;
+    std::shared_ptr<const Regions> data_ ;
+    size_t idx_ ;
 };
 
 // performs connected components analysis on the source binary image (CV_8UC1) and finds the largest blob. It returns
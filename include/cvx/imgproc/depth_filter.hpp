@@ -0,0 +1,98 @@
+#ifndef CVX_IMGPROC_DEPTH_FILTER_HPP
+#define CVX_IMGPROC_DEPTH_FILTER_HPP
+
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace cvx {
+
+// Edge preserving filters for 16bit depth images (0 marks missing depth). Rows are processed in parallel; the per pixel
+// kernels use SSE4.1 when available.
+
+// Fills short runs of missing depth along rows and then along columns. A run bounded by valid depths on both sides is
+// linearly interpolated if the depths are close, otherwise it is filled with the farther one so that foreground does not
+// bleed into the background.
+
+class DepthHoleFilling {
+public:
+
+    struct Parameters {
+        uint max_hole_size_ ;   // longer runs are left empty
+        ushort max_depth_jump_ ; // larger differences across a hole are treated as a discontinuity
+
+        Parameters():
+            max_hole_size_(8),
+            max_depth_jump_(50)
+        {}
+    } ;
+
+    DepthHoleFilling(const Parameters &params = Parameters()): params_(params) {}
+
+    void apply(const cv::Mat &depth, cv::Mat &res) const ;
+
+private:
+
+    Parameters params_ ;
+} ;
+
+// Upsamples a low resolution depth image to the resolution of a registered colour (CV_8UC3) or gray (CV_8UC1) guide
+// image. Each output depth is the average of the valid low resolution depths in a window, weighted by their distance and
+// by the similarity of the guide at the output pixel and at the low resolution sample. Weights are tabulated on
+// construction.
+
+class JointBilateralUpsampling {
+public:
+
+    struct Parameters {
+        uint radius_ ;          // window radius in low resolution pixels
+        float sigma_space_ ;    // in low resolution pixels
+        float sigma_color_ ;    // per channel intensity difference
+
+        Parameters():
+            radius_(2),
+            sigma_space_(1.0),
+            sigma_color_(12.0)
+        {}
+    } ;
+
+    JointBilateralUpsampling(const Parameters &params = Parameters()) ;
+
+    void apply(const cv::Mat &depth, const cv::Mat &guide, cv::Mat &res) const ;
+
+private:
+
+    Parameters params_ ;
+    std::vector<float> space_weights_, color_weights_ ;
+} ;
+
+// Exponential smoothing of a depth stream. The state of a pixel restarts from the new measurement when it was empty or
+// the depth moved by more than max_difference_; missing depth clears it.
+
+class TemporalDepthFilter {
+public:
+
+    struct Parameters {
+        float alpha_ ;          // weight of the new frame
+        float max_difference_ ; // in depth units
+
+        Parameters():
+            alpha_(0.3),
+            max_difference_(30)
+        {}
+    } ;
+
+    TemporalDepthFilter(const Parameters &params = Parameters()): params_(params) {}
+
+    void apply(const cv::Mat &depth, cv::Mat &res) ;
+
+    void reset() { state_.release() ; }
+
+private:
+
+    Parameters params_ ;
+    cv::Mat state_ ;
+} ;
+
+}
+
+#endif
@@ -1,8 +1,11 @@
 #ifndef CVX_IMGPROC_GABOR_HPP
 #define CVX_IMGPROC_GABOR_HPP
 
+#include <vector>
 #include <opencv2/opencv.hpp>
 
+#include <cvx/ml/dataset.hpp>
+
 namespace cvx {
 
 // Gabor filter-bank creation
@@ -11,6 +14,92 @@ void makeGaborFilterBank(int nOctaves, int nAngles, double sigma, std::vector<cv
 // filter image with filter-bank
 void applyGaborFilterBank(const cv::Mat &src, std::vector<cv::Mat> &kernels, std::vector<cv::Mat> &responses) ;
 
+// Filter-bank engine for repeated filtering of images of the same size. The output is that of applyGaborFilterBank: for
+// each (real, imaginary) kernel pair, the magnitude of the response scaled to [0, 1].
+// All kernels are applied in the frequency domain from a single forward FFT of the (border extended) image; each pair
+// is packed into one complex kernel so it costs one inverse FFT regardless of its size. Kernel spectra are computed on
+// the first image of a given size and cached, and the responses are written into the given matrices, which are only
+// reallocated when their size changes.
+
+class GaborFilterBank {
+public:
+
+    GaborFilterBank(int nOctaves, int nAngles, double sigma) ;
+    GaborFilterBank(const std::vector<cv::Mat> &kernels) ;
+
+    // number of kernel pairs (responses)
+    size_t size() const { return kernels_.size() / 2 ; }
+
+    const std::vector<cv::Mat> &kernels() const { return kernels_ ; }
+
+    // single channel image of any depth
+    void apply(const cv::Mat &src, std::vector<cv::Mat> &responses) ;
+
+private:
+
+    void prepare(const cv::Size &sz) ;
+
+    std::vector<cv::Mat> kernels_ ;
+    int border_ ;                       // half size of the largest kernel
+    cv::Size image_size_, dft_size_ ;
+    std::vector<cv::Mat> spectra_ ;     // one complex spectrum per kernel pair
+    cv::Mat padded_, spectrum_ ;
+} ;
+
+// Per-pixel (or per-cell) Gabor feature vectors: feature k of a sample is the magnitude of the response to kernel pair k,
+// averaged over the cell when cell_size_ > 1. The image is filtered in square tiles processed in parallel, each with
+// its own FFT of the tile plus the kernel margin, so the working memory depends on the tile size and not on the image.
+// The features are written directly into the output, which can be an interleaved tensor, the sample matrix of a
+// MatDataset or any strided buffer.
+
+class GaborFeatureExtractor {
+public:
+
+    enum Normalization { None,      // raw magnitudes
+                         MinMax,    // each feature scaled to [0, 1] over the image, as applyGaborFilterBank
+                         L2         // each feature vector scaled to unit length
+                       } ;
+
+    struct Parameters {
+        Parameters(): tile_size_(256), cell_size_(1), normalization_(MinMax) {}
+
+        int tile_size_ ;                // side of the tiles, rounded up to a multiple of the cell size
+        int cell_size_ ;                // side of the pooling cells, 1 gives one sample per pixel
+        Normalization normalization_ ;
+    } ;
+
+    GaborFeatureExtractor(const std::vector<cv::Mat> &kernels, const Parameters &params = Parameters()) ;
+
+    // feature dimension
+    size_t size() const { return kernels_.size() / 2 ; }
+
+    // number of cells along each image dimension, partial cells on the right and bottom are included
+    cv::Size gridSize(const cv::Size &image_size) const ;
+
+    // interleaved gridSize() x size() tensor of type CV_32FC(size()), reallocated only when its size changes
+    void compute(const cv::Mat &src, cv::Mat &features) ;
+
+    // one sample per cell in raster order, the feature k of sample i is written at dst[i * sample_stride + k * feature_stride]
+    void compute(const cv::Mat &src, float *dst, size_t sample_stride, size_t feature_stride) ;
+
+    // fill the samples of the dataset, the (column-major) sample matrix is written in place
+    template<typename L>
+    void compute(const cv::Mat &src, MatDataset<float, L> &ds) {
+        cv::Size grid = gridSize(src.size()) ;
+        Eigen::MatrixXf &samples = ds.mat() ;
+        samples.resize((Eigen::Index)grid.width * grid.height, size()) ;
+        compute(src, samples.data(), 1, samples.rows()) ;
+    }
+
+private:
+
+    std::vector<cv::Mat> kernels_ ;
+    Parameters params_ ;
+    int border_, tile_size_ ;
+    cv::Size dft_size_ ;
+    std::vector<cv::Mat> spectra_ ;     // kernel spectra for the tile transform size
+} ;
+
 }
 
 #endif
@@ -5,10 +5,51 @@
 
 #include <cvx/camera/camera.hpp>
 #include <cvx/geometry/point_list.hpp>
+#include <cvx/pcl/organized_cloud.hpp>
 
 namespace cvx {
 
+// Colour coding of 16bit depth images for display. Depth is scaled linearly to [0, 1] within the given range (by default
+// the range of the non-zero depths of each image) and mapped to a colour; missing (zero) depth is black. Colour tables
+// are built once per colormap and shared. Output is CV_8UC3, in BGR order unless bgr_ is false.
+
+class DepthVisualizer {
+public:
+
+    enum ColorMap { Hue, Jet, Gray, Turbo } ;
+
+    struct Parameters {
+        ColorMap colormap_ ;
+        ushort min_depth_, max_depth_ ;   // fixed range, 0 to take the bound from the image
+        bool bgr_ ;                       // channel order of the output, false for RGB
+
+        Parameters():
+            colormap_(Hue),
+            min_depth_(0),
+            max_depth_(0),
+            bgr_(true)
+        {}
+    } ;
+
+    DepthVisualizer(const Parameters &params = Parameters()) ;
+
+    // res is reallocated only if it does not have the size and type of the output
+    void apply(const cv::Mat &depth, cv::Mat &res) const ;
+
+    cv::Mat apply(const cv::Mat &depth) const {
+        cv::Mat res ;
+        apply(depth, res) ;
+        return res ;
+    }
+
+private:
+
+    Parameters params_ ;
+    const cv::Vec3b *lut_ ;
+} ;
+
 // convert depth image (16bit) to colored mapped image (maps depth value scaled tp [0, 1] to color Hue).
+// The output is in RGB order and the given range is extended to that of the image.
 cv::Mat depthViz(const cv::Mat &depth, ushort minv = 0, ushort maxv = 0) ;
 
 // Safely samples depth map to obtain depth value at (x, y) and a region of size [-ws, ws] around it.
@@ -18,9 +59,25 @@ bool sampleNearestNonZeroDepth(const cv::Mat &dim, int x, int y, ushort &z, int
 // same as above but also performs bilinear interpolation
 bool sampleBilinearDepth(const cv::Mat &dim, float x, float y, float &z,int ws=1) ;
 
-// create point cloud from depth image
+// Batch versions of the above for many points, processed in parallel. valid[i] is set to 0 (and z[i] to 0) when no depth
+// is found for pts[i]. All sampling functions are thread safe.
+void sampleNearestNonZeroDepth(const cv::Mat &dim, const std::vector<cv::Point> &pts, std::vector<ushort> &z, std::vector<uchar> &valid, int ws=1) ;
+void sampleBilinearDepth(const cv::Mat &dim, const std::vector<cv::Point2f> &pts, std::vector<float> &z, std::vector<uchar> &valid, int ws=1) ;
+
+// Create point cloud from depth image, appending the valid points of every sampling-th row and column to coords.
+// depth_unit is the size of a depth value in meters; if 0 depth is taken to be in millimeters for 16bit images and in
+// meters for float images. Zero, NaN and infinite depths are missing.
+
+void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model, PointList3f &coords, uint sampling = 1, float depth_unit = 0) ;
+
+// organised version: one point per pixel stored row by row, with NaN coordinates for missing depth.
+
+void depthToVertexMap(const cv::Mat &depth, const PinholeCamera &model, PointList3f &vertices, float depth_unit = 0) ;
+
+// organised cloud with the size of the depth image. If rgb (CV_8UC3, registered to depth) is given the cloud also
+// carries colours.
 
-void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model_, PointList3f &coords, uint sampling = 1) ;
+void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model, OrganizedPointCloud &cloud, const cv::Mat &rgb = cv::Mat(), float depth_unit = 0) ;
 
 }
 
@@ -3,6 +3,12 @@
 
 #include <cvx/math/rng.hpp>
 #include <cassert>
+#include <cmath>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
 
 namespace cvx {
 /*
@@ -15,74 +21,439 @@ namespace cvx {
  *      float computeResidual(const vector<size_t> &inliers) ; // fit the model onto the inliers and compute resiudal
  *  };
  *
+ *  fit() is also called on subsets larger than minSamples (all the inliers, and inlier subsets in local optimisation).
+ *
+ *  Optionally the model may implement
+ *      bool isInlier(const ModelParams &params, size_t idx) const ;
+ *  to have hypotheses verified point by point and abandoned early by the SPRT test.
+ *
  *  Optionally you can supply a sampling function of the form:
  *  sampler(RNG &rng, int n, int total, vector<size_t> &samples)
  *
+ *  The model and sampler are called concurrently from several threads, each with its own RNG, and ModelParams should be
+ *  copyable.
+ *
  */
 class RANSAC {
 public:
 
-    // min_inliers is the minimum numbers of inliers to assume that the model fir is good
-    explicit RANSAC(int max_trials, int min_inliers): max_trials_(max_trials), min_inliers_(min_inliers) {}
+    struct Parameters {
+        Parameters(): max_trials_(1000), min_inliers_(0), seed_(0), confidence_(0.99), lo_iterations_(10), lo_sample_size_(0),
+            lo_refits_(4), sprt_(true), sprt_epsilon_(0), sprt_delta_(0.01), sprt_model_cost_(200), prosac_growth_(200000) {}
+
+        int max_trials_ ;           // upper bound on the number of hypotheses
+        int min_inliers_ ;          // minimum numbers of inliers to assume that the model fit is good
+        uint64_t seed_ ;            // the result only depends on the seed and not on the number of threads
+        double confidence_ ;        // stop once an all-inlier sample has been drawn with this probability, 1 runs all trials
+        int lo_iterations_ ;        // inner RANSAC iterations of the local optimisation of the best model, 0 disables it
+        int lo_sample_size_ ;       // size of the inlier subsets fitted by the local optimisation, 0 for 7 * minSamples
+        int lo_refits_ ;            // iterative refits on all inliers after the inner RANSAC
+        bool sprt_ ;                // preemptive verification with the sequential probability ratio test (needs Model::isInlier)
+        double sprt_epsilon_ ;      // initial estimate of the inlier ratio, 0 for min_inliers_ / n (at least sprt_delta_)
+        double sprt_delta_ ;        // initial estimate of the probability that a point is consistent with a wrong model
+        double sprt_model_cost_ ;   // time of fitting a hypothesis in units of verifying a point
+        int prosac_growth_ ;        // number of PROSAC samples after which the sampling is uniform over all the data
+    } ;
+
+    // counters of the last call to estimate
+    struct Stats {
+        int trials_ = 0 ;           // hypotheses drawn
+        int sprt_rejected_ = 0 ;    // hypotheses abandoned by the preemptive test
+        int lo_runs_ = 0 ;          // local optimisations (of the final model)
+    } ;
+
+    explicit RANSAC(const Parameters &params): params_(params) {}
+    explicit RANSAC(int max_trials, int min_inliers, uint64_t seed = 0) {
+        params_.max_trials_ = max_trials ;
+        params_.min_inliers_ = min_inliers ;
+        params_.seed_ = seed ;
+    }
     RANSAC() = default ;
 
+    void setSeed(uint64_t seed) { params_.seed_ = seed ; }
+
+    // Quality score of each data point (higher is better) to draw the samples progressively from the best points first
+    // (PROSAC), instead of using the sampler. An empty vector returns to uniform sampling.
+    void setQuality(const std::vector<float> &quality) {
+        order_.resize(quality.size()) ;
+        for( size_t i=0 ; i<order_.size() ; i++ ) order_[i] = i ;
+        std::stable_sort(order_.begin(), order_.end(), [&](size_t a, size_t b) { return quality[a] > quality[b] ; }) ;
+        rank_.resize(order_.size()) ;
+        for( size_t i=0 ; i<order_.size() ; i++ ) rank_[order_[i]] = i ;
+    }
+
+    const Stats &stats() const { return stats_ ; }
+
     using Sampler = std::function<bool(RNG&, int, int, std::vector<size_t>&)> ;
 
+    // n distinct indices out of total by rejection, n is small so this avoids the O(total) index table of RNG::sample
     static bool defaultSampler(RNG &rng, int n, int total, std::vector<size_t> &samples) {
-        rng.sample(n, total, samples) ;
+        std::uniform_int_distribution<size_t> ud(0, total - 1) ;
+        samples.clear() ;
+        while ( samples.size() < (size_t)n ) {
+            size_t idx = ud(rng.generator()) ;
+            if ( std::find(samples.begin(), samples.end(), idx) == samples.end() ) samples.push_back(idx) ;
+        }
         return true ;
     }
 
-    struct best_t{
-        float residual_ = std::numeric_limits<double>::max();
-        std::vector<size_t> subset_;
-    } ;
-
     template <typename Model, typename Params>
     bool estimate(size_t n, Model &model, std::vector<size_t> &best_subset, Params &best_params, Sampler sampler = defaultSampler ) {
         size_t N = Model::minSamples ;
 
         assert( N <= n ) ;
+        assert( order_.empty() || order_.size() == n ) ;
 
-#pragma omp declare reduction(get_min : struct best_t :\
-    omp_out = (omp_in.residual_ < omp_out.residual_) ? omp_in : omp_out)\
-    initializer (omp_priv=best_t{})
+        // Trials are split in fixed blocks, each drawing from its own random stream seeded from the block index, so
+        // the hypotheses do not depend on which thread runs the block. Finished blocks are merged in index order and
+        // the number of trials needed for the requested confidence is updated from the best hypothesis of the merged
+        // prefix; blocks past that point are skipped. Blocks are run in waves and the preemptive test of a wave starts
+        // from the inlier ratio of the best hypothesis of the previous ones. The result is thus the same for any number
+        // of threads.
 
-        best_t best ;
-#pragma omp parallel for shared(model, sampler, N, n, rng_) reduction(get_min : best) schedule(static)
-        for( size_t trial_count = 0 ; trial_count < max_trials_ ; trial_count ++)  {
-            std::vector<size_t> subset, inliers ;
-            Params params ;
-            if ( sampler(rng_, N, n, subset) ) {
+        stats_ = Stats() ;
+
+        const int max_trials = params_.max_trials_ ;
+        const int n_blocks = ( max_trials + block_size - 1 ) / block_size ;
+
+        std::vector<Hypothesis<Params>> block_best(n_blocks) ;
+        std::vector<Stats> block_stats(n_blocks) ;
+        std::vector<std::vector<size_t>> block_ranks(order_.empty() ? 0 : n_blocks) ;
+        std::vector<char> done(n_blocks, 0) ;
+
+        Hypothesis<Params> best ;
+        int merged = 0, stop = n_blocks ;
+        std::vector<size_t> best_ranks ;   // quality ranks of the inliers of the best hypothesis, with PROSAC
+
+        // points are verified in random order by the preemptive test, with a low initial inlier ratio so that good
+        // models are not rejected when there are few inliers
+        const bool sprt = params_.sprt_ && has_is_inlier<Model, Params>::value ;
+        const double sprt_epsilon = ( params_.sprt_epsilon_ > 0 ) ? params_.sprt_epsilon_ : std::max(minInliers() / (double)n, params_.sprt_delta_) ;
+        std::vector<size_t> verify_order ;
+        if ( sprt ) {
+            RNG rng(streamSeed(params_.seed_, ~0ULL)) ;
+            rng.sequence(n, verify_order) ;
+        }
+
+        std::vector<int> prosac_schedule ;
+        if ( !order_.empty() ) makeProsacSchedule(n, N, prosac_schedule) ;
+
+        for( int first = 0 ; first < stop ; first += wave_size ) {
+            const int last = std::min(first + wave_size, n_blocks) ;
+            const double epsilon = ( best.trial_ < 0 ) ? sprt_epsilon : std::max(sprt_epsilon, best.n_inliers_ / (double)n) ;
 
-                if ( model.fit(subset, params) ) { // try to fit the model to the subset of measurements returning the obtained model parameters and a success flag
+#pragma omp parallel
+            {
+                RNG rng(0) ;
+                std::vector<size_t> subset, inliers ;
+                Params params ;
 
-                    // compute inliers given the model parameters
-                    model.findInliers(params, inliers) ;
+#pragma omp for schedule(dynamic)
+                for( int b = first ; b < last ; b++ ) {
+                    int stop_b ;
+#pragma omp atomic read
+                    stop_b = stop ;
+                    if ( b >= stop_b ) continue ;
 
-                    if ( inliers.size() > min_inliers_ ) {
+                    rng.generator().seed(streamSeed(params_.seed_, b)) ;
 
-                        float residual = model.computeResidual(inliers) ;
+                    Hypothesis<Params> &bbest = block_best[b] ;
+                    Stats &bstats = block_stats[b] ;
+                    SPRT test(epsilon, params_.sprt_delta_, params_.sprt_model_cost_) ;
 
-                        if ( residual < best.residual_ ) {
-                            best = best_t{residual, inliers};
+                    for( int trial = b * block_size ; trial < std::min(max_trials, ( b + 1 ) * block_size) ; trial++ ) {
+                        bstats.trials_ ++ ;
+
+                        if ( !order_.empty() ) prosacSample(rng, trial, N, prosac_schedule, subset) ;
+                        else {
+                            subset.clear() ;
+                            if ( !sampler(rng, N, n, subset) ) continue ;
+                        }
+
+                        // try to fit the model to the subset of measurements returning the obtained model parameters and a success flag
+                        if ( !model.fit(subset, params) ) continue ;
+
+                        // compute inliers given the model parameters
+                        inliers.clear() ;
+                        if constexpr ( has_is_inlier<Model, Params>::value ) {
+                            if ( sprt && !test.verify(model, params, verify_order, inliers) ) {
+                                bstats.sprt_rejected_ ++ ;
+                                continue ;
+                            }
+                        }
+                        if ( !sprt ) model.findInliers(params, inliers) ;
+
+                        if ( inliers.size() > minInliers() ) {
+                            float residual = model.computeResidual(inliers) ;
+
+                            if ( bbest.improvedBy(residual, inliers.size(), trial) ) {
+                                bbest.set(residual, inliers.size(), trial, params) ;
+                                test.setInlierRatio(inliers.size() / (double)n) ;
+
+                                if ( !order_.empty() ) {
+                                    std::vector<size_t> &ranks = block_ranks[b] ;
+                                    ranks.clear() ;
+                                    for( size_t idx: inliers ) ranks.push_back(rank_[idx]) ;
+                                    std::sort(ranks.begin(), ranks.end()) ;
+                                }
+                            }
+                        }
+                    }
+
+#pragma omp critical
+                    {
+                        done[b] = 1 ;
+
+                        for( ; merged < stop && done[merged] ; merged++ ) {
+                            const Hypothesis<Params> &h = block_best[merged] ;
+                            stats_.trials_ += block_stats[merged].trials_ ;
+                            stats_.sprt_rejected_ += block_stats[merged].sprt_rejected_ ;
+
+                            if ( best.improvedBy(h.residual_, h.n_inliers_, h.trial_) ) {
+                                best = h ;
+                                if ( !order_.empty() ) best_ranks.swap(block_ranks[merged]) ;
+                            }
+
+                            const int trials = std::min(max_trials, ( merged + 1 ) * block_size) ;
+                            int required = requiredTrials(best.n_inliers_, n, N) ;
+                            if ( !order_.empty() )
+                                required = std::min(required, prosacRequiredTrials(prosacPrefix(prosac_schedule, trials - 1, N), best_ranks, N)) ;
+
+                            if ( best.trial_ >= 0 && trials >= required ) {
+#pragma omp atomic write
+                                stop = merged + 1 ;
+                            }
                         }
                     }
                 }
             }
         }
 
+        if ( best.trial_ < 0 ) return false ;
 
-        if ( best.subset_.empty() ) return false ;
+        // the inliers are only materialised for the winning hypothesis, which is then locally optimised
+        best_subset.clear() ;
+        model.findInliers(best.params_, best_subset) ;
+
+        if ( params_.lo_iterations_ > 0 || params_.lo_refits_ > 0 ) {
+            RNG rng(streamSeed(params_.seed_, n_blocks)) ;
+            std::vector<size_t> subset, inliers ;
+            Params params ;
+            localOptimization(model, N, rng, best, best_subset, inliers, subset, params) ;
+            stats_.lo_runs_ ++ ;
+        }
 
-        best_subset = best.subset_ ;
         return model.fit(best_subset, best_params);
     }
 
 protected:
-    int min_inliers_ ;
-    int max_trials_ ;
-    RNG rng_ ;
+
+    static const int block_size = 16 ;
+    static const int wave_size = 64 ;   // blocks
+
+    size_t minInliers() const {
+        assert( params_.min_inliers_ >= 0 ) ;
+        return params_.min_inliers_ ;
+    }
+
+    template<typename Params>
+    struct Hypothesis {
+        float residual_ = std::numeric_limits<float>::max() ;
+        size_t n_inliers_ = 0 ;
+        int trial_ = -1 ;
+        Params params_ ;
+
+        // lower residual, then more inliers, then earlier trial
+        bool improvedBy(float residual, size_t n_inliers, int trial) const {
+            if ( trial < 0 ) return false ;
+            if ( trial_ < 0 ) return true ;
+            if ( residual != residual_ ) return residual < residual_ ;
+            return n_inliers > n_inliers_ || ( n_inliers == n_inliers_ && trial < trial_ ) ;
+        }
+
+        void set(float residual, size_t n_inliers, int trial, const Params &params) {
+            residual_ = residual ; n_inliers_ = n_inliers ; trial_ = trial ; params_ = params ;
+        }
+    } ;
+
+    template<typename M, typename P, typename = void>
+    struct has_is_inlier: std::false_type {} ;
+
+    template<typename M, typename P>
+    struct has_is_inlier<M, P, decltype(void(std::declval<const M &>().isInlier(std::declval<const P &>(), size_t())))>: std::true_type {} ;
+
+    // Wald's sequential test (Matas & Chum, "Randomized RANSAC with sequential probability ratio test"). A hypothesis
+    // is abandoned as soon as the likelihood ratio of it being wrong exceeds the threshold A, which minimises the
+    // expected running time for the current estimates of the inlier ratio (epsilon) and of the fraction of points
+    // consistent with wrong models (delta). Both are updated from the hypotheses seen by the block, epsilon starting
+    // from the best hypothesis of the previous waves.
+    class SPRT {
+    public:
+        SPRT(double epsilon, double delta, double model_cost): epsilon_(epsilon), delta_(delta), model_cost_(model_cost) {
+            update() ;
+        }
+
+        void setInlierRatio(double epsilon) {
+            if ( epsilon <= epsilon_ ) return ;
+            epsilon_ = epsilon ;
+            update() ;
+        }
+
+        template <typename Model, typename Params>
+        bool verify(const Model &model, const Params &params, const std::vector<size_t> &order, std::vector<size_t> &inliers) {
+            double lambda = 1.0 ;
+            for( size_t j=0 ; j<order.size() ; j++ ) {
+                if ( model.isInlier(params, order[j]) ) {
+                    inliers.push_back(order[j]) ;
+                    lambda *= accept_ratio_ ;
+                }
+                else lambda *= reject_ratio_ ;
+
+                if ( lambda > A_ ) {
+                    // the fraction of consistent points of the rejected model is an estimate of delta
+                    const double delta = inliers.size() / (double)( j + 1 ) ;
+                    n_rejected_ ++ ;
+                    delta_sum_ += delta ;
+                    const double mean = delta_sum_ / n_rejected_ ;
+                    if ( std::abs(mean - delta_) > 0.05 * delta_ && mean < epsilon_ ) {
+                        delta_ = std::max(mean, 1.0e-4) ;
+                        update() ;
+                    }
+                    return false ;
+                }
+            }
+            std::sort(inliers.begin(), inliers.end()) ;
+            return true ;
+        }
+
+    private:
+
+        void update() {
+            if ( epsilon_ <= delta_ ) {
+                // the test cannot tell good from bad models
+                A_ = std::numeric_limits<double>::infinity() ;
+                accept_ratio_ = reject_ratio_ = 1 ;
+                return ;
+            }
+            accept_ratio_ = delta_ / epsilon_ ;
+            reject_ratio_ = ( 1 - delta_ ) / ( 1 - epsilon_ ) ;
+
+            const double C = ( 1 - delta_ ) * log(( 1 - delta_ ) / ( 1 - epsilon_ )) + delta_ * log(delta_ / epsilon_) ;
+            const double K = model_cost_ * C + 1 ;
+            A_ = K ;
+            for( int i=0 ; i<10 ; i++ ) A_ = K + log(A_) ;
+        }
+
+        double epsilon_, delta_, model_cost_ ;
+        double A_, accept_ratio_, reject_ratio_ ;
+        double delta_sum_ = 0 ;
+        int n_rejected_ = 0 ;
+    } ;
+
+    // Inner RANSAC on non-minimal subsets of the inliers (base) of the best hypothesis followed by iterative refits on
+    // all its inliers (Chum et al., "Locally optimized RANSAC"). On return base holds the inliers of the improved model.
+    template <typename Model, typename Params>
+    void localOptimization(Model &model, size_t N, RNG &rng, Hypothesis<Params> &best, std::vector<size_t> &base,
+                           std::vector<size_t> &inliers, std::vector<size_t> &subset, Params &params) const {
+
+        auto tryFit = [&](const std::vector<size_t> &s) {
+            if ( !model.fit(s, params) ) return false ;
+            inliers.clear() ;
+            model.findInliers(params, inliers) ;
+            if ( inliers.size() <= minInliers() ) return false ;
+            float residual = model.computeResidual(inliers) ;
+            if ( !best.improvedBy(residual, inliers.size(), best.trial_) ) return false ;
+            best.set(residual, inliers.size(), best.trial_, params) ;
+            std::swap(base, inliers) ;
+            return true ;
+        } ;
+
+        const size_t sample_size = params_.lo_sample_size_ > 0 ? params_.lo_sample_size_ : 7 * N ;
+        std::vector<size_t> pos ;
+
+        for( int i=0 ; i<params_.lo_iterations_ ; i++ ) {
+            const size_t s = std::min(sample_size, base.size() / 2) ;
+            if ( s <= N ) break ;
+            defaultSampler(rng, s, base.size(), pos) ;
+            subset.clear() ;
+            for( size_t p: pos ) subset.push_back(base[p]) ;
+            tryFit(subset) ;
+        }
+
+        for( int i=0 ; i<params_.lo_refits_ ; i++ ) {
+            subset = base ;
+            if ( !tryFit(subset) ) break ;
+        }
+    }
+
+    // hypotheses needed to draw an all-inlier sample with the requested confidence
+    int requiredTrials(size_t n_inliers, size_t n, size_t N) const {
+        const double p = pow(n_inliers / (double)n, (double)N) ;
+        if ( p >= 1.0 ) return 1 ;
+        if ( p <= 0.0 || params_.confidence_ >= 1.0 ) return params_.max_trials_ ;
+        const double k = log(1.0 - params_.confidence_) / log(1.0 - p) ;
+        return ( k < params_.max_trials_ ) ? (int)ceil(k) : params_.max_trials_ ;
+    }
+
+    // PROSAC (Chum & Matas, "Matching with PROSAC - progressive sample consensus"): trial t draws the t-th point of the
+    // quality order and N-1 points among the better ones, where the prefix grows with t so that the samples follow
+    // those of uniform sampling of prosac_growth_ hypotheses in order of quality. schedule[k] is the first trial using
+    // the k best points.
+    void makeProsacSchedule(size_t n, size_t N, std::vector<int> &schedule) const {
+        schedule.assign(n + 1, 0) ;
+        double Tn = params_.prosac_growth_ ;
+        for( size_t i=0 ; i<N ; i++ ) Tn *= ( N - i ) / (double)( n - i ) ;
+        double Tp = 1 ;
+        schedule[N] = 0 ;
+        for( size_t k = N ; k < n ; k++ ) {
+            const double Tn1 = Tn * ( k + 1 ) / (double)( k + 1 - N ) ;
+            Tp += ceil(Tn1 - Tn) ;
+            Tn = Tn1 ;
+            schedule[k + 1] = (int)std::min(Tp, (double)std::numeric_limits<int>::max()) - 1 ;
+        }
+    }
+
+    // size of the prefix of the quality order sampled by the trial: the last k with schedule[k] <= trial
+    static size_t prosacPrefix(const std::vector<int> &schedule, int trial, size_t N) {
+        return std::max(N, (size_t)( std::upper_bound(schedule.begin() + N, schedule.end(), trial) - schedule.begin() ) - 1) ;
+    }
+
+    // Trials needed with the inlier ratio of the best hypothesis within the sampled prefix of k points. The support in
+    // the prefix must first be above what a wrong model gets by chance (binomial with probability sprt_delta_, normal
+    // approximation at 5%).
+    int prosacRequiredTrials(size_t k, const std::vector<size_t> &ranks, size_t N) const {
+        const size_t inliers = std::lower_bound(ranks.begin(), ranks.end(), k) - ranks.begin() ;
+        const double beta = params_.sprt_delta_, m = k - N ;
+        if ( inliers < N + beta * m + 1.645 * sqrt(m * beta * ( 1 - beta )) ) return params_.max_trials_ ;
+        return requiredTrials(inliers, k, N) ;
+    }
+
+    void prosacSample(RNG &rng, int trial, size_t N, const std::vector<int> &schedule, std::vector<size_t> &subset) const {
+        const size_t k = prosacPrefix(schedule, trial, N) ;
+        subset.clear() ;
+        if ( k == schedule.size() - 1 && trial > schedule.back() ) {
+            // past the growth, uniform over all points
+            defaultSampler(rng, N, k, subset) ;
+        }
+        else {
+            defaultSampler(rng, N - 1, k - 1, subset) ;
+            subset.push_back(k - 1) ;
+        }
+        for( size_t &s: subset ) s = order_[s] ;
+    }
+
+    // splitmix64 of the seed and stream index, decorrelates the seeds of consecutive streams
+    static uint64_t streamSeed(uint64_t seed, uint64_t stream) {
+        uint64_t z = seed + ( stream + 1 ) * 0x9e3779b97f4a7c15ULL ;
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL ;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL ;
+        return z ^ ( z >> 31 ) ;
+    }
+
+    Parameters params_ ;
+    Stats stats_ ;
+    std::vector<size_t> order_ ;    // data indices by decreasing quality for PROSAC
+    std::vector<size_t> rank_ ;     // position of each data index in order_
 };
 
 
@@ -60,6 +60,9 @@ public:
 
     Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> getMat() const { return data_ ; }
 
+    // sample matrix (one sample per row) for filling it in place, e.g. by feature extractors
+    Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic> &mat() { return data_ ; }
+
     void getTargets(std::vector<L> &targets) const {
         if ( !targets_.empty() ) {
             for(uint i=0 ; i<targets_.size() ; i++ )
@@ -0,0 +1,407 @@
+#ifndef CVX_ML_KDTREE_HPP
+#define CVX_ML_KDTREE_HPP
+
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <cmath>
+#include <Eigen/Core>
+
+#include <cvx/math/rng.hpp>
+#include <cvx/ml/dataset.hpp>
+
+namespace cvx {
+
+// Distance functors for FeatureKDTree. distance() returns the distance between two vectors and may stop accumulating
+// once the partial sum exceeds bound, accum() returns the contribution of a single coordinate to the distance and is
+// used to bound the distance of the query to a cell of the tree
+
+template <typename T>
+struct L2Metric {
+
+    // squared euclidean distance
+    static T distance(const T *a, const T *b, size_t dim, T bound) {
+        T d = 0 ;
+        size_t i = 0 ;
+        for( ; i + 4 <= dim ; i += 4 ) {
+            const T d0 = a[i] - b[i], d1 = a[i+1] - b[i+1], d2 = a[i+2] - b[i+2], d3 = a[i+3] - b[i+3] ;
+            d += d0 * d0 + d1 * d1 + d2 * d2 + d3 * d3 ;
+            if ( d > bound ) return d ;
+        }
+        for( ; i<dim ; i++ ) {
+            const T di = a[i] - b[i] ;
+            d += di * di ;
+        }
+        return d ;
+    }
+
+    static T accum(T a, T b) { return ( a - b ) * ( a - b ) ; }
+};
+
+template <typename T>
+struct L1Metric {
+
+    static T distance(const T *a, const T *b, size_t dim, T bound) {
+        T d = 0 ;
+        size_t i = 0 ;
+        for( ; i + 4 <= dim ; i += 4 ) {
+            d += std::abs(a[i] - b[i]) + std::abs(a[i+1] - b[i+1]) + std::abs(a[i+2] - b[i+2]) + std::abs(a[i+3] - b[i+3]) ;
+            if ( d > bound ) return d ;
+        }
+        for( ; i<dim ; i++ )
+            d += std::abs(a[i] - b[i]) ;
+        return d ;
+    }
+
+    static T accum(T a, T b) { return std::abs(a - b) ; }
+};
+
+// kd-tree over the rows of a dense matrix, e.g. feature descriptors or dataset samples. The dimension D is either fixed
+// at compile time or Eigen::Dynamic.
+//
+// With max_checks_ = 0 the search is exact. Otherwise the search is approximate, as in FLANN: n_trees_ randomized trees
+// (each splitting on a dimension drawn among the n_split_candidates_ of highest variance) are searched together in
+// best-bin-first order until max_checks_ points have been examined. This is the mode to use for high dimensional data.
+//
+// Distances reported are those of the metric (squared for L2).
+
+template <typename T, int D = Eigen::Dynamic, typename Metric = L2Metric<T>>
+class FeatureKDTree
+{
+public:
+
+    typedef Eigen::Matrix<T, Eigen::Dynamic, D, Eigen::RowMajor> matrix_t ;
+    typedef Eigen::Map<const matrix_t> map_t ;
+
+    struct Parameters {
+        uint n_trees_ ;             // number of randomized trees, only used by approximate search
+        uint leaf_size_ ;           // maximum number of points in a leaf
+        uint max_checks_ ;          // maximum number of points examined per query (0 for exact search)
+        uint n_split_candidates_ ;  // number of highest variance dimensions among which the split dimension is drawn
+        uint64_t seed_ ;            // seed of the random split selection
+
+        Parameters():
+            n_trees_(4),
+            leaf_size_(10),
+            max_checks_(0),
+            n_split_candidates_(5),
+            seed_(0)
+        {}
+    } ;
+
+    FeatureKDTree(const Parameters &params = Parameters()): params_(params) {}
+
+    // index the rows of a row-major rows x cols matrix. The data are borrowed and must outlive the index
+    void train(const T *data, size_t rows, size_t cols) {
+        assert( D == Eigen::Dynamic || cols == (size_t)D ) ;
+        data_ = data ;
+        n_ = rows ;
+        dim_ = cols ;
+        build() ;
+    }
+
+    void train(const map_t &data) {
+        train(data.data(), data.rows(), data.cols()) ;
+    }
+
+    // index the samples of a dataset. MatDataset stores its matrix column-major so the samples are first copied to contiguous rows
+    template <typename L>
+    void train(const MatDataset<T, L> &ds) {
+        size_t rows = ds.size(), cols = ds.dimensions() ;
+        storage_.resize(rows * cols) ;
+        for( size_t c=0 ; c<cols ; c++ )
+            for( size_t r=0 ; r<rows ; r++ )
+                storage_[r * cols + c] = ds.getSampleCoordinate(r, c) ;
+        train(storage_.data(), rows, cols) ;
+    }
+
+    size_t size() const { return n_ ; }
+    size_t dimensions() const { return dim() ; }
+
+    // k nearest neighbours of q sorted by distance. Returns the number of neighbours found, which is less than k only
+    // if the index holds fewer points or the check budget ran out
+    uint knearest(const T *q, uint k, uint *indices, T *distances) const {
+        Scratch scratch ;
+        return search(q, k, indices, distances, scratch) ;
+    }
+
+    void knearest(const T *q, uint k, std::vector<uint> &indices, std::vector<T> &distances) const {
+        indices.resize(k) ;
+        distances.resize(k) ;
+        uint n = knearest(q, k, indices.data(), distances.data()) ;
+        indices.resize(n) ;
+        distances.resize(n) ;
+    }
+
+    // batched search of the rows of queries, processed in parallel. The neighbours of query i are stored at [i*k, (i+1)*k)
+    // and missing entries are filled with index -1 and maximum distance
+    void knearest(const map_t &queries, uint k, uint *indices, T *distances) const {
+        assert( (size_t)queries.cols() == dim() ) ;
+        const size_t n_queries = queries.rows() ;
+
+#pragma omp parallel
+        {
+            Scratch scratch ;
+
+#pragma omp for schedule(dynamic, 64)
+            for( size_t i=0 ; i<n_queries ; i++ ) {
+                uint *q_indices = indices + i * k ;
+                T *q_distances = distances + i * k ;
+
+                uint n = search(queries.data() + i * dim(), k, q_indices, q_distances, scratch) ;
+
+                for( uint j=n ; j<k ; j++ ) {
+                    q_indices[j] = -1 ;
+                    q_distances[j] = std::numeric_limits<T>::max() ;
+                }
+            }
+        }
+    }
+
+    void knearest(const map_t &queries, uint k, std::vector<uint> &indices, std::vector<T> &distances) const {
+        indices.resize(queries.rows() * k) ;
+        distances.resize(queries.rows() * k) ;
+        knearest(queries, k, indices.data(), distances.data()) ;
+    }
+
+private:
+
+    // internal nodes hold the split dimension and value and the indices of their children, leaves (dim_ < 0) hold the
+    // range of their points in the permutation array of the tree
+    struct Node {
+        int dim_ ;
+        T value_ ;
+        uint first_, second_ ;
+    } ;
+
+    struct Tree {
+        std::vector<Node> nodes_ ;
+        std::vector<uint> vind_ ;
+    } ;
+
+    // unexplored branch of the approximate search
+    struct Branch {
+        T dist_ ;
+        uint tree_, node_ ;
+
+        bool operator < (const Branch &other) const { return dist_ > other.dist_ ; } // min-heap
+    } ;
+
+    // per-thread search buffers
+    struct Scratch {
+        std::vector<T> dists_ ;
+        std::vector<Branch> heap_ ;
+    } ;
+
+    struct Results {
+        Results(uint k, uint *indices, T *dists, bool unique): k_(k), count_(0), indices_(indices), dists_(dists), unique_(unique) {}
+
+        T worst() const { return ( count_ < k_ ) ? std::numeric_limits<T>::max() : dists_[k_-1] ; }
+
+        void add(T dist, uint idx) {
+            // with several trees the same point may be reached more than once
+            if ( unique_ && std::find(indices_, indices_ + count_, idx) != indices_ + count_ ) return ;
+
+            uint i ;
+            for( i=count_ ; i>0 && dists_[i-1] > dist ; --i ) {
+                if ( i < k_ ) {
+                    dists_[i] = dists_[i-1] ;
+                    indices_[i] = indices_[i-1] ;
+                }
+            }
+            if ( i < k_ ) {
+                dists_[i] = dist ;
+                indices_[i] = idx ;
+            }
+            if ( count_ < k_ ) count_ ++ ;
+        }
+
+        uint k_, count_ ;
+        uint *indices_ ;
+        T *dists_ ;
+        bool unique_ ;
+    } ;
+
+    size_t dim() const { return ( D == Eigen::Dynamic ) ? dim_ : D ; }
+
+    const T *point(uint idx) const { return data_ + (size_t)idx * dim() ; }
+
+    bool approximate() const { return params_.max_checks_ > 0 ; }
+
+    void build() {
+        uint n_trees = approximate() ? std::max(1u, params_.n_trees_) : 1 ;
+        trees_.resize(n_trees) ;
+
+        RNG rng(params_.seed_) ;
+
+        for( Tree &tree: trees_ ) {
+            tree.nodes_.clear() ;
+            tree.vind_.resize(n_) ;
+            for( size_t i=0 ; i<n_ ; i++ ) tree.vind_[i] = i ;
+            if ( n_ > 0 ) divide(tree, 0, n_, rng, n_trees > 1) ;
+        }
+    }
+
+    uint divide(Tree &tree, uint begin, uint end, RNG &rng, bool randomize) {
+        uint node = tree.nodes_.size() ;
+        tree.nodes_.emplace_back() ;
+
+        if ( end - begin <= std::max(1u, params_.leaf_size_) ) {
+            tree.nodes_[node] = Node{-1, 0, begin, end} ;
+            return node ;
+        }
+
+        // mean and variance of each dimension estimated from a sample of the points
+
+        const size_t dim = this->dim() ;
+        const uint n_samples = std::min(end - begin, 100u) ;
+
+        std::vector<double> mean(dim, 0.0), var(dim, 0.0) ;
+
+        for( uint i=0 ; i<n_samples ; i++ ) {
+            const T *p = point(tree.vind_[begin + i]) ;
+            for( size_t j=0 ; j<dim ; j++ ) mean[j] += p[j] ;
+        }
+        for( size_t j=0 ; j<dim ; j++ ) mean[j] /= n_samples ;
+
+        for( uint i=0 ; i<n_samples ; i++ ) {
+            const T *p = point(tree.vind_[begin + i]) ;
+            for( size_t j=0 ; j<dim ; j++ ) var[j] += ( p[j] - mean[j] ) * ( p[j] - mean[j] ) ;
+        }
+
+        // split on the dimension of highest variance or, for randomized trees, on one of the highest ones
+
+        std::vector<uint> dims(dim) ;
+        for( size_t j=0 ; j<dim ; j++ ) dims[j] = j ;
+
+        uint n_candidates = randomize ? std::min<size_t>(std::max(1u, params_.n_split_candidates_), dim) : 1 ;
+        std::partial_sort(dims.begin(), dims.begin() + n_candidates, dims.end(), [&](uint a, uint b) { return var[a] > var[b] ; }) ;
+
+        int split_dim = dims[ ( n_candidates > 1 ) ? rng.uniform<int>(0, n_candidates - 1) : 0 ] ;
+        T split_value = mean[split_dim] ;
+
+        // partition around the mean, falling back to the median if this leaves one side empty
+
+        auto it = std::partition(tree.vind_.begin() + begin, tree.vind_.begin() + end,
+                                 [&](uint idx) { return point(idx)[split_dim] < split_value ; }) ;
+        uint mid = it - tree.vind_.begin() ;
+
+        if ( mid == begin || mid == end ) {
+            mid = ( begin + end ) / 2 ;
+            std::nth_element(tree.vind_.begin() + begin, tree.vind_.begin() + mid, tree.vind_.begin() + end,
+                             [&](uint a, uint b) { return point(a)[split_dim] < point(b)[split_dim] ; }) ;
+            split_value = point(tree.vind_[mid])[split_dim] ;
+        }
+
+        uint left = divide(tree, begin, mid, rng, randomize) ;
+        uint right = divide(tree, mid, end, rng, randomize) ;
+
+        tree.nodes_[node] = Node{split_dim, split_value, left, right} ;
+        return node ;
+    }
+
+    uint search(const T *q, uint k, uint *indices, T *distances, Scratch &scratch) const {
+        if ( n_ == 0 || k == 0 ) return 0 ;
+
+        Results results(k, indices, distances, trees_.size() > 1) ;
+
+        if ( approximate() )
+            searchApproximate(q, results, scratch) ;
+        else {
+            scratch.dists_.assign(dim(), 0) ;
+            searchExact(trees_[0], 0, q, 0, scratch.dists_.data(), results) ;
+        }
+
+        return results.count_ ;
+    }
+
+    void checkLeaf(const Tree &tree, const Node &node, const T *q, Results &results) const {
+        for( uint i=node.first_ ; i<node.second_ ; i++ ) {
+            uint idx = tree.vind_[i] ;
+            T worst = results.worst() ;
+            T dist = Metric::distance(q, point(idx), dim(), worst) ;
+            if ( dist < worst ) results.add(dist, idx) ;
+        }
+    }
+
+    // mindist is a lower bound of the distance of q to the cell of the node, dists holds its per-dimension terms
+    void searchExact(const Tree &tree, uint node_idx, const T *q, T mindist, T *dists, Results &results) const {
+        const Node &node = tree.nodes_[node_idx] ;
+
+        if ( node.dim_ < 0 ) {
+            checkLeaf(tree, node, q, results) ;
+            return ;
+        }
+
+        const int d = node.dim_ ;
+        bool go_left = q[d] < node.value_ ;
+
+        searchExact(tree, go_left ? node.first_ : node.second_, q, mindist, dists, results) ;
+
+        T cut = Metric::accum(q[d], node.value_) ;
+        T prev = dists[d] ;
+        T other_mindist = mindist + cut - prev ;
+
+        if ( other_mindist <= results.worst() ) {
+            dists[d] = cut ;
+            searchExact(tree, go_left ? node.second_ : node.first_, q, other_mindist, dists, results) ;
+            dists[d] = prev ;
+        }
+    }
+
+    void searchApproximate(const T *q, Results &results, Scratch &scratch) const {
+        std::vector<Branch> &heap = scratch.heap_ ;
+        heap.clear() ;
+
+        size_t checks = 0 ;
+
+        for( uint t=0 ; t<trees_.size() ; t++ )
+            descend(t, 0, q, results, heap, checks) ;
+
+        while ( !heap.empty() && checks < params_.max_checks_ ) {
+            std::pop_heap(heap.begin(), heap.end()) ;
+            Branch b = heap.back() ;
+            heap.pop_back() ;
+
+            if ( b.dist_ >= results.worst() ) break ;
+
+            descend(b.tree_, b.node_, q, results, heap, checks) ;
+        }
+    }
+
+    // follow the closest branches down to a leaf, queuing the others
+    void descend(uint t, uint node_idx, const T *q, Results &results, std::vector<Branch> &heap, size_t &checks) const {
+        const Tree &tree = trees_[t] ;
+
+        while ( true ) {
+            const Node &node = tree.nodes_[node_idx] ;
+
+            if ( node.dim_ < 0 ) {
+                checkLeaf(tree, node, q, results) ;
+                checks += node.second_ - node.first_ ;
+                return ;
+            }
+
+            const int d = node.dim_ ;
+            bool go_left = q[d] < node.value_ ;
+
+            T cut = Metric::accum(q[d], node.value_) ;
+            if ( cut < results.worst() ) {
+                heap.push_back(Branch{cut, t, go_left ? node.second_ : node.first_}) ;
+                std::push_heap(heap.begin(), heap.end()) ;
+            }
+
+            node_idx = go_left ? node.first_ : node.second_ ;
+        }
+    }
+
+    Parameters params_ ;
+    std::vector<Tree> trees_ ;
+    std::vector<T> storage_ ;   // only used when the index owns the data
+    const T *data_ = nullptr ;
+    size_t n_ = 0, dim_ = 0 ;
+} ;
+
+}
+
+#endif
@@ -11,6 +11,10 @@ namespace cvx {
 Eigen::Isometry3f alignRigid(const Eigen::Matrix3Xf &P, const Eigen::Matrix3Xf &Q) ;
 Eigen::Isometry3f alignRigid(const std::vector<Eigen::Vector3f> &P, const std::vector<Eigen::Vector3f> &Q) ;
 
+// same, given the centroids p, q of the two sets and their cross-covariance sum_i (P_i - p)(Q_i - q)^T, so that the
+// correspondences need not be stored
+Eigen::Isometry3f alignRigid(const Eigen::Matrix3d &cov, const Eigen::Vector3d &p, const Eigen::Vector3d &q) ;
+
 }
 
 #endif
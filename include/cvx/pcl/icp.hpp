@@ -3,28 +3,38 @@
 
 #include <Eigen/Geometry>
 #include <vector>
+#include <memory>
 #include <cvx/geometry/kdtree.hpp>
 
 namespace cvx {
 
-// simple ICP point-to-point alignment class
+// ICP alignment class
+//
+// Point-to-point alignment solves for the rigid transform in closed form (Kabsch). The point-to-plane and symmetric
+// objectives minimise the distance of the source points to the tangent plane of their target correspondences (for the
+// symmetric objective, the plane with the average of the two normals) with a Gauss-Newton step on the linearised 6-DoF
+// system per iteration. They need far fewer iterations but require normals (see estimateNormals).
 
 class ICPAligner {
 public:
 
+    enum Metric { PointToPoint, PointToPlane, Symmetric } ;
+
     struct Parameters {
         float inlier_distance_threshold_ ;
         float inlier_threshold_update_factor_ ;
         uint max_iterations_ ;
         uint min_inliers_ ;
         float epsilon_ ;     // difference in squared distance error to stop iterations
+        Metric metric_ ;     // used by the overloads taking normals
 
         Parameters():
             inlier_distance_threshold_(0.05),
             max_iterations_(10),
             epsilon_(1.0e-10),
             min_inliers_(3),
-            inlier_threshold_update_factor_(3)
+            inlier_threshold_update_factor_(3),
+            metric_(PointToPlane)
         {}
 
     } ;
@@ -36,7 +46,8 @@ public:
     // with the initial transform
 
     float align(const PointList3f &target, const PointList3f &src, Eigen::Isometry3f &pose, uint &n_inliers) {
-        KDTree3 tree(target) ;
+        KDTree3 tree ;
+        tree.borrow(target) ;
         return align(tree, target, src, pose, n_inliers) ;
     }
 
@@ -44,11 +55,110 @@ public:
     float align(KDTree3 &stree, const PointList3f &target, const PointList3f &src, Eigen::Isometry3f &pose,
                 uint &n_inliers) ;
 
+    // Alignment with the metric given in the parameters. Point-to-plane needs the target normals, the symmetric
+    // objective the normals of both clouds; pass an empty list for normals that are not needed.
+    float align(const PointList3f &target, const PointList3f &target_normals, const PointList3f &src, const PointList3f &src_normals,
+                Eigen::Isometry3f &pose, uint &n_inliers) {
+        KDTree3 tree ;
+        tree.borrow(target) ;
+        return align(tree, target, target_normals, src, src_normals, pose, n_inliers) ;
+    }
+
+    float align(KDTree3 &stree, const PointList3f &target, const PointList3f &target_normals, const PointList3f &src,
+                const PointList3f &src_normals, Eigen::Isometry3f &pose, uint &n_inliers) ;
+
 
 private:
 
     Parameters params_ ;
 };
 
+// Coarse-to-fine ICP against a fixed model. Voxel-downsampled levels of the target, with their kd-trees and normals,
+// are built once on construction. Each alignment downsamples the source to the same levels and runs ICP from the
+// coarsest to the finest level, starting each level from the pose found at the previous one and shrinking the inlier
+// threshold by threshold_scale_ per level.
+
+class PyramidICPAligner {
+public:
+
+    struct Parameters {
+        std::vector<float> voxel_sizes_ ;   // coarse to fine, 0 for full resolution
+        float inlier_distance_threshold_ ;  // at the coarsest level
+        float threshold_scale_ ;            // inlier threshold factor from one level to the next
+        uint normal_neighbours_ ;           // neighbours used to estimate normals for the plane metrics
+        ICPAligner::Parameters icp_ ;       // per level ICP parameters, the inlier threshold is overriden
+
+        Parameters():
+            voxel_sizes_{0.02, 0.01, 0.005},
+            inlier_distance_threshold_(0.1),
+            threshold_scale_(0.5),
+            normal_neighbours_(10)
+        {}
+    } ;
+
+    PyramidICPAligner(const PointList3f &target, const Parameters &params = Parameters()) ;
+
+    // variable pose should be initialized with the initial transform; returns the error at the finest level
+    float align(const PointList3f &src, Eigen::Isometry3f &pose, uint &n_inliers) ;
+
+    size_t numLevels() const { return levels_.size() ; }
+
+private:
+
+    struct Level {
+        PointList3f points_, normals_ ;
+        KDTree3 tree_ ;     // borrows points_
+    } ;
+
+    void makeLevel(const PointList3f &cloud, float voxel_size, PointList3f &points, PointList3f &normals, bool need_normals) const ;
+
+    Parameters params_ ;
+    std::vector<std::unique_ptr<Level>> levels_ ;
+} ;
+
+class PinholeCamera ;
+
+// Registration of depth frames with projective data association (as in KinectFusion). Frames are organised clouds
+// (vertex maps) of the camera image size stored row by row in the camera frame, with NaN coordinates for invalid
+// pixels. The correspondence of a source point is the target point at the pixel it projects to, accepted if the two are
+// closer than max_distance_ and (when source normals are given) their normals are within max_normal_angle_. Each
+// iteration is a point-to-plane Gauss-Newton step, accumulated over blocks of rows in parallel. No kd-tree is needed.
+
+class ProjectiveICPAligner {
+public:
+
+    struct Parameters {
+        float max_distance_ ;       // maximum distance between corresponding points
+        float max_normal_angle_ ;   // maximum angle between corresponding normals (radians)
+        uint max_iterations_ ;
+        uint min_inliers_ ;
+        float epsilon_ ;            // stop when the norm of the pose update falls below this
+        uint sampling_ ;            // use every sampling_-th row and column of the source
+
+        Parameters():
+            max_distance_(0.1),
+            max_normal_angle_(0.5),
+            max_iterations_(10),
+            min_inliers_(100),
+            epsilon_(1.0e-6),
+            sampling_(1)
+        {}
+    } ;
+
+    ProjectiveICPAligner(const PinholeCamera &cam, const Parameters &params = Parameters()) ;
+
+    // Variable pose maps source camera coordinates to target camera coordinates and should be initialized (e.g. with
+    // the previous motion). Target normals are required, source normals are optional (pass an empty list to skip the
+    // normal compatibility check). Returns the mean squared point-to-plane residual.
+    float align(const PointList3f &target, const PointList3f &target_normals, const PointList3f &src, const PointList3f &src_normals,
+                Eigen::Isometry3f &pose, uint &n_inliers) const ;
+
+private:
+
+    Parameters params_ ;
+    float fx_, fy_, cx_, cy_ ;
+    uint width_, height_ ;
+} ;
+
 }
 #endif
@@ -0,0 +1,65 @@
+#ifndef CVX_PCL_NORMALS_HPP
+#define CVX_PCL_NORMALS_HPP
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <cvx/geometry/kdtree.hpp>
+
+#include <limits>
+
+namespace cvx {
+
+// Estimate surface normals by fitting a plane to the k nearest neighbours of each point (direction of least variance).
+// Normals are oriented towards the viewpoint; they are zero for points with fewer than 3 neighbours.
+
+void estimateNormals(const KDTree3 &search, const PointList3f &cloud, uint k, PointList3f &normals,
+                     const Eigen::Vector3f &viewpoint = Eigen::Vector3f::Zero()) ;
+
+void estimateNormals(const PointList3f &cloud, uint k, PointList3f &normals,
+                     const Eigen::Vector3f &viewpoint = Eigen::Vector3f::Zero()) ;
+
+// Normals of an organised cloud (width x height points stored row by row, NaN coordinates for invalid points) from
+// the cross product of the differences to horizontally and vertically adjacent points. Neighbours further than
+// max_distance are treated as lying across a depth discontinuity. Normals face the camera and are NaN where they
+// cannot be computed.
+
+void estimateNormalsOrganized(const PointList3f &cloud, uint width, uint height, PointList3f &normals, float max_distance = 0.05f) ;
+
+namespace detail {
+
+// Normal at (x, y) of a w x h organised grid as computed by estimateNormalsOrganized, with the storage hidden behind
+// valid(x, y) and point(x, y) so that every organised representation shares the same kernel.
+template <class Valid, class Point>
+Eigen::Vector3f organizedNormal(int x, int y, int w, int h, float sq_max_distance, const Valid &valid, const Point &point) {
+    const float nan = std::numeric_limits<float>::quiet_NaN() ;
+    if ( !valid(x, y) ) return Eigen::Vector3f(nan, nan, nan) ;
+
+    const Eigen::Vector3f p = point(x, y) ;
+
+    // difference to the neighbour at offset (or minus the one at -offset if that is invalid), false if neither is usable
+    auto difference = [&](int dx, int dy, Eigen::Vector3f &d) {
+        for( int s : { 1, -1 } ) {
+            int nx = x + s * dx, ny = y + s * dy ;
+            if ( nx < 0 || ny < 0 || nx >= w || ny >= h || !valid(nx, ny) ) continue ;
+            d = ( point(nx, ny) - p ) * (float)s ;
+            if ( d.squaredNorm() <= sq_max_distance ) return true ;
+        }
+        return false ;
+    } ;
+
+    Eigen::Vector3f dx, dy ;
+    if ( !difference(1, 0, dx) || !difference(0, 1, dy) ) return Eigen::Vector3f(nan, nan, nan) ;
+
+    Eigen::Vector3f n = dx.cross(dy) ;
+    float len = n.norm() ;
+    if ( len == 0 ) return Eigen::Vector3f(nan, nan, nan) ;
+
+    n /= len ;
+    return ( n.dot(p) > 0 ) ? Eigen::Vector3f(-n) : n ;
+}
+
+}
+
+}
+
+#endif
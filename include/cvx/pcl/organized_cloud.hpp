@@ -0,0 +1,129 @@
+#ifndef CVX_PCL_ORGANIZED_CLOUD_HPP
+#define CVX_PCL_ORGANIZED_CLOUD_HPP
+
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <Eigen/Core>
+
+#include <cvx/geometry/point_list.hpp>
+
+namespace cvx {
+
+// Point cloud that keeps the pixel grid of the depth image it was created from (see depthToPointCloud), so that image
+// neighbours can be used instead of a spatial search. Coordinates, validity mask and the optional colours and normals
+// are stored as separate arrays (structure of arrays).
+//
+// Like cv::Mat, copies share the data: roi() and subsample() return views into the same storage without copying and
+// clone() makes a deep copy.
+
+class OrganizedPointCloud {
+public:
+
+    typedef Eigen::Matrix<uint8_t, 3, 1> color_t ;
+
+    OrganizedPointCloud() {}
+    OrganizedPointCloud(uint width, uint height, bool with_colors = false, bool with_normals = false) ;
+
+    uint width() const { return width_ ; }
+    uint height() const { return height_ ; }
+    bool empty() const { return width_ == 0 || height_ == 0 ; }
+
+    bool hasColors() const { return data_ && !data_->colors_.empty() ; }
+    bool hasNormals() const { return data_ && !data_->nx_.empty() ; }
+
+    bool isValid(uint x, uint y) const { return data_->mask_[index(x, y)] != 0 ; }
+
+    Eigen::Vector3f point(uint x, uint y) const {
+        size_t idx = index(x, y) ;
+        return Eigen::Vector3f(data_->x_[idx], data_->y_[idx], data_->z_[idx]) ;
+    }
+
+    Eigen::Vector3f normal(uint x, uint y) const {
+        size_t idx = index(x, y) ;
+        return Eigen::Vector3f(data_->nx_[idx], data_->ny_[idx], data_->nz_[idx]) ;
+    }
+
+    color_t color(uint x, uint y) const {
+        return Eigen::Map<const color_t>(&data_->colors_[3 * index(x, y)]) ;
+    }
+
+    // setting a point marks it valid
+    void setPoint(uint x, uint y, const Eigen::Vector3f &p) {
+        size_t idx = index(x, y) ;
+        data_->x_[idx] = p.x() ; data_->y_[idx] = p.y() ; data_->z_[idx] = p.z() ;
+        data_->mask_[idx] = 1 ;
+    }
+
+    void setInvalid(uint x, uint y) { data_->mask_[index(x, y)] = 0 ; }
+
+    void setNormal(uint x, uint y, const Eigen::Vector3f &n) {
+        size_t idx = index(x, y) ;
+        data_->nx_[idx] = n.x() ; data_->ny_[idx] = n.y() ; data_->nz_[idx] = n.z() ;
+    }
+
+    void setColor(uint x, uint y, const color_t &c) {
+        Eigen::Map<color_t>(&data_->colors_[3 * index(x, y)]) = c ;
+    }
+
+    // allocate the optional channels (of the whole underlying grid when called on a view)
+    void allocateColors() ;
+    void allocateNormals() ;
+
+    // Raw access for fast loops: element (x, y) of the view is at offset(x, y) in the arrays below, which span the
+    // underlying grid. Colours are interleaved, 3 bytes per point.
+    size_t offset(uint x, uint y) const { return index(x, y) ; }
+    const float *xData() const { return data_->x_.data() ; }
+    const float *yData() const { return data_->y_.data() ; }
+    const float *zData() const { return data_->z_.data() ; }
+    const uint8_t *maskData() const { return data_->mask_.data() ; }
+    float *xData() { return data_->x_.data() ; }
+    float *yData() { return data_->y_.data() ; }
+    float *zData() { return data_->z_.data() ; }
+    uint8_t *maskData() { return data_->mask_.data() ; }
+    uint8_t *colorData() { return data_->colors_.data() ; }
+
+    // view of the rectangle of size w x h at (x, y)
+    OrganizedPointCloud roi(uint x, uint y, uint w, uint h) const ;
+
+    // view of every step-th row and column
+    OrganizedPointCloud subsample(uint step) const ;
+
+    // deep copy of the view
+    OrganizedPointCloud clone() const ;
+
+    size_t countValid() const ;
+
+    // valid points (and their normals if any) in row order
+    void getPoints(PointList3f &pts) const ;
+    void getPoints(PointList3f &pts, PointList3f &normals) const ;
+
+    // one point per pixel in row order, with NaN coordinates for invalid points (the layout of ProjectiveICPAligner)
+    void getVertexMap(PointList3f &vertices) const ;
+
+    // Normals from the cross product of the differences to horizontally and vertically adjacent points of the view,
+    // ignoring neighbours further than max_distance (depth discontinuities). Normals face the camera; they are NaN
+    // where they cannot be computed.
+    void computeNormals(float max_distance = 0.05f) ;
+
+private:
+
+    struct Storage {
+        uint width_, height_ ;
+        std::vector<float> x_, y_, z_ ;
+        std::vector<uint8_t> mask_ ;
+        std::vector<uint8_t> colors_ ;
+        std::vector<float> nx_, ny_, nz_ ;
+    } ;
+
+    size_t index(uint x, uint y) const {
+        return (size_t)( y0_ + y * step_ ) * data_->width_ + x0_ + x * step_ ;
+    }
+
+    std::shared_ptr<Storage> data_ ;
+    uint x0_ = 0, y0_ = 0, width_ = 0, height_ = 0, step_ = 1 ;
+} ;
+
+}
+
+#endif
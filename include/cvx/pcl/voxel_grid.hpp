@@ -0,0 +1,51 @@
+#ifndef CVX_PCL_VOXEL_GRID_HPP
+#define CVX_PCL_VOXEL_GRID_HPP
+
+#include <vector>
+#include <cvx/geometry/point_list.hpp>
+
+namespace cvx {
+
+// Point cloud downsampling on a regular voxel grid. Each occupied voxel is reduced to a single point. The grid is
+// anchored at the minimum corner of the cloud so no bounds are needed; points with non-finite coordinates are ignored.
+// Points are bucketed by sorting their voxel keys (parallel radix sort) and voxels are reduced in parallel. The output
+// is ordered by voxel.
+
+class VoxelGridFilter {
+public:
+
+    enum Reduction {
+        Centroid,           // mean of the points in the voxel
+        ClosestToCentroid,  // point of the voxel closest to the mean
+        FirstHit            // first point of the voxel in input order
+    } ;
+
+    struct Parameters {
+        float voxel_size_ ;     // must be positive, filter() throws std::invalid_argument otherwise
+        Reduction reduction_ ;
+        uint min_points_ ;      // voxels with fewer points are dropped
+
+        Parameters():
+            voxel_size_(0.01),
+            reduction_(ClosestToCentroid),
+            min_points_(1)
+        {}
+    } ;
+
+    VoxelGridFilter(const Parameters &params = Parameters()): params_(params) {}
+
+    void filter(const PointList3f &cloud, PointList3f &res) const ;
+
+    // Per-point attributes (e.g. colours or normals) are given as n_attributes floats per point stored contiguously.
+    // The attributes of each output point are the average over its voxel (normals should be renormalized by the caller).
+    void filter(const PointList3f &cloud, const float *attributes, uint n_attributes,
+                PointList3f &res, std::vector<float> &res_attributes) const ;
+
+private:
+
+    Parameters params_ ;
+} ;
+
+}
+
+#endif
@@ -0,0 +1,107 @@
+#include <cvx/camera/camera.hpp>
+
+#include <atomic>
+
+using namespace std ;
+
+namespace cvx {
+
+const PinholeCamera::Maps &PinholeCamera::maps() const {
+    // the maps are immutable once built so concurrent callers may at worst build them twice, the first one published wins
+    shared_ptr<const Maps> maps = std::atomic_load(&maps_) ;
+    if ( maps ) return *maps ;
+
+    shared_ptr<Maps> m(new Maps) ;
+    const int w = sz_.width, h = sz_.height ;
+
+    m->ray_x_.create(h, w, CV_32FC1) ;
+    m->ray_y_.create(h, w, CV_32FC1) ;
+
+    if ( has_distortion_ ) {
+        cv::Mat K = getMatrix() ;
+
+        cv::initUndistortRectifyMap(K, dist_, cv::Mat(), K, sz_, CV_16SC2, m->rect_map1_, m->rect_map2_) ;
+
+        vector<cv::Point2f> pixels, rays ;
+        pixels.reserve((size_t)w * h) ;
+        for( int i=0 ; i<h ; i++ )
+            for( int j=0 ; j<w ; j++ )
+                pixels.push_back(cv::Point2f(j, i)) ;
+
+        cv::undistortPoints(pixels, rays, K, dist_) ;
+
+        m->unrect_x_.create(h, w, CV_32FC1) ;
+        m->unrect_y_.create(h, w, CV_32FC1) ;
+
+#pragma omp parallel for
+        for( int i=0 ; i<h ; i++ ) {
+            const cv::Point2f *r = &rays[(size_t)i * w] ;
+            float *rx = m->ray_x_.ptr<float>(i), *ry = m->ray_y_.ptr<float>(i) ;
+            float *ux = m->unrect_x_.ptr<float>(i), *uy = m->unrect_y_.ptr<float>(i) ;
+            for( int j=0 ; j<w ; j++ ) {
+                rx[j] = r[j].x ;
+                ry[j] = r[j].y ;
+                ux[j] = fx_ * r[j].x + cx_ ;
+                uy[j] = fy_ * r[j].y + cy_ ;
+            }
+        }
+    } else {
+        for( int i=0 ; i<h ; i++ ) {
+            float *rx = m->ray_x_.ptr<float>(i), *ry = m->ray_y_.ptr<float>(i) ;
+            for( int j=0 ; j<w ; j++ ) {
+                rx[j] = ( j - cx_ ) / fx_ ;
+                ry[j] = ( i - cy_ ) / fy_ ;
+            }
+        }
+    }
+
+    // publish only if no other thread did meanwhile, otherwise keep theirs: a published Maps is never replaced, so the
+    // references handed out stay valid until the camera parameters change
+    shared_ptr<const Maps> expected ;
+    maps = m ;
+    if ( std::atomic_compare_exchange_strong(&maps_, &expected, maps) ) return *maps ;
+    return *expected ;
+}
+
+cv::Mat PinholeCamera::rectifyImage(const cv::Mat &raw, int interpolation) const {
+    if ( !has_distortion_ ) return raw.clone() ;
+
+    assert( raw.size() == sz_ ) ;
+
+    const Maps &m = maps() ;
+    cv::Mat rectified ;
+    cv::remap(raw, rectified, m.rect_map1_, m.rect_map2_, interpolation) ;
+    return rectified ;
+}
+
+cv::Mat PinholeCamera::unrectifyImage(const cv::Mat &rectified, int interpolation) const {
+    if ( !has_distortion_ ) return rectified.clone() ;
+
+    assert( rectified.size() == sz_ ) ;
+
+    const Maps &m = maps() ;
+    cv::Mat raw ;
+    cv::remap(rectified, raw, m.unrect_x_, m.unrect_y_, interpolation) ;
+    return raw ;
+}
+
+cv::Point2d PinholeCamera::rectifyPoint(const cv::Point2d &uv_raw) const {
+    if ( !has_distortion_ ) return uv_raw ;
+
+    cv::Mat K = getMatrix() ;
+    vector<cv::Point2d> src { uv_raw }, dst ;
+    cv::undistortPoints(src, dst, K, dist_, cv::Mat(), K) ;
+    return dst[0] ;
+}
+
+cv::Point2d PinholeCamera::unrectifyPoint(const cv::Point2d &uv_rect) const {
+    if ( !has_distortion_ ) return uv_rect ;
+
+    vector<cv::Point3d> src { cv::Point3d((uv_rect.x - cx_)/fx_, (uv_rect.y - cy_)/fy_, 1.0) } ;
+    vector<cv::Point2d> dst ;
+    cv::Mat zero = cv::Mat::zeros(3, 1, CV_64F) ;
+    cv::projectPoints(src, zero, zero, getMatrix(), dist_, dst) ;
+    return dst[0] ;
+}
+
+}
@@ -3,38 +3,55 @@
 
 #include "../3rdparty/nanoflann.hpp"
 
+#include <numeric>
+#include <unordered_set>
+
 using namespace std ;
 using namespace Eigen ;
 using namespace nanoflann ;
 
 namespace cvx {
 
-struct PointCloudAdaptor3
+// Number of distance evaluations made by the current search of the calling thread. Only maintained for indexes with a
+// limit on the checks per query, nanoflann has no such option so the count is kept by the dataset adaptor.
+
+static thread_local size_t search_checks = 0 ;
+
+// Dataset adaptor over D-dimensional float points stored at a fixed stride. The points are borrowed from the caller
+// unless the adaptor is constructed from a point list, in which case it takes ownership of it.
+
+template <int D>
+struct PointCloudAdaptor
 {
-    using point_list_t = PointList3f ;
+    using point_list_t = PointList<float, D, false> ;
 
-    PointCloudAdaptor3(const point_list_t &data): pts_(data) {}
+    PointCloudAdaptor(const float *data, size_t n, size_t stride): n_(n), stride_(stride), data_(data), count_checks_(false) {}
+
+    PointCloudAdaptor(point_list_t &&data): storage_(std::move(data)), n_(storage_.size()), stride_(D), count_checks_(false) {
+        data_ = reinterpret_cast<const float *>(storage_.data()) ;
+    }
 
     // Must return the number of data points
-    inline size_t kdtree_get_point_count() const { return pts_.size(); }
+    inline size_t kdtree_get_point_count() const { return n_; }
 
     // Returns the distance between the vector "p1[0:size-1]" and the data point with index "idx_p2" stored in the class:
     inline float kdtree_distance(const float *p1, const size_t idx_p2, size_t /*size*/) const
     {
-        const float d0=p1[0] - pts_[idx_p2].x();
-        const float d1=p1[1] - pts_[idx_p2].y();
-        const float d2=p1[2] - pts_[idx_p2].z();
-        return d0*d0+d1*d1+d2*d2;
+        if ( count_checks_ ) ++search_checks ;
+
+        const float *p2 = data_ + idx_p2 * stride_ ;
+        float d = 0 ;
+        for( int i=0 ; i<D ; i++ ) {
+            const float di = p1[i] - p2[i] ;
+            d += di * di ;
+        }
+        return d ;
     }
 
     // Returns the dim'th component of the idx'th point in the class:
-    // Since this is inlined and the "dim" argument is typically an immediate value, the
-    //  "if/else's" are actually solved at compile time.
     inline float kdtree_get_pt(const size_t idx, int dim) const
     {
-        if ( dim == 0 ) return pts_[idx].x();
-        else if (dim == 1 ) return pts_[idx].y();
-        else return pts_[idx].z() ;
+        return data_[idx * stride_ + dim] ;
     }
 
     // Optional bounding-box computation: return false to default to a standard bbox computation loop.
@@ -43,35 +60,117 @@ struct PointCloudAdaptor3
     template <class BBOX>
     bool kdtree_get_bbox(BBOX& /* bb */) const { return false; }
 
-    const point_list_t pts_ ;
+    point_list_t storage_ ; // only used when the adaptor owns the points
+    size_t n_, stride_ ;
+    const float *data_ ;
+    bool count_checks_ ;
+};
+
+// Radius result set that appends matches to a list without clearing it first
+
+struct AppendRadiusResultSet
+{
+    AppendRadiusResultSet(float radius, vector<pair<uint, float>> &matches): radius_(radius), matches_(matches) {}
+
+    inline size_t size() const { return matches_.size() ; }
+    inline bool full() const { return true ; }
+
+    inline void addPoint(float dist, uint index) {
+        if ( dist < radius_ ) matches_.emplace_back(index, dist) ;
+    }
+
+    inline float worstDist() const { return radius_ ; }
+
+    float radius_ ;
+    vector<pair<uint, float>> &matches_ ;
+};
+
+// Result set keeping only the closest point. The initial worst distance bounds the search.
+
+struct NearestResultSet
+{
+    NearestResultSet(float max_dist): dist_(max_dist), index_(-1) {}
+
+    inline size_t size() const { return ( index_ == uint(-1) ) ? 0 : 1 ; }
+    inline bool full() const { return true ; }
+
+    inline void addPoint(float dist, uint index) {
+        if ( dist < dist_ ) {
+            dist_ = dist ;
+            index_ = index ;
+        }
+    }
+
+    inline float worstDist() const { return dist_ ; }
+
+    float dist_ ;
+    uint index_ ;
+};
+
+// Wraps a result set to stop the search once the check budget is spent. Reporting a negative worst distance makes
+// nanoflann skip all remaining leaf points and subtrees.
+
+template <class RESULTSET>
+struct CheckBudgetResultSet
+{
+    CheckBudgetResultSet(RESULTSET &results, size_t max_checks): results_(results), max_checks_(max_checks) {}
+
+    inline size_t size() const { return results_.size() ; }
+    inline bool full() const { return results_.full() ; }
+
+    inline void addPoint(float dist, uint index) { results_.addPoint(dist, index) ; }
+
+    inline float worstDist() const {
+        return ( search_checks >= max_checks_ ) ? -1.0f : results_.worstDist() ;
+    }
+
+    RESULTSET &results_ ;
+    size_t max_checks_ ;
 };
 
-class KDTreeIndex3
+template <int D>
+class KDTreeIndex
 {
 public:
 
-    typedef PointList3f point_list_t ;
+    typedef Eigen::Matrix<float, D, 1> point_t ;
+    typedef PointCloudAdaptor<D> adaptor_t ;
 
-    KDTreeIndex3(const point_list_t &data) {
-        data_.reset(new PointCloudAdaptor3(data)) ;
-        index_.reset(new  kd_tree_t(3, *data_, KDTreeSingleIndexAdaptorParams(10 /* max leaf */) ) ) ;
+    KDTreeIndex(adaptor_t *data, const KDTreeParameters &params = KDTreeParameters()): data_(data), params_(params) {
+        data_->count_checks_ = ( params.max_checks_ > 0 ) ;
+        index_.reset(new  kd_tree_t(D, *data_, KDTreeSingleIndexAdaptorParams(params.leaf_size_) ) ) ;
         index_->buildIndex() ;
     }
 
-    void knn(const Vector3f &q, uint k, vector<uint> &indices, vector<float> &distances) {
+    bool nearest(const point_t &q, float max_dist, uint &idx, float &dist) const {
+        NearestResultSet results(max_dist) ;
+        search(results, q) ;
+        idx = results.index_ ;
+        dist = results.dist_ ;
+        return results.size() == 1 ;
+    }
+
+    void knn(const point_t &q, uint k, vector<uint> &indices, vector<float> &distances) const {
         k = std::min(data_->kdtree_get_point_count(), (size_t)k) ;
         indices.resize(k) ;
         distances.resize(k) ;
         KNNResultSet<float, uint> results(k);
         results.init(indices.data(), distances.data() );
-        index_->findNeighbors(results, q.data(), nanoflann::SearchParams());
+        search(results, q) ;
+        // the check budget may end the search before k points are found
+        indices.resize(results.size()) ;
+        distances.resize(results.size()) ;
     }
 
-    void radiusSearch(const Vector3f &q, float radius, vector<uint> &indices, vector<float> &distances) {
+    void radiusSearch(const point_t &q, float radius, vector<uint> &indices, vector<float> &distances) const {
 
-        std::vector<std::pair<uint,float> > indices_dists;
+        // scratch list reused by all searches of the calling thread
+        static thread_local std::vector<std::pair<uint,float> > indices_dists;
 
-        index_->radiusSearch(q.data(), radius, indices_dists, nanoflann::SearchParams());
+        indices_dists.clear() ;
+        AppendRadiusResultSet results(radius, indices_dists) ;
+        search(results, q) ;
+        std::sort(indices_dists.begin(), indices_dists.end(), IndexDist_Sorter()) ;
 
         for( uint i=0 ; i<indices_dists.size() ; i++ ) {
            indices.push_back(indices_dists[i].first) ;
@@ -79,195 +178,652 @@ public:
         }
     }
 
+    void knn(const point_t *queries, size_t n_queries, uint k, uint *indices, float *distances) const {
+        uint kn = std::min(data_->kdtree_get_point_count(), (size_t)k) ;
+
+#pragma omp parallel for schedule(dynamic, 256)
+        for( size_t i=0 ; i<n_queries ; i++ ) {
+            uint *q_indices = indices + i * k ;
+            float *q_distances = distances + i * k ;
+
+            KNNResultSet<float, uint> results(kn);
+            results.init(q_indices, q_distances) ;
+            search(results, queries[i]) ;
+
+            for( uint j=results.size() ; j<k ; j++ ) {
+                q_indices[j] = -1 ;
+                q_distances[j] = std::numeric_limits<float>::max() ;
+            }
+        }
+    }
+
+    void radiusSearch(const point_t *queries, size_t n_queries, float radius,
+                      vector<size_t> &offsets, vector<uint> &indices, vector<float> &distances) const {
+
+        // queries are processed in blocks; each block gathers its matches in a private list which is then copied to its
+        // place in the output, once the offsets are known
+
+        const size_t block_size = 1024 ;
+        size_t n_blocks = ( n_queries + block_size - 1 ) / block_size ;
+
+        vector<vector<pair<uint, float>>> block_matches(n_blocks) ;
+
+        offsets.resize(n_queries + 1) ;
+        offsets[0] = 0 ;
+
+#pragma omp parallel for schedule(dynamic)
+        for( size_t b=0 ; b<n_blocks ; b++ ) {
+            vector<pair<uint, float>> &matches = block_matches[b] ;
+            size_t last = std::min(n_queries, (b + 1) * block_size) ;
+
+            for( size_t i = b * block_size ; i<last ; i++ ) {
+                size_t first_match = matches.size() ;
+                AppendRadiusResultSet results(radius, matches) ;
+                search(results, queries[i]) ;
+                std::sort(matches.begin() + first_match, matches.end(), IndexDist_Sorter()) ;
+                offsets[i+1] = matches.size() - first_match ;
+            }
+        }
+
+        for( size_t i=0 ; i<n_queries ; i++ )
+            offsets[i+1] += offsets[i] ;
+
+        indices.resize(offsets[n_queries]) ;
+        distances.resize(offsets[n_queries]) ;
+
+#pragma omp parallel for schedule(dynamic)
+        for( size_t b=0 ; b<n_blocks ; b++ ) {
+            const vector<pair<uint, float>> &matches = block_matches[b] ;
+            size_t offset = offsets[b * block_size] ;
+            for( size_t j=0 ; j<matches.size() ; j++ ) {
+                indices[offset + j] = matches[j].first ;
+                distances[offset + j] = matches[j].second ;
+            }
+        }
+    }
+
+    // search with a custom result set
+    template <class RESULTSET>
+    void search(RESULTSET &results, const point_t &q) const {
+        nanoflann::SearchParams search_params(32, params_.eps_) ;
+
+        if ( params_.max_checks_ == 0 )
+            index_->findNeighbors(results, q.data(), search_params);
+        else {
+            CheckBudgetResultSet<RESULTSET> bounded(results, params_.max_checks_) ;
+            search_checks = 0 ;
+            index_->findNeighbors(bounded, q.data(), search_params);
+        }
+    }
+
+    const adaptor_t &data() const { return *data_ ; }
+
 private:
 
-    typedef nanoflann::KDTreeSingleIndexAdaptor< L2_Simple_Adaptor<float, PointCloudAdaptor3 > , PointCloudAdaptor3,  3 /* dim */, uint > kd_tree_t;
+    typedef nanoflann::KDTreeSingleIndexAdaptor< L2_Simple_Adaptor<float, adaptor_t > , adaptor_t,  D /* dim */, uint > kd_tree_t;
 
-    std::shared_ptr<kd_tree_t> index_ ;
-    std::shared_ptr<PointCloudAdaptor3> data_ ;
+    // the adaptor is declared first so that it outlives the index referencing it
+    std::unique_ptr<adaptor_t> data_ ;
+    std::unique_ptr<kd_tree_t> index_ ;
+    KDTreeParameters params_ ;
 };
 
-KDTree3::KDTree3(const point_list_t &data): index_(new KDTreeIndex3(data))
+class KDTreeIndex3: public KDTreeIndex<3> {
+public:
+    using KDTreeIndex<3>::KDTreeIndex ;
+};
+
+class KDTreeIndex2: public KDTreeIndex<2> {
+public:
+    using KDTreeIndex<2>::KDTreeIndex ;
+};
+
+KDTree3::KDTree3(const point_list_t &data, const Parameters &params)
 {
+    train(data, params) ;
+}
 
+KDTree3::KDTree3(point_list_t &&data, const Parameters &params)
+{
+    train(std::move(data), params) ;
 }
 
-void KDTree3::train(const point_list_t &data)
+KDTree3::KDTree3(const ConstMap<float, 3> &data, const Parameters &params)
 {
-    index_.reset(new KDTreeIndex3(data)) ;
+    train(data, params) ;
 }
 
-uint KDTree3::nearest(const point_t &q)
+KDTree3::KDTree3(const float *data, size_t n, size_t stride, const Parameters &params)
 {
-    vector<uint> indices ;
-    vector<float> distances ;
+    train(data, n, stride, params) ;
+}
 
-    index_->knn(q, 1, indices, distances) ;
+void KDTree3::train(const point_list_t &data, const Parameters &params)
+{
+    train(point_list_t(data), params) ;
+}
 
-    return indices[0] ;
+void KDTree3::train(point_list_t &&data, const Parameters &params)
+{
+    index_.reset(new KDTreeIndex3(new PointCloudAdaptor<3>(std::move(data)), params)) ;
 }
 
-uint KDTree3::nearest(const point_t &q, float &dist)
+void KDTree3::train(const ConstMap<float, 3> &data, const Parameters &params)
 {
-    vector<uint> indices ;
-    vector<float> distances ;
+    train(data.data(), data.rows(), 3, params) ;
+}
 
-    index_->knn(q, 1, indices, distances) ;
+void KDTree3::train(const float *data, size_t n, size_t stride, const Parameters &params)
+{
+    index_.reset(new KDTreeIndex3(new PointCloudAdaptor<3>(data, n, stride), params)) ;
+}
 
-    dist = distances[0] ;
+void KDTree3::borrow(const point_list_t &data, const Parameters &params)
+{
+    train(reinterpret_cast<const float *>(data.data()), data.size(), 3, params) ;
+}
 
-    return indices[0] ;
+uint KDTree3::nearest(const point_t &q) const
+{
+    uint idx ;
+    float dist ;
+
+    index_->nearest(q, std::numeric_limits<float>::max(), idx, dist) ;
+
+    return idx ;
 }
 
-void KDTree3::knearest(const point_t &q, uint k, std::vector<uint> &indexes)
+uint KDTree3::nearest(const point_t &q, float &dist) const
 {
-    vector<float> distances ;
+    uint idx ;
+
+    index_->nearest(q, std::numeric_limits<float>::max(), idx, dist) ;
+
+    return idx ;
+}
+
+bool KDTree3::nearest(const point_t &q, float max_dist, uint &idx, float &dist) const
+{
+    return index_->nearest(q, max_dist, idx, dist) ;
+}
+
+void KDTree3::knearest(const point_t &q, uint k, std::vector<uint> &indexes) const
+{
+    static thread_local vector<float> distances ;
 
     index_->knn(q, k, indexes, distances) ;
 
 }
 
-void KDTree3::knearest(const point_t &q, uint k, std::vector<uint> &indexes, vector<float> &distances)
+void KDTree3::knearest(const point_t &q, uint k, std::vector<uint> &indexes, vector<float> &distances) const
 {
     index_->knn(q, k, indexes, distances) ;
 }
 
-void KDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes)
+void KDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) const
 {
-    vector<float> distances ;
+    static thread_local vector<float> distances ;
+    distances.clear() ;
     index_->radiusSearch(q, radius, indexes, distances) ;
 }
 
-void KDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes,  vector<float> &distances )
+void KDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes,  vector<float> &distances ) const
 {
     index_->radiusSearch(q, radius, indexes, distances) ;
 }
 
+void KDTree3::knearest(const point_list_t &queries, uint k, uint *indexes, float *distances) const
+{
+    index_->knn(queries.data(), queries.size(), k, indexes, distances) ;
+}
+
+void KDTree3::knearest(const point_list_t &queries, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const
+{
+    indexes.resize(queries.size() * k) ;
+    distances.resize(queries.size() * k) ;
+    index_->knn(queries.data(), queries.size(), k, indexes.data(), distances.data()) ;
+}
+
+void KDTree3::withinRadius(const point_list_t &queries, float radius, std::vector<size_t> &offsets,
+                           std::vector<uint> &indexes, std::vector<float> &distances) const
+{
+    index_->radiusSearch(queries.data(), queries.size(), radius, offsets, indexes, distances) ;
+}
+
 
 /////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-struct PointCloudAdaptor2
+// A static tree of the dynamic index. It owns a copy of its points, ids_ holds their ids in increasing order.
+
+struct KDSubTree3
 {
-    typedef PointList2f point_list_t ;
+    KDSubTree3(PointList3f &&pts, vector<uint> &&ids): ids_(std::move(ids)), index_(new PointCloudAdaptor<3>(std::move(pts))), n_removed_(0) {}
 
-    PointCloudAdaptor2(const point_list_t &data): pts_(data) {}
+    size_t size() const { return ids_.size() - n_removed_ ; }
 
-    // Must return the number of data points
-    inline size_t kdtree_get_point_count() const { return pts_.size(); }
+    const Vector3f &point(size_t i) const { return index_.data().storage_[i] ; }
 
-    // Returns the distance between the vector "p1[0:size-1]" and the data point with index "idx_p2" stored in the class:
-    inline float kdtree_distance(const float *p1, const size_t idx_p2, size_t /*size*/) const
-    {
-        const float d0=p1[0] - pts_[idx_p2].x();
-        const float d1=p1[1] - pts_[idx_p2].y();
-        return d0*d0+d1*d1;
+    // local index of the point with given id or -1
+    size_t find(uint id) const {
+        auto it = std::lower_bound(ids_.begin(), ids_.end(), id) ;
+        return ( it != ids_.end() && *it == id ) ? it - ids_.begin() : -1 ;
     }
 
-    // Returns the dim'th component of the idx'th point in the class:
-    // Since this is inlined and the "dim" argument is typically an immediate value, the
-    //  "if/else's" are actually solved at compile time.
-    inline float kdtree_get_pt(const size_t idx, int dim) const
-    {
-        if ( dim == 0 ) return pts_[idx].x();
-        else if (dim == 1 ) return pts_[idx].y();
-        else return 0 ;
+    vector<uint> ids_ ;
+    KDTreeIndex<3> index_ ;
+    size_t n_removed_ ;
+};
+
+// Result sets used to search the trees of the dynamic index. They translate local point indices of the tree currently
+// searched to ids and skip removed points. The same result set is passed to all trees so that the bound found in one
+// tree prunes the search in the next.
+
+struct ForestResultSet
+{
+    ForestResultSet(const unordered_set<uint> &removed): removed_(removed), tree_(nullptr) {}
+
+    inline bool accept(uint local, uint &id) const {
+        id = tree_->ids_[local] ;
+        return removed_.empty() || removed_.count(id) == 0 ;
     }
 
-    // Optional bounding-box computation: return false to default to a standard bbox computation loop.
-    //   Return true if the BBOX was already computed by the class and returned in "bb" so it can be avoided to redo it again.
-    //   Look at bb.size() to find out the expected dimensionality (e.g. 2 or 3 for point clouds)
-    template <class BBOX>
-    bool kdtree_get_bbox(BBOX& /* bb */) const { return false; }
+    const unordered_set<uint> &removed_ ;
+    const KDSubTree3 *tree_ ;
+};
+
+struct ForestNearestResultSet: public ForestResultSet
+{
+    ForestNearestResultSet(const unordered_set<uint> &removed, float max_dist):
+        ForestResultSet(removed), dist_(max_dist), id_(-1) {}
+
+    inline size_t size() const { return ( id_ == uint(-1) ) ? 0 : 1 ; }
+    inline bool full() const { return true ; }
+
+    inline void addPoint(float dist, uint local) {
+        uint id ;
+        if ( dist < dist_ && accept(local, id) ) {
+            dist_ = dist ;
+            id_ = id ;
+        }
+    }
 
-    const point_list_t &pts_;
+    inline float worstDist() const { return dist_ ; }
+
+    float dist_ ;
+    uint id_ ;
+};
+
+struct ForestKNNResultSet: public ForestResultSet
+{
+    ForestKNNResultSet(const unordered_set<uint> &removed, uint k, uint *ids, float *dists):
+        ForestResultSet(removed), k_(k), count_(0), ids_(ids), dists_(dists) {}
+
+    inline size_t size() const { return count_ ; }
+    inline bool full() const { return count_ == k_ ; }
+
+    inline void addPoint(float dist, uint local) {
+        uint id ;
+        if ( !accept(local, id) ) return ;
+
+        uint i ;
+        for( i=count_ ; i>0 && dists_[i-1] > dist ; --i ) {
+            if ( i < k_ ) {
+                dists_[i] = dists_[i-1] ;
+                ids_[i] = ids_[i-1] ;
+            }
+        }
+        if ( i < k_ ) {
+            dists_[i] = dist ;
+            ids_[i] = id ;
+        }
+        if ( count_ < k_ ) count_ ++ ;
+    }
+
+    inline float worstDist() const { return full() ? dists_[k_-1] : std::numeric_limits<float>::max() ; }
+
+    uint k_, count_ ;
+    uint *ids_ ;
+    float *dists_ ;
 };
 
-class KDTreeIndex2
+struct ForestRadiusResultSet: public ForestResultSet
+{
+    ForestRadiusResultSet(const unordered_set<uint> &removed, float radius, vector<pair<uint, float>> &matches):
+        ForestResultSet(removed), radius_(radius), matches_(matches) {}
+
+    inline size_t size() const { return matches_.size() ; }
+    inline bool full() const { return true ; }
+
+    inline void addPoint(float dist, uint local) {
+        uint id ;
+        if ( dist < radius_ && accept(local, id) ) matches_.emplace_back(id, dist) ;
+    }
+
+    inline float worstDist() const { return radius_ ; }
+
+    float radius_ ;
+    vector<pair<uint, float>> &matches_ ;
+};
+
+class DynamicKDTreeIndex3
 {
 public:
 
-    typedef PointList2f point_list_t ;
+    typedef Vector3f point_t ;
 
-    KDTreeIndex2(const point_list_t &data) {
-        data_.reset(new PointCloudAdaptor2(data)) ;
-        index_.reset(new  kd_tree_t(2, *data_, KDTreeSingleIndexAdaptorParams(10 /* max leaf */) ) ) ;
-        index_->buildIndex() ;
+    DynamicKDTreeIndex3(): next_id_(0), n_points_(0) {}
+
+    uint insert(const PointList3f &data) {
+        uint first = next_id_ ;
+
+        if ( data.empty() ) return first ;
+
+        PointList3f pts ;
+        vector<uint> ids ;
+
+        // merge with the most recent trees while they are at most twice the size of the new one. Trees are kept
+        // oldest first so that the ids of the merged tree remain sorted
+
+        size_t n = data.size() ;
+        size_t n_merged = 0 ;
+        while ( n_merged < trees_.size() && trees_[trees_.size() - n_merged - 1]->size() <= 2 * n ) {
+            n += trees_[trees_.size() - n_merged - 1]->size() ;
+            ++n_merged ;
+        }
+
+        pts.reserve(n) ;
+        ids.reserve(n) ;
+
+        for( size_t t = trees_.size() - n_merged ; t < trees_.size() ; t++ )
+            collect(*trees_[t], pts, ids) ;
+
+        trees_.resize(trees_.size() - n_merged) ;
+
+        pts.insert(pts.end(), data.begin(), data.end()) ;
+        for( size_t i=0 ; i<data.size() ; i++ ) ids.push_back(next_id_++) ;
+
+        trees_.emplace_back(new KDSubTree3(std::move(pts), std::move(ids))) ;
+
+        n_points_ += data.size() ;
+
+        return first ;
     }
 
-    void knn(const Vector2f &q, uint k, vector<uint> &indices, vector<float> &distances) {
-        k = std::min(data_->kdtree_get_point_count(), (size_t)k) ;
-        indices.resize(k) ;
+    void remove(const vector<uint> &ids) {
+        vector<KDSubTree3 *> modified ;
+
+        for( uint id: ids ) {
+            KDSubTree3 *tree = findTree(id) ;
+            if ( !tree || tree->find(id) == size_t(-1) ) continue ;
+            if ( !removed_.insert(id).second ) continue ;
+
+            tree->n_removed_ ++ ;
+            n_points_ -- ;
+            modified.push_back(tree) ;
+        }
+
+        // rebuild trees that lost more than half of their points
+
+        for( size_t t=0 ; t<trees_.size() ; ) {
+            KDSubTree3 *tree = trees_[t].get() ;
+            if ( 2 * tree->n_removed_ > tree->ids_.size() &&
+                 std::find(modified.begin(), modified.end(), tree) != modified.end() ) {
+                PointList3f pts ;
+                vector<uint> tree_ids ;
+                collect(*tree, pts, tree_ids) ;
+
+                if ( pts.empty() ) {
+                    trees_.erase(trees_.begin() + t) ;
+                    continue ;
+                }
+
+                trees_[t].reset(new KDSubTree3(std::move(pts), std::move(tree_ids))) ;
+            }
+            ++t ;
+        }
+    }
+
+    size_t size() const { return n_points_ ; }
+
+    const point_t &point(uint id) const {
+        const KDSubTree3 *tree = findTree(id) ;
+        assert( tree ) ;
+        size_t idx = tree->find(id) ;
+        assert( idx != size_t(-1) && removed_.count(id) == 0 ) ;
+        return tree->point(idx) ;
+    }
+
+    bool nearest(const point_t &q, float max_dist, uint &id, float &dist) const {
+        ForestNearestResultSet results(removed_, max_dist) ;
+        search(results, q) ;
+        id = results.id_ ;
+        dist = results.dist_ ;
+        return results.size() == 1 ;
+    }
+
+    void knn(const point_t &q, uint k, vector<uint> &ids, vector<float> &distances) const {
+        k = std::min(n_points_, (size_t)k) ;
+        ids.resize(k) ;
         distances.resize(k) ;
-        KNNResultSet<float, uint> results(k);
-        results.init(indices.data(), distances.data() );
-        index_->findNeighbors(results, q.data(), nanoflann::SearchParams());
+        if ( k == 0 ) return ;
+        ForestKNNResultSet results(removed_, k, ids.data(), distances.data()) ;
+        search(results, q) ;
     }
 
-    void radiusSearch(const Vector2f &q, float radius, vector<uint> &indices, vector<float> &distances) {
+    void radiusSearch(const point_t &q, float radius, vector<uint> &ids, vector<float> &distances) const {
+        static thread_local vector<pair<uint, float>> matches ;
+        matches.clear() ;
 
-        std::vector<std::pair<uint,float> > indices_dists;
+        ForestRadiusResultSet results(removed_, radius, matches) ;
+        search(results, q) ;
 
-        index_->radiusSearch(q.data(), radius, indices_dists, nanoflann::SearchParams());
+        std::sort(matches.begin(), matches.end(), IndexDist_Sorter()) ;
 
-        for( uint i=0 ; i<indices_dists.size() ; i++ ) {
-           indices.push_back(indices_dists[i].first) ;
-           distances.push_back(indices_dists[i].second) ;
+        for( uint i=0 ; i<matches.size() ; i++ ) {
+           ids.push_back(matches[i].first) ;
+           distances.push_back(matches[i].second) ;
         }
     }
 
 private:
 
-    typedef nanoflann::KDTreeSingleIndexAdaptor< L2_Simple_Adaptor<float, PointCloudAdaptor2 > , PointCloudAdaptor2,  2 /* dim */, uint > kd_tree_t;
+    // visit largest trees first, they give the tightest bound for the remaining ones
+    template <class RESULTSET>
+    void search(RESULTSET &results, const point_t &q) const {
+        for( const auto &tree: trees_ ) {
+            results.tree_ = tree.get() ;
+            tree->index_.search(results, q) ;
+        }
+    }
 
-    std::shared_ptr<kd_tree_t> index_ ;
-    std::shared_ptr<PointCloudAdaptor2> data_ ;
+    // append the points of tree that have not been removed
+    void collect(const KDSubTree3 &tree, PointList3f &pts, vector<uint> &ids) {
+        for( size_t i=0 ; i<tree.ids_.size() ; i++ ) {
+            uint id = tree.ids_[i] ;
+            if ( tree.n_removed_ && removed_.erase(id) ) continue ;
+            pts.push_back(tree.point(i)) ;
+            ids.push_back(id) ;
+        }
+    }
+
+    // the tree whose id range contains id
+    KDSubTree3 *findTree(uint id) const {
+        auto it = std::upper_bound(trees_.begin(), trees_.end(), id,
+                                   [](uint id, const std::unique_ptr<KDSubTree3> &t) { return id < t->ids_.front() ; }) ;
+        if ( it == trees_.begin() ) return nullptr ;
+        return (--it)->get() ;
+    }
+
+    vector<std::unique_ptr<KDSubTree3>> trees_ ;
+    unordered_set<uint> removed_ ;
+    uint next_id_ ;
+    size_t n_points_ ;
 };
 
-KDTree2::KDTree2(const point_list_t &data): index_(new KDTreeIndex2(data)) {
+DynamicKDTree3::DynamicKDTree3(): index_(new DynamicKDTreeIndex3)
+{
+}
 
+uint DynamicKDTree3::insert(const point_list_t &data)
+{
+    return index_->insert(data) ;
+}
+
+void DynamicKDTree3::remove(const std::vector<uint> &ids)
+{
+    index_->remove(ids) ;
 }
 
-void KDTree2::train(const point_list_t &data) {
-    index_.reset(new KDTreeIndex2(data)) ;
+size_t DynamicKDTree3::size() const
+{
+    return index_->size() ;
+}
+
+const DynamicKDTree3::point_t &DynamicKDTree3::point(uint id) const
+{
+    return index_->point(id) ;
 }
 
-uint KDTree2::nearest(const point_t &q) {
-    vector<uint> indices ;
-    vector<float> distances ;
+uint DynamicKDTree3::nearest(const point_t &q) const
+{
+    uint id ;
+    float dist ;
 
-    index_->knn(q, 1, indices, distances) ;
+    index_->nearest(q, std::numeric_limits<float>::max(), id, dist) ;
 
-    return indices[0] ;
+    return id ;
 }
 
-uint KDTree2::nearest(const point_t &q, float &dist) {
-    vector<uint> indices ;
-    vector<float> distances ;
+uint DynamicKDTree3::nearest(const point_t &q, float &dist) const
+{
+    uint id ;
 
-    index_->knn(q, 1, indices, distances) ;
+    index_->nearest(q, std::numeric_limits<float>::max(), id, dist) ;
 
-    dist = distances[0] ;
+    return id ;
+}
 
-    return indices[0] ;
+bool DynamicKDTree3::nearest(const point_t &q, float max_dist, uint &id, float &dist) const
+{
+    return index_->nearest(q, max_dist, id, dist) ;
 }
 
-void KDTree2::knearest(const point_t &q, uint k, std::vector<uint> &indexes) {
-    vector<float> distances ;
+void DynamicKDTree3::knearest(const point_t &q, uint k, std::vector<uint> &ids) const
+{
+    static thread_local vector<float> distances ;
+
+    index_->knn(q, k, ids, distances) ;
+}
+
+void DynamicKDTree3::knearest(const point_t &q, uint k, std::vector<uint> &ids, vector<float> &distances) const
+{
+    index_->knn(q, k, ids, distances) ;
+}
+
+void DynamicKDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &ids) const
+{
+    static thread_local vector<float> distances ;
+    distances.clear() ;
+    index_->radiusSearch(q, radius, ids, distances) ;
+}
+
+void DynamicKDTree3::withinRadius(const point_t &q, float radius, std::vector<uint> &ids,  vector<float> &distances ) const
+{
+    index_->radiusSearch(q, radius, ids, distances) ;
+}
+
+/////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+KDTree2::KDTree2(const point_list_t &data, const Parameters &params) {
+    train(data, params) ;
+}
+
+KDTree2::KDTree2(point_list_t &&data, const Parameters &params) {
+    train(std::move(data), params) ;
+}
+
+KDTree2::KDTree2(const ConstMap<float, 2> &data, const Parameters &params) {
+    train(data, params) ;
+}
+
+KDTree2::KDTree2(const float *data, size_t n, size_t stride, const Parameters &params) {
+    train(data, n, stride, params) ;
+}
+
+void KDTree2::train(const point_list_t &data, const Parameters &params) {
+    train(point_list_t(data), params) ;
+}
+
+void KDTree2::train(point_list_t &&data, const Parameters &params) {
+    index_.reset(new KDTreeIndex2(new PointCloudAdaptor<2>(std::move(data)), params)) ;
+}
+
+void KDTree2::train(const ConstMap<float, 2> &data, const Parameters &params) {
+    train(data.data(), data.rows(), 2, params) ;
+}
+
+void KDTree2::train(const float *data, size_t n, size_t stride, const Parameters &params) {
+    index_.reset(new KDTreeIndex2(new PointCloudAdaptor<2>(data, n, stride), params)) ;
+}
+
+void KDTree2::borrow(const point_list_t &data, const Parameters &params) {
+    train(reinterpret_cast<const float *>(data.data()), data.size(), 2, params) ;
+}
+
+uint KDTree2::nearest(const point_t &q) const {
+    uint idx ;
+    float dist ;
+
+    index_->nearest(q, std::numeric_limits<float>::max(), idx, dist) ;
+
+    return idx ;
+}
+
+uint KDTree2::nearest(const point_t &q, float &dist) const {
+    uint idx ;
+
+    index_->nearest(q, std::numeric_limits<float>::max(), idx, dist) ;
+
+    return idx ;
+}
+
+bool KDTree2::nearest(const point_t &q, float max_dist, uint &idx, float &dist) const {
+    return index_->nearest(q, max_dist, idx, dist) ;
+}
+
+void KDTree2::knearest(const point_t &q, uint k, std::vector<uint> &indexes) const {
+    static thread_local vector<float> distances ;
 
     index_->knn(q, k, indexes, distances) ;
 }
 
-void KDTree2::knearest(const point_t &q, uint k, std::vector<uint> &indexes, vector<float> &distances) {
+void KDTree2::knearest(const point_t &q, uint k, std::vector<uint> &indexes, vector<float> &distances) const {
     index_->knn(q, k, indexes, distances) ;
 }
 
-void KDTree2::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) {
-    vector<float> distances ;
+void KDTree2::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes) const {
+    static thread_local vector<float> distances ;
+    distances.clear() ;
     index_->radiusSearch(q, radius, indexes, distances) ;
 }
 
-void KDTree2::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes,  vector<float> &distances ) {
+void KDTree2::withinRadius(const point_t &q, float radius, std::vector<uint> &indexes,  vector<float> &distances ) const {
     index_->radiusSearch(q, radius, indexes, distances) ;
 }
 
+void KDTree2::knearest(const point_list_t &queries, uint k, uint *indexes, float *distances) const {
+    index_->knn(queries.data(), queries.size(), k, indexes, distances) ;
+}
+
+void KDTree2::knearest(const point_list_t &queries, uint k, std::vector<uint> &indexes, std::vector<float> &distances) const {
+    indexes.resize(queries.size() * k) ;
+    distances.resize(queries.size() * k) ;
+    index_->knn(queries.data(), queries.size(), k, indexes.data(), distances.data()) ;
+}
+
+void KDTree2::withinRadius(const point_list_t &queries, float radius, std::vector<size_t> &offsets,
+                           std::vector<uint> &indexes, std::vector<float> &distances) const {
+    index_->radiusSearch(queries.data(), queries.size(), radius, offsets, indexes, distances) ;
+}
+
 }
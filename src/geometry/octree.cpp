@@ -1,5 +1,7 @@
 #include <cvx/geometry/octree.hpp>
-#include <functional>
+#include <cvx/camera/camera.hpp>
+#include <algorithm>
+#include <cmath>
 #include <float.h>
 
 using namespace Eigen ;
@@ -7,58 +9,193 @@ using namespace std ;
 
 namespace cvx {
 
-class OctreeVisitor
-{
-public:
+// spread the lower 21 bits of x so that there are two zero bits between each of them
+static uint64_t spreadBits(uint64_t x) {
+    x &= 0x1fffff ;
+    x = ( x | x << 32 ) & 0x1f00000000ffffull ;
+    x = ( x | x << 16 ) & 0x1f0000ff0000ffull ;
+    x = ( x | x << 8 ) & 0x100f00f00f00f00full ;
+    x = ( x | x << 4 ) & 0x10c30c30c30c30c3ull ;
+    x = ( x | x << 2 ) & 0x1249249249249249ull ;
+    return x ;
+}
+
+static uint64_t compactBits(uint64_t x) {
+    x &= 0x1249249249249249ull ;
+    x = ( x ^ ( x >> 2 ) ) & 0x10c30c30c30c30c3ull ;
+    x = ( x ^ ( x >> 4 ) ) & 0x100f00f00f00f00full ;
+    x = ( x ^ ( x >> 8 ) ) & 0x1f0000ff0000ffull ;
+    x = ( x ^ ( x >> 16 ) ) & 0x1f00000000ffffull ;
+    x = ( x ^ ( x >> 32 ) ) & 0x1fffff ;
+    return x ;
+}
+
+typedef std::pair<uint64_t, uint> MortonKey ;
+
+// sort chunks in parallel and merge them pairwise
+static void parallelSort(vector<MortonKey> &keys) {
+    const size_t n = keys.size(), min_chunk_size = 1 << 16, max_chunks = 64 ;
+
+    size_t n_chunks = 1 ;
+    while ( n_chunks < max_chunks && n / ( 2 * n_chunks ) >= min_chunk_size ) n_chunks *= 2 ;
+    const size_t chunk_size = ( n + n_chunks - 1 ) / n_chunks ;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for( size_t c=0 ; c<n_chunks ; c++ ) {
+        size_t first = std::min(c * chunk_size, n), last = std::min(first + chunk_size, n) ;
+        std::sort(keys.begin() + first, keys.begin() + last) ;
+    }
+
+    for( size_t width = chunk_size ; width < n ; width *= 2 ) {
+        const size_t n_merges = ( n + 2 * width - 1 ) / ( 2 * width ) ;
+
+#pragma omp parallel for schedule(dynamic, 1)
+        for( size_t m=0 ; m<n_merges ; m++ ) {
+            size_t first = m * 2 * width, mid = std::min(first + width, n), last = std::min(first + 2 * width, n) ;
+            std::inplace_merge(keys.begin() + first, keys.begin() + mid, keys.begin() + last) ;
+        }
+    }
+}
+
+LinearOctreeBase::LinearOctreeBase(const Vector3f &bmin, const Vector3f &bmax, const Vector3f &cell):
+    bmin_(bmin), bmax_(bmax), cell_(cell), depth_(0) {
+
+    // same number of subdivisions as Octree::insert, limited by the 63 bits of the codes
+    Vector3f delta = bmax - bmin ;
+    while ( delta >= cell_ && depth_ < 21 ) {
+        delta *= 0.5f ;
+        ++depth_ ;
+    }
+}
+
+uint64_t LinearOctreeBase::leafCode(const Vector3f &p) const {
+    const int64_t max_coord = ( int64_t(1) << depth_ ) - 1 ;
+    const float scale = float(int64_t(1) << depth_) ;
+
+    uint64_t code = 0 ;
+    for( int c=0 ; c<3 ; c++ ) {
+        int64_t v = (int64_t)std::floor(( p[c] - bmin_[c] ) / ( bmax_[c] - bmin_[c] ) * scale) ;
+        v = std::max<int64_t>(0, std::min(v, max_coord)) ;
+        code |= spreadBits(v) << c ;
+    }
+    return code ;
+}
+
+void LinearOctreeBase::cellBounds(uint64_t code, uint level, Vector3f &bmin, Vector3f &bmax) const {
+    Vector3f size = ( bmax_ - bmin_ ) / float(int64_t(1) << level) ;
+    Vector3f coords(compactBits(code), compactBits(code >> 1), compactBits(code >> 2)) ;
+    bmin = bmin_ + coords.cwiseProduct(size) ;
+    bmax = bmin + size ;
+}
 
-    OctreeVisitor(const PointList3f &cloud, PointList3f &centers): cloud_(cloud), centers_(centers) {}
+void LinearOctreeBase::index(const PointList3f &pos, vector<uint> &perm) {
+    const size_t n = pos.size() ;
 
-    bool visit(const Vector3f &, const Vector3f &, const vector<uint> &data) {
+    vector<MortonKey> keys(n) ;
 
-        uint n = data.size() ;
+#pragma omp parallel for
+    for( size_t i=0 ; i<n ; i++ )
+        keys[i] = MortonKey(leafCode(pos[i]), i) ;
 
-        if ( n > 0 )
-        {
-            Vector3f c(0, 0, 0) ;
-            for(uint i=0 ; i<n ; i++)  c += cloud_[data[i]] ;
-            c /= n ;
+    parallelSort(keys) ;
 
-            float min_dist = std::numeric_limits<float>::max() ;
-            Vector3f best_pt ;
+    perm.resize(n) ;
+    leaf_codes_.clear() ;
+    leaf_offsets_.clear() ;
 
-            for(uint i=0 ; i<n ; i++) {
-                const Vector3f &p = cloud_[data[i]] ;
-                float d = ( p - c ).squaredNorm() ;
-                if ( d < min_dist ) {
-                    min_dist = d ;
-                    best_pt = p ;
-                }
+    for( size_t i=0 ; i<n ; i++ ) {
+        perm[i] = keys[i].second ;
+        if ( i == 0 || keys[i].first != keys[i-1].first ) {
+            leaf_codes_.push_back(keys[i].first) ;
+            leaf_offsets_.push_back(i) ;
+        }
+    }
+    leaf_offsets_.push_back(n) ;
+
+    // Emit nodes in depth-first order. Consecutive leaves share the ancestors above the highest differing bit triplet
+    // of their codes; the nodes below it are closed and those of the new leaf opened.
+
+    nodes_.clear() ;
+    vector<uint> open(depth_ + 1) ;
+
+    const uint n_leaves = leaf_codes_.size() ;
+
+    for( uint l=0 ; l<n_leaves ; l++ ) {
+        uint64_t code = leaf_codes_[l] ;
+        uint first_level = 0 ;
+
+        if ( l > 0 ) {
+            int bit = 63 - __builtin_clzll(code ^ leaf_codes_[l-1]) ;
+            first_level = depth_ - bit/3 ;
+
+            for( uint level = first_level ; level <= depth_ ; level++ ) {
+                Node &node = nodes_[open[level]] ;
+                node.last_leaf_ = l ;
+                node.next_ = nodes_.size() ;
             }
+        }
 
-            centers_.push_back(best_pt) ;
-            return false ;
+        for( uint level = first_level ; level <= depth_ ; level++ ) {
+            open[level] = nodes_.size() ;
+            nodes_.push_back(Node{code >> ( 3 * ( depth_ - level ) ), level, 0, l, 0}) ;
         }
+    }
 
-        return true ;
+    if ( n_leaves > 0 ) {
+        for( uint level = 0 ; level <= depth_ ; level++ ) {
+            Node &node = nodes_[open[level]] ;
+            node.last_leaf_ = n_leaves ;
+            node.next_ = nodes_.size() ;
+        }
     }
+}
+
+Frustum::Frustum(const PinholeCamera &cam, const Isometry3f &pose, float znear, float zfar) {
+    // extent of the image plane at unit depth
+    float l = -cam.cx() / cam.fx(), r = ( cam.width() - cam.cx() ) / cam.fx() ;
+    float t = -cam.cy() / cam.fy(), b = ( cam.height() - cam.cy() ) / cam.fy() ;
 
-    const PointList3f &cloud_ ;
-    PointList3f &centers_ ;
+    // planes in camera coordinates: left, right, top, bottom, near, far
+    const Vector3f normals[6] = { {1, 0, -l}, {-1, 0, r}, {0, 1, -t}, {0, -1, b}, {0, 0, 1}, {0, 0, -1} } ;
+    const float offsets[6] = { 0, 0, 0, 0, -znear, zfar } ;
 
-};
+    for( int i=0 ; i<6 ; i++ ) {
+        normals_[i] = pose.linear() * normals[i] ;
+        offsets_[i] = offsets[i] - normals_[i].dot(pose.translation()) ;
+    }
+}
 
 void sampleCloudCenters(const PointList3f &cloud, float cell_size, PointList3f &res, const Vector3f &pmin, const Vector3f &pmax) {
 
-    OctreeIndexed tree(pmin, pmax, Vector3f(cell_size, cell_size, cell_size)) ;
+    LinearOctreeIndexed tree(pmin, pmax, Vector3f(cell_size, cell_size, cell_size)) ;
+    tree.build(cloud) ;
 
-    for(uint i=0 ; i<cloud.size() ; i++ )
-        tree.insert(cloud[i], i) ;
+    const size_t n_leaves = tree.numLeaves() ;
+    size_t offset = res.size() ;
+    res.resize(offset + n_leaves) ;
 
-    using namespace std::placeholders;
+#pragma omp parallel for schedule(dynamic, 256)
+    for( size_t l=0 ; l<n_leaves ; l++ ) {
+        LinearOctreeIndexed::Range data = tree.leafData(l) ;
 
-    OctreeVisitor v(cloud, res) ;
-    tree.traverse(std::bind(&OctreeVisitor::visit, v, _1, _2, _3)) ;
-}
+        Vector3f c(0, 0, 0) ;
+        for( uint idx: data ) c += cloud[idx] ;
+        c /= data.size() ;
+
+        float min_dist = std::numeric_limits<float>::max() ;
+        Vector3f best_pt = cloud[data[0]] ;
 
+        for( uint idx: data ) {
+            const Vector3f &p = cloud[idx] ;
+            float d = ( p - c ).squaredNorm() ;
+            if ( d < min_dist ) {
+                min_dist = d ;
+                best_pt = p ;
+            }
+        }
+
+        res[offset + l] = best_pt ;
+    }
+}
 
 }
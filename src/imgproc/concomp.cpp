@@ -1,7 +1,7 @@
 #include <cvx/imgproc/concomp.hpp>
 
-#include <stack>
-#include <set>
+#include <climits>
+#include <unordered_map>
 
 using namespace std ;
 
@@ -9,157 +9,293 @@ namespace cvx {
 
 const int NOLABEL = INT_MAX ;
 
-struct ConRegionInfo
-{
-    ConRegionInfo(): comp_(NOLABEL) {}
+// Connected components on row runs. Each maximal horizontal run of foreground pixels gets a provisional label (its
+// index); runs of consecutive rows that touch are merged with a union-find whose roots are the smallest index of each
+// set. Since runs are indexed in raster order, numbering the roots in index order gives each component the rank of its
+// first pixel.
+//
+// The image is split into horizontal strips that are labelled in parallel; strips are then stitched along their
+// borders and the label image is written in parallel again.
+
+namespace {
 
-    set<unsigned int> eq_set_ ;
-    unsigned int comp_ ;
+struct Run {
+    int x0_, x1_ ;    // [x0, x1)
 } ;
 
-typedef vector<ConRegionInfo> EqTable ;
+struct Strip {
+    int y0_, y1_ ;
+    vector<Run> runs_ ;
+    vector<uint> row_start_ ;   // runs of row y0 + k are [row_start_[k], row_start_[k+1])
+    uint base_ ;                // index of the first run of the strip
+} ;
 
-static void dfs(EqTable& G, long v, unsigned int count)
-{
-    stack<unsigned long> S;
+class UnionFind {
+public:
+    UnionFind(uint n): parent_(n) {
+        for( uint i=0 ; i<n ; i++ ) parent_[i] = i ;
+    }
 
-    S.push(v);
-    G[v].comp_ = count;
+    uint find(uint a) {
+        while ( parent_[a] != a ) {
+            parent_[a] = parent_[parent_[a]] ; // path halving
+            a = parent_[a] ;
+        }
+        return a ;
+    }
 
-    while (!S.empty())
-    {
-        v = S.top() ;
-        S.pop() ;
+    void unite(uint a, uint b) {
+        a = find(a) ; b = find(b) ;
+        if ( a < b ) parent_[b] = a ;
+        else if ( b < a ) parent_[a] = b ;
+    }
 
-        set<unsigned int>::iterator it = G[v].eq_set_.begin() ;
+    vector<uint> parent_ ;
+} ;
 
-        for( ; it != G[v].eq_set_.end() ; it ++ )
-        {
-            unsigned int w = *it ;
-            if ( G[w].comp_ == NOLABEL )
-            {
-                G[w].comp_ = count;
-                S.push(w);
-            }
+void extractRuns(const cv::Mat &src, Strip &strip) {
+    strip.runs_.clear() ;
+    strip.row_start_.assign(1, 0) ;
+
+    const int w = src.cols ;
+
+    for( int i=strip.y0_ ; i<strip.y1_ ; i++ ) {
+        const uchar *p = src.ptr<uchar>(i) ;
+        int j = 0 ;
+        while ( j < w ) {
+            while ( j < w && !p[j] ) ++j ;
+            if ( j == w ) break ;
+            int x0 = j ;
+            while ( j < w && p[j] ) ++j ;
+            strip.runs_.push_back(Run{x0, j}) ;
         }
+        strip.row_start_.push_back(strip.runs_.size()) ;
     }
 }
 
-static int eqTableResolve(EqTable &G, unsigned int nreg)
+// unite the runs [a0, a1) of a row with the touching runs [b0, b1) of the next row; runs are global indexes
+void mergeRows(const Run *runs_a, uint a0, uint a1, const Run *runs_b, uint b0, uint b1, uint base_a, uint base_b, int slack, UnionFind &uf) {
+    uint a = a0, b = b0 ;
+    while ( a < a1 && b < b1 ) {
+        const Run &ra = runs_a[a], &rb = runs_b[b] ;
+        // with 8-connectivity (slack 1) runs also touch diagonally
+        if ( ra.x0_ < rb.x1_ + slack && rb.x0_ < ra.x1_ + slack )
+            uf.unite(base_a + a, base_b + b) ;
+        // advance the run that ends first
+        if ( ra.x1_ < rb.x1_ ) ++a ; else ++b ;
+    }
+}
+
+}
+
+// label the runs of the strips; final_label[base + q] is the label of run q of a strip
+static unsigned int labelRuns(const cv::Mat &src, int nc, vector<Strip> &strips, vector<uint> &final_label)
 {
-    int i ;
+    assert (nc == 4 || nc == 8) ;
+    assert( src.type() == CV_8UC1 ) ;
 
-    for( i=0 ; i<nreg ; i++ ) G[i].comp_ = NOLABEL ;
+    const int h = src.rows, slack = ( nc == 8 ) ? 1 : 0 ;
 
-    unsigned int count = 0 ;
+    // one strip per 64 rows at least, so that stitching stays cheap
 
-    for(i=0 ; i<nreg ; i++ )
-    {
-        if (G[i].comp_ == NOLABEL)
-        {
-            dfs(G, i, count) ;
-            count++ ;
-        }
+    const int min_strip_height = 64 ;
+    int n_strips = std::max(1, std::min(h / min_strip_height, 256)) ;
+
+    strips.resize(n_strips) ;
+    for( int k=0 ; k<n_strips ; k++ ) {
+        strips[k].y0_ = (int64_t)h * k / n_strips ;
+        strips[k].y1_ = (int64_t)h * ( k + 1 ) / n_strips ;
     }
 
-    return count ;
-}
+#pragma omp parallel for schedule(dynamic)
+    for( int k=0 ; k<n_strips ; k++ )
+        extractRuns(src, strips[k]) ;
 
+    uint n_runs = 0 ;
+    for( Strip &s: strips ) {
+        s.base_ = n_runs ;
+        n_runs += s.runs_.size() ;
+    }
 
+    UnionFind uf(n_runs) ;
 
-unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, int nc)
-{
-    assert (nc == 4 || nc == 8) ;
-
-    cv::Mat_<uchar> bmp(src) ;
+    // within strips: each strip only touches its own range of the forest
 
-    int w = src.cols, h = src.rows ;
-    cv::Mat_<int> labels(h, w) ;
+#pragma omp parallel for schedule(dynamic)
+    for( int k=0 ; k<n_strips ; k++ ) {
+        const Strip &s = strips[k] ;
+        const Run *runs = s.runs_.data() ;
+        for( int r=0 ; r+1 < s.y1_ - s.y0_ ; r++ )
+            mergeRows(runs, s.row_start_[r], s.row_start_[r+1], runs, s.row_start_[r+1], s.row_start_[r+2], s.base_, s.base_, slack, uf) ;
+    }
 
-    unsigned long nlabels = 0 ;
+    // across strip borders
 
-    EqTable eq_table ;
+    for( int k=0 ; k+1<n_strips ; k++ ) {
+        const Strip &s = strips[k], &t = strips[k+1] ;
+        int last = s.y1_ - s.y0_ - 1 ;
+        if ( last < 0 || t.y1_ == t.y0_ ) continue ;
+        mergeRows(s.runs_.data(), s.row_start_[last], s.row_start_[last+1], t.runs_.data(), t.row_start_[0], t.row_start_[1], s.base_, t.base_, slack, uf) ;
+    }
 
-    for(int i=0 ; i<h ; i++ )
-        for(int j=0 ; j<w ; j++ )
-            labels[i][j] = NOLABEL ;
+    // final labels: roots precede the members of their set
 
-    // Start merging neighbor pixels
+    final_label.swap(uf.parent_) ;
+    uint ncomp = 0 ;
+    for( uint i=0 ; i<n_runs ; i++ )
+        final_label[i] = ( final_label[i] == i ) ? ncomp++ : final_label[final_label[i]] ;
 
-    for( int i=0 ; i<h ; i++ )
-        for( int j=0 ; j<w ; j++ )
-        {
-            if ( !bmp[i][j] ) continue ;
+    return ncomp ;
+}
 
-            int &label = labels[i][j] ;
+static void paintLabels(const vector<Strip> &strips, const vector<uint> &final_label, int w, int h, cv::Mat &labelImage)
+{
+    const int n_strips = strips.size() ;
+
+    labelImage.create(h, w, CV_32SC1) ;
+
+#pragma omp parallel for schedule(dynamic)
+    for( int k=0 ; k<n_strips ; k++ ) {
+        const Strip &s = strips[k] ;
+        for( int i=s.y0_ ; i<s.y1_ ; i++ ) {
+            int *dst = labelImage.ptr<int>(i) ;
+            std::fill(dst, dst + w, NOLABEL) ;
+            int r = i - s.y0_ ;
+            for( uint q = s.row_start_[r] ; q < s.row_start_[r+1] ; q++ ) {
+                const Run &run = s.runs_[q] ;
+                std::fill(dst + run.x0_, dst + run.x1_, (int)final_label[s.base_ + q]) ;
+            }
+        }
+    }
+}
 
-            int nb[8] ;
+unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, int nc)
+{
+    vector<Strip> strips ;
+    vector<uint> final_label ;
 
-#define OUT_OF_BOUNDS(x, y) ( y < 0 || y>h-1 || x<0 || x > w-1 )
-#define NEIGHB(i, j) ( OUT_OF_BOUNDS(j, i) || labels[i][j] == NOLABEL || !bmp[i][j] ) ? NOLABEL : labels[i][j] ;
+    unsigned int ncomp = labelRuns(src, nc, strips, final_label) ;
+    paintLabels(strips, final_label, src.cols, src.rows, labelImage) ;
 
-            nb[0] = NEIGHB(i-1, j-1) ;
-            nb[1] = NEIGHB(i-1, j) ;
-            nb[2] = NEIGHB(i-1, j+1) ;
-            nb[3] = NEIGHB(i, j-1) ;
+    return ncomp ;
+}
 
-            if ( nc == 8 ) {
-                nb[4] = NEIGHB(i, j+1) ;
-                nb[5] = NEIGHB(i+1, j-1) ;
-                nb[6] = NEIGHB(i+1, j) ;
-                nb[7] = NEIGHB(i+1, j+1) ;
-            }
+// Region statistics from labelled runs given in raster order. Statistics are kept in a flat vector indexed by a dense
+// slot, which is the label itself for the output of connectedComponents. Slots that receive no pixels are dropped at the
+// end.
 
-            unsigned long min_label = w * h ;
-            bool first = true ;
-            int k ;
+namespace {
 
-            for(  k=0 ; k<nc ; k++ )
-            {
-                unsigned long p = nb[k] ;
+class RegionBuilder {
+public:
+    RegionBuilder(bool keep_runs): keep_runs_(keep_runs) {}
 
-                if ( p == NOLABEL ) continue ;
+    void reserve(uint n_labels) { acc_.reserve(n_labels) ; }
 
-                first = false ;
+    void add(uint slot, int y, int x0, int x1) {
+        if ( slot >= acc_.size() ) acc_.resize(slot + 1) ;
 
-                min_label = std::min(min_label, p) ;
-            }
+        Accumulator &a = acc_[slot] ;
+        double n = x1 - x0, sx = n * ( x0 + x1 - 1 ) / 2.0 ;
 
-            if ( first )
-            {
-                label = nlabels++ ;
-                eq_table.push_back(ConRegionInfo()) ;
-            }
-            else
-            {
-                label = min_label ;
+        if ( a.area_ == 0 ) {
+            a.xmin_ = x0 ; a.xmax_ = x1 - 1 ;
+            a.ymin_ = a.ymax_ = y ;
+        } else {
+            a.xmin_ = std::min(a.xmin_, x0) ;
+            a.xmax_ = std::max(a.xmax_, x1 - 1) ;
+            a.ymax_ = y ;
+        }
 
-                for( k=0 ; k<nc ; k++ )
-                {
-                    unsigned int p = nb[k] ;
+        a.area_ += x1 - x0 ;
+        a.sx_ += sx ;
+        a.sy_ += n * y ;
+        a.sxx_ += sumOfSquares(x1 - 1) - sumOfSquares(x0 - 1) ;
+        a.sxy_ += sx * y ;
+        a.syy_ += n * y * y ;
+        a.n_runs_ ++ ;
 
-                    if ( p == NOLABEL || p == min_label ) continue ;
+        if ( keep_runs_ ) labelled_runs_.push_back({slot, RegionRun{y, x0, x1}}) ;
+    }
 
-                    eq_table[min_label].eq_set_.insert(p) ;
-                }
-            }
+    // slot_labels gives the label of each slot when they differ, regions are then output by increasing label
+    void finish(vector<RegionStats> &stats, vector<RegionRun> *runs, const vector<uint> *slot_labels = nullptr) {
+        stats.clear() ;
+
+        vector<uint> order(acc_.size()) ;
+        for( uint l=0 ; l<acc_.size() ; l++ ) order[l] = l ;
+        if ( slot_labels )
+            std::sort(order.begin(), order.end(), [&](uint a, uint b) { return (*slot_labels)[a] < (*slot_labels)[b] ; }) ;
+
+        uint first_run = 0 ;
+        vector<uint> index(acc_.size(), 0) ;
+
+        for( uint l: order ) {
+            const Accumulator &a = acc_[l] ;
+            if ( a.area_ == 0 ) continue ;
+
+            RegionStats r ;
+            double area = a.area_ ;
+            r.label_ = slot_labels ? (*slot_labels)[l] : l ;
+            r.area_ = a.area_ ;
+            r.rect_ = cv::Rect(a.xmin_, a.ymin_, a.xmax_ - a.xmin_ + 1, a.ymax_ - a.ymin_ + 1) ;
+            r.centroid_ = cv::Point2d(a.sx_ / area, a.sy_ / area) ;
+            r.mu20_ = a.sxx_ / area - r.centroid_.x * r.centroid_.x ;
+            r.mu11_ = a.sxy_ / area - r.centroid_.x * r.centroid_.y ;
+            r.mu02_ = a.syy_ / area - r.centroid_.y * r.centroid_.y ;
+            r.first_run_ = first_run ;
+            r.n_runs_ = keep_runs_ ? a.n_runs_ : 0 ;
+
+            index[l] = r.first_run_ ;
+            first_run += r.n_runs_ ;
+            stats.push_back(r) ;
         }
 
-    int ncomp = eqTableResolve(eq_table, nlabels) ;
+        if ( !runs ) return ;
+
+        // group by region keeping the raster order
+        runs->resize(labelled_runs_.size()) ;
+        for( const auto &lr: labelled_runs_ )
+            (*runs)[index[lr.first]++] = lr.second ;
+    }
+
+private:
+
+    static double sumOfSquares(double m) { return m * ( m + 1 ) * ( 2 * m + 1 ) / 6.0 ; }
+
+    struct Accumulator {
+        uint area_ = 0, n_runs_ = 0 ;
+        int xmin_, xmax_, ymin_, ymax_ ;
+        double sx_ = 0, sy_ = 0, sxx_ = 0, sxy_ = 0, syy_ = 0 ;
+    } ;
+
+    bool keep_runs_ ;
+    vector<Accumulator> acc_ ;
+    vector<std::pair<uint, RegionRun>> labelled_runs_ ;
+} ;
+
+}
 
-    for( int i=h-1 ; i>=0 ; i-- )
-        for( int j=w-1 ; j>=0 ; j-- )
-        {
-            int &label = labels[i][j] ;
+unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, vector<RegionStats> &stats, int nc, vector<RegionRun> *runs)
+{
+    vector<Strip> strips ;
+    vector<uint> final_label ;
 
-            if ( label == NOLABEL ) continue ;
+    unsigned int ncomp = labelRuns(src, nc, strips, final_label) ;
+    paintLabels(strips, final_label, src.cols, src.rows, labelImage) ;
 
-            int v = eq_table[label].comp_ ;
+    RegionBuilder builder(runs != nullptr) ;
+    builder.reserve(ncomp) ;
 
-            label = v ;
+    for( const Strip &s: strips )
+        for( int i=s.y0_ ; i<s.y1_ ; i++ ) {
+            int r = i - s.y0_ ;
+            for( uint q = s.row_start_[r] ; q < s.row_start_[r+1] ; q++ )
+                builder.add(final_label[s.base_ + q], i, s.runs_[q].x0_, s.runs_[q].x1_) ;
         }
 
-    labelImage = labels ;
+    builder.finish(stats, runs) ;
+
     return ncomp ;
 }
 
@@ -167,110 +303,120 @@ unsigned int connectedComponents(const cv::Mat &src, cv::Mat &labelImage, int nc
 RegionIterator findLargestBlob(const cv::Mat &src, unsigned int minArea)
 {
     cv::Mat labels ;
-    if ( connectedComponents(src, labels) )
-    {
-        unsigned int maxArea = minArea ;
-
-        RegionIterator it(labels), best ;
-
-        while ( it )
-        {
-            if ( it.area() > maxArea )
-            {
-                maxArea = it.area() ;
-                best = it ;
-            }
+    vector<RegionStats> stats ;
+    vector<RegionRun> runs ;
 
-            ++it ;
-        }
+    connectedComponents(src, labels, stats, 8, &runs) ;
+
+    unsigned int maxArea = minArea ;
+    int best = -1 ;
 
-        return best ;
+    for( uint i=0 ; i<stats.size() ; i++ ) {
+        if ( stats[i].area_ > maxArea ) {
+            maxArea = stats[i].area_ ;
+            best = i ;
+        }
     }
-    else
-        return RegionIterator() ;
-}
 
-void RegionIterator::reset(const cv::Mat &src)
-{
-    data_.reset(new ContainerType ) ;
+    if ( best < 0 ) return RegionIterator() ;
 
-    int w = src.cols, h = src.rows ;
+    RegionIterator it(labels, std::move(stats), std::move(runs)) ;
+    it.idx_ = best ;
+    return it ;
+}
 
-    // Gather region info
+RegionIterator::RegionIterator(const cv::Mat &labels, vector<RegionStats> &&stats, vector<RegionRun> &&runs): idx_(0)
+{
+    Regions *regions = new Regions ;
+    regions->labels_ = labels ;
+    regions->stats_ = std::move(stats) ;
+    regions->runs_ = std::move(runs) ;
+    data_.reset(regions) ;
+}
 
-    unsigned long prev_label = NOLABEL ;
-    RegionData *prev_reg = NULL, *reg ;
+RegionIterator::RegionIterator(const cv::Mat &src): idx_(0)
+{
+    Regions *regions = new Regions ;
+    regions->labels_ = src ;
 
-    for( int i=0 ; i<h ; i++ )
-        for(int j=0 ; j<w ; j++ )
-        {
-            unsigned long label = src.at<unsigned int>(i, j) ;
+    // Runs of equal labels in a single pass. Labels may be arbitrary (e.g. negative watershed markers or sparse ids), so
+    // they are mapped to dense slots in order of appearance.
 
-            if ( label == NOLABEL ) continue ;
+    RegionBuilder builder(true) ;
+    std::unordered_map<unsigned int, uint> slots ;
+    vector<uint> slot_labels ;
+    unsigned int last_label = NOLABEL ;
+    uint last_slot = 0 ;
 
-            // Create or retrieve region with specified label
+    int w = src.cols, h = src.rows ;
 
-            if ( label == prev_label ) reg = prev_reg ;
-            else
-            {
-                reg = &((*data_)[label]) ;
-                prev_label = label ;
-                prev_reg = reg ;
+    for( int i=0 ; i<h ; i++ ) {
+        const unsigned int *p = src.ptr<unsigned int>(i) ;
+        int j = 0 ;
+        while ( j < w ) {
+            unsigned int label = p[j] ;
+            int x0 = j ;
+            while ( j < w && p[j] == label ) ++j ;
+            if ( label == (unsigned int)NOLABEL ) continue ;
+
+            if ( label != last_label || slot_labels.empty() ) {
+                auto it = slots.emplace(label, (uint)slot_labels.size()).first ;
+                if ( it->second == slot_labels.size() ) slot_labels.push_back(label) ;
+                last_label = label ;
+                last_slot = it->second ;
             }
+            builder.add(last_slot, i, x0, j) ;
+        }
+    }
 
-            // Update region info
-
-            reg->label_ = label ;
-
-            if ( reg->rect_.width == 0 )
-            {
-                reg->rect_ = cv::Rect(cv::Point(j, i), cv::Size(1, 1)) ;
-                reg->area_ = 1 ;
-            }
-            else
-            {
-                cv::Point tl = reg->rect_.tl(), br = reg->rect_.br() ;
+    builder.finish(regions->stats_, &regions->runs_, &slot_labels) ;
+    data_.reset(regions) ;
+}
 
-                tl.x = std::min(tl.x, j) ; tl.y = std::min(tl.y, i) ;
-                br.x = std::max(br.x, j) ; br.y = std::max(br.y, i) ;
+cv::Mat RegionIterator::localMask() const {
+    const RegionStats &r = stats() ;
+    const cv::Point offset = r.rect_.tl() - cv::Point(1, 1) ;
 
-                reg->rect_ = cv::Rect(tl, br) ;
+    cv::Mat mask = cv::Mat::zeros(r.rect_.height + 2, r.rect_.width + 2, CV_8UC1) ;
 
-                reg->area_ ++ ;
-            }
+    if ( r.n_runs_ ) {
+        for( uint k = r.first_run_ ; k < r.first_run_ + r.n_runs_ ; k++ ) {
+            const RegionRun &run = data_->runs_[k] ;
+            uchar *dst = mask.ptr<uchar>(run.y_ - offset.y) - offset.x ;
+            std::fill(dst + run.x0_, dst + run.x1_, 255) ;
         }
+    } else {
+        for( int y = r.rect_.y ; y < r.rect_.y + r.rect_.height ; y++ ) {
+            const unsigned int *src = data_->labels_.ptr<unsigned int>(y) ;
+            uchar *dst = mask.ptr<uchar>(y - offset.y) - offset.x ;
+            for( int x = r.rect_.x ; x < r.rect_.x + r.rect_.width ; x++ )
+                if ( src[x] == r.label_ ) dst[x] = 255 ;
+        }
+    }
 
-    it_ = data_->begin() ;
+    return mask ;
 }
 
 cv::Mat RegionIterator::mask() const {
-    const cv::Rect &r = it_->second.rect_ ;
+    const cv::Rect &r = stats().rect_ ;
 
-    cv::Mat mask = cv::Mat::zeros(src_.size(), CV_8UC1) ;
+    cv::Mat local = localMask() ;
+    cv::Mat mask = cv::Mat::zeros(data_->labels_.size(), CV_8UC1) ;
 
-    for( int y = r.tl().y ; y<=r.br().y ; y++ )
-        for( int x=r.tl().x ; x<=r.br().x ; x++ )
-        {
-            unsigned int label = src_.at<unsigned int>(y, x) ;
-
-            if ( label == it_->second.label_ )
-            {
-                mask.at<uchar>(y, x) = 255 ;
-            }
-        }
+    for( int y=0 ; y<r.height ; y++ )
+        memcpy(mask.ptr<uchar>(r.y + y) + r.x, local.ptr<uchar>(y + 1) + 1, r.width) ;
 
     return mask ;
 }
 
 vector<cv::Point> RegionIterator::contour() const {
 
-    cv::Mat bmp = mask() ;
+    cv::Mat bmp = localMask() ;
 
     vector<vector<cv::Point> > contours ;
-    cv::findContours(bmp, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE) ;
+    cv::findContours(bmp, contours, cv::RETR_EXTERNAL, cv::CHAIN_APPROX_NONE, stats().rect_.tl() - cv::Point(1, 1)) ;
 
-    return contours[0] ;
+    return contours.empty() ? vector<cv::Point>() : contours[0] ;
 }
 
 }
-
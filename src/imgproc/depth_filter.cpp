@@ -0,0 +1,207 @@
+#include <cvx/imgproc/depth_filter.hpp>
+
+#include <cmath>
+
+#ifdef __SSE4_1__
+#include <smmintrin.h>
+#endif
+
+using namespace std ;
+
+namespace cvx {
+
+// fill the n missing values at p, p + stride, ... between the valid depths l and r
+static inline void fillGap(ushort *p, size_t stride, uint n, ushort l, ushort r, ushort max_jump) {
+    if ( std::abs((int)l - (int)r) <= max_jump ) {
+        float step = ( (float)r - (float)l ) / ( n + 1 ) ;
+        for( uint k=0 ; k<n ; k++ ) p[k * stride] = (ushort)lrintf(l + step * ( k + 1 )) ;
+    } else {
+        ushort far = std::max(l, r) ;
+        for( uint k=0 ; k<n ; k++ ) p[k * stride] = far ;
+    }
+}
+
+void DepthHoleFilling::apply(const cv::Mat &depth, cv::Mat &res) const {
+    assert( depth.type() == CV_16UC1 ) ;
+
+    const int w = depth.cols, h = depth.rows ;
+    const uint max_size = params_.max_hole_size_ ;
+    const ushort max_jump = params_.max_depth_jump_ ;
+
+    res = depth.clone() ;
+
+    // rows
+
+#pragma omp parallel for
+    for( int i=0 ; i<h ; i++ ) {
+        ushort *p = res.ptr<ushort>(i) ;
+        int last = -1 ;
+        for( int j=0 ; j<w ; j++ ) {
+            if ( p[j] == 0 ) continue ;
+            uint gap = j - last - 1 ;
+            if ( last >= 0 && gap > 0 && gap <= max_size )
+                fillGap(p + last + 1, 1, gap, p[last], p[j], max_jump) ;
+            last = j ;
+        }
+    }
+
+    // columns, in blocks so that each thread walks down a narrow stripe of the image keeping the last valid row of
+    // each of its columns
+
+    const int block_size = 64 ;
+    const size_t stride = res.step / sizeof(ushort) ;
+
+#pragma omp parallel for
+    for( int b=0 ; b<w ; b += block_size ) {
+        int e = std::min(w, b + block_size) ;
+        int last[block_size] ;
+        std::fill(last, last + block_size, -1) ;
+
+        for( int i=0 ; i<h ; i++ ) {
+            ushort *p = res.ptr<ushort>(i) ;
+            for( int j=b ; j<e ; j++ ) {
+                if ( p[j] == 0 ) continue ;
+                int &l = last[j - b] ;
+                uint gap = i - l - 1 ;
+                if ( l >= 0 && gap > 0 && gap <= max_size ) {
+                    ushort *q = res.ptr<ushort>(l) + j ;
+                    fillGap(q + stride, stride, gap, *q, p[j], max_jump) ;
+                }
+                l = i ;
+            }
+        }
+    }
+}
+
+JointBilateralUpsampling::JointBilateralUpsampling(const Parameters &params): params_(params) {
+    const int r = params_.radius_, n = 2 * r + 1 ;
+
+    space_weights_.resize(n * n) ;
+    for( int dy = -r ; dy <= r ; dy++ )
+        for( int dx = -r ; dx <= r ; dx++ )
+            space_weights_[( dy + r ) * n + dx + r] = exp(-0.5 * ( dx * dx + dy * dy ) / ( params_.sigma_space_ * params_.sigma_space_ )) ;
+
+    // indexed by the sum of absolute differences over 3 channels
+    color_weights_.resize(3 * 255 + 1) ;
+    for( uint d=0 ; d<color_weights_.size() ; d++ ) {
+        float c = d / ( 3.0f * params_.sigma_color_ ) ;
+        color_weights_[d] = exp(-0.5f * c * c) ;
+    }
+}
+
+void JointBilateralUpsampling::apply(const cv::Mat &depth, const cv::Mat &guide, cv::Mat &res) const {
+    assert( depth.type() == CV_16UC1 ) ;
+    assert( guide.type() == CV_8UC3 || guide.type() == CV_8UC1 ) ;
+
+    const int w = depth.cols, h = depth.rows, gw = guide.cols, gh = guide.rows ;
+    const int r = params_.radius_, n = 2 * r + 1 ;
+    const bool color = guide.type() == CV_8UC3 ;
+
+    // low resolution sample nearest to each output column/row, and the guide pixel at each low resolution sample
+
+    auto nearest = [](int x, int from, int to) {
+        return std::min(to - 1, std::max(0, (int)floor(( x + 0.5f ) * to / from))) ;
+    } ;
+
+    vector<int> lx(gw), ly(gh), gx(w), gy(h) ;
+    for( int x=0 ; x<gw ; x++ ) lx[x] = nearest(x, gw, w) ;
+    for( int y=0 ; y<gh ; y++ ) ly[y] = nearest(y, gh, h) ;
+    for( int x=0 ; x<w ; x++ ) gx[x] = nearest(x, w, gw) ;
+    for( int y=0 ; y<h ; y++ ) gy[y] = nearest(y, h, gh) ;
+
+    res.create(gh, gw, CV_16UC1) ;
+
+    const float *cw = color_weights_.data() ;
+
+#pragma omp parallel for
+    for( int y=0 ; y<gh ; y++ ) {
+        const uchar *g = guide.ptr<uchar>(y) ;
+        ushort *dst = res.ptr<ushort>(y) ;
+        const int cy = ly[y] ;
+
+        for( int x=0 ; x<gw ; x++ ) {
+            const int cx = lx[x] ;
+            const uchar *gc = color ? g + 3 * x : g + x ;
+
+            float sum = 0, wsum = 0 ;
+
+            for( int dy = -r ; dy <= r ; dy++ ) {
+                int sy = cy + dy ;
+                if ( sy < 0 || sy >= h ) continue ;
+
+                const ushort *d = depth.ptr<ushort>(sy) ;
+                const uchar *gs = guide.ptr<uchar>(gy[sy]) ;
+                const float *sw = &space_weights_[( dy + r ) * n + r] ;
+
+                for( int dx = -r ; dx <= r ; dx++ ) {
+                    int sx = cx + dx ;
+                    if ( sx < 0 || sx >= w || d[sx] == 0 ) continue ;
+
+                    uint diff ;
+                    if ( color ) {
+                        const uchar *q = gs + 3 * gx[sx] ;
+                        diff = std::abs(gc[0] - q[0]) + std::abs(gc[1] - q[1]) + std::abs(gc[2] - q[2]) ;
+                    } else
+                        diff = 3 * std::abs(gc[0] - gs[gx[sx]]) ;
+
+                    float wt = sw[dx] * cw[diff] ;
+                    sum += wt * d[sx] ;
+                    wsum += wt ;
+                }
+            }
+
+            dst[x] = ( wsum > 0 ) ? (ushort)lrintf(sum / wsum) : 0 ;
+        }
+    }
+}
+
+void TemporalDepthFilter::apply(const cv::Mat &depth, cv::Mat &res) {
+    assert( depth.type() == CV_16UC1 ) ;
+
+    if ( state_.empty() || state_.size() != depth.size() )
+        state_ = cv::Mat(depth.size(), CV_32FC1, cv::Scalar(0)) ;
+
+    res.create(depth.size(), CV_16UC1) ;
+
+    const int w = depth.cols, h = depth.rows ;
+    const float alpha = params_.alpha_, max_diff = params_.max_difference_ ;
+
+#pragma omp parallel for
+    for( int i=0 ; i<h ; i++ ) {
+        const ushort *src = depth.ptr<ushort>(i) ;
+        float *s = state_.ptr<float>(i) ;
+        ushort *dst = res.ptr<ushort>(i) ;
+
+        int j = 0 ;
+
+#ifdef __SSE4_1__
+        const __m128 va = _mm_set1_ps(alpha), vmax = _mm_set1_ps(max_diff), zero = _mm_setzero_ps() ;
+        const __m128 abs_mask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff)) ;
+
+        for( ; j + 4 <= w ; j += 4 ) {
+            __m128 z = _mm_cvtepi32_ps(_mm_cvtepu16_epi32(_mm_loadl_epi64((const __m128i *)( src + j )))) ;
+            __m128 prev = _mm_loadu_ps(s + j) ;
+            __m128 diff = _mm_sub_ps(z, prev) ;
+            __m128 smooth = _mm_add_ps(prev, _mm_mul_ps(va, diff)) ;
+            __m128 restart = _mm_or_ps(_mm_cmpeq_ps(prev, zero), _mm_cmpgt_ps(_mm_and_ps(diff, abs_mask), vmax)) ;
+            __m128 next = _mm_and_ps(_mm_blendv_ps(smooth, z, restart), _mm_cmpneq_ps(z, zero)) ;
+
+            _mm_storeu_ps(s + j, next) ;
+            __m128i out = _mm_cvtps_epi32(next) ;
+            _mm_storel_epi64((__m128i *)( dst + j ), _mm_packus_epi32(out, out)) ;
+        }
+#endif
+
+        for( ; j<w ; j++ ) {
+            float z = src[j], prev = s[j], diff = z - prev ;
+            float next ;
+            if ( z == 0 ) next = 0 ;
+            else if ( prev == 0 || std::abs(diff) > max_diff ) next = z ;
+            else next = prev + alpha * diff ;
+            s[j] = next ;
+            dst[j] = (ushort)lrintf(next) ;
+        }
+    }
+}
+
+}
@@ -1,5 +1,7 @@
 #include <cvx/imgproc/gabor.hpp>
 
+#include <limits>
+
 using namespace std ;
 
 namespace cvx {
@@ -80,26 +82,312 @@ void makeGaborFilterBank(int nOctaves, int nAngles, double sigma, vector<cv::Mat
     }
 }
 
+// Kernel pair k as the complex image real + i imag with its anchor wrapped to the origin. The response of the correlation
+// with the pair is then IDFT(DFT(image) * conj(DFT(kernel))), up to the sign of the imaginary part.
+
+static void makeKernelSpectra(const vector<cv::Mat> &kernels, const cv::Size &dft_size, vector<cv::Mat> &spectra)
+{
+    const int n_pairs = kernels.size() / 2 ;
+    spectra.resize(n_pairs) ;
+
+#pragma omp parallel for
+    for( int k=0 ; k<n_pairs ; k++ )
+    {
+        const cv::Mat &kr = kernels[2*k], &ki = kernels[2*k+1] ;
+        const int ax = kr.cols / 2, ay = kr.rows / 2 ;
+
+        cv::Mat kernel(dft_size, CV_32FC2, cv::Scalar(0, 0)) ;
+
+        for( int y=0 ; y<kr.rows ; y++ )
+        {
+            cv::Vec2f *dst = kernel.ptr<cv::Vec2f>(( y - ay + dft_size.height ) % dft_size.height) ;
+            for( int x=0 ; x<kr.cols ; x++ )
+                dst[( x - ax + dft_size.width ) % dft_size.width] = cv::Vec2f(kr.at<float>(y, x), ki.at<float>(y, x)) ;
+        }
+
+        cv::dft(kernel, spectra[k]) ;
+    }
+}
+
+// Forward transform of an image region extended by b pixels on each side, zero padded to the transform size. Outside the
+// image the border extension of filter2D is used; the region is clipped only on the sides where it touches the image
+// border, so reflecting the clipped region is the same as reflecting the image.
+
+static void regionSpectrum(const cv::Mat &src, const cv::Rect &region, int b, const cv::Size &dft_size, cv::Mat &padded, cv::Mat &spectrum)
+{
+    const cv::Rect outer(region.x - b, region.y - b, region.width + 2 * b, region.height + 2 * b) ;
+    const cv::Rect inner = outer & cv::Rect(0, 0, src.cols, src.rows) ;
+
+    cv::Mat fsrc ;
+    src(inner).convertTo(fsrc, CV_32F) ;
+
+    padded.create(dft_size, CV_32FC1) ;
+    padded.setTo(cv::Scalar(0)) ;
+    cv::Mat roi = padded(cv::Rect(0, 0, outer.width, outer.height)) ;
+    cv::copyMakeBorder(fsrc, roi, inner.y - outer.y, outer.br().y - inner.br().y, inner.x - outer.x, outer.br().x - inner.br().x,
+                       cv::BORDER_REFLECT_101) ;
+
+    cv::dft(padded, spectrum, cv::DFT_COMPLEX_OUTPUT, outer.height) ;
+}
+
+// complex response of a kernel pair, only the first rows of the result are computed
+
+static void pairResponse(const cv::Mat &spectrum, const cv::Mat &kernel_spectrum, int rows, cv::Mat &product, cv::Mat &response)
+{
+    cv::mulSpectrums(spectrum, kernel_spectrum, product, 0, true) ;
+    cv::dft(product, response, cv::DFT_INVERSE | cv::DFT_SCALE, rows) ;
+}
+
+static inline float magnitude(const cv::Vec2f &r)
+{
+    return sqrt(r[0] * r[0] + r[1] * r[1]) ;
+}
+
+static int maxKernelRadius(const vector<cv::Mat> &kernels)
+{
+    int r = 0 ;
+    for( const cv::Mat &k: kernels )
+        r = std::max(r, std::max(k.rows, k.cols) / 2) ;
+    return r ;
+}
+
 void applyGaborFilterBank(const cv::Mat &src, vector<cv::Mat> &kernels, vector<cv::Mat> &responses)
 {
-    responses.resize(kernels.size()/2) ;
+    GaborFilterBank(kernels).apply(src, responses) ;
+}
+
+GaborFilterBank::GaborFilterBank(int nOctaves, int nAngles, double sigma)
+{
+    makeGaborFilterBank(nOctaves, nAngles, sigma, kernels_) ;
+    border_ = maxKernelRadius(kernels_) ;
+}
+
+GaborFilterBank::GaborFilterBank(const vector<cv::Mat> &kernels): kernels_(kernels)
+{
+    assert( kernels_.size() % 2 == 0 ) ;
+    border_ = maxKernelRadius(kernels_) ;
+}
+
+void GaborFilterBank::prepare(const cv::Size &sz)
+{
+    if ( sz == image_size_ ) return ;
 
-#pragma omp parallel for shared(responses)
-    for( int i=0 ; i<kernels.size() ; i+=2 )
+    image_size_ = sz ;
+    dft_size_ = cv::Size(cv::getOptimalDFTSize(sz.width + 2 * border_), cv::getOptimalDFTSize(sz.height + 2 * border_)) ;
+
+    makeKernelSpectra(kernels_, dft_size_, spectra_) ;
+}
+
+void GaborFilterBank::apply(const cv::Mat &src, vector<cv::Mat> &responses)
+{
+    assert( src.channels() == 1 ) ;
+
+    prepare(src.size()) ;
+
+    const int w = src.cols, h = src.rows, b = border_, n_pairs = size() ;
+
+    regionSpectrum(src, cv::Rect(0, 0, w, h), b, dft_size_, padded_, spectrum_) ;
+
+    responses.resize(n_pairs) ;
+
+#pragma omp parallel
     {
-        cv::Mat res_real, res_imag, res_norm ;
+        cv::Mat product, response ;
+
+#pragma omp for schedule(dynamic)
+        for( int k=0 ; k<n_pairs ; k++ )
+        {
+            pairResponse(spectrum_, spectra_[k], h + 2 * b, product, response) ;
+
+            // magnitude scaled to [0, 1]: the range is found on the squared magnitude, the square root is taken once
 
-        cv::filter2D(src, res_real, CV_32F, kernels[i]) ;
-        cv::filter2D(src, res_imag, CV_32F, kernels[i+1]) ;
+            float mn = std::numeric_limits<float>::max(), mx = 0 ;
 
-        cv::pow(res_real, 2, res_real);
-        cv::pow(res_imag, 2, res_imag);
-        cv::add(res_imag, res_real, res_norm);
-        cv::pow(res_norm, 0.5, res_norm);
-        cv::normalize(res_norm, res_norm, 0, 1, cv::NORM_MINMAX, CV_32F);
-        responses[i/2] = res_norm ;
+            for( int y=0 ; y<h ; y++ )
+            {
+                const cv::Vec2f *r = response.ptr<cv::Vec2f>(y + b) + b ;
+                for( int x=0 ; x<w ; x++ )
+                {
+                    float m2 = r[x][0] * r[x][0] + r[x][1] * r[x][1] ;
+                    mn = std::min(mn, m2) ;
+                    mx = std::max(mx, m2) ;
+                }
+            }
+
+            mn = sqrt(mn) ; mx = sqrt(mx) ;
+            const float scale = ( mx > mn ) ? 1.0f / ( mx - mn ) : 0.0f ;
+
+            cv::Mat &dst = responses[k] ;
+            dst.create(h, w, CV_32FC1) ;
+
+            for( int y=0 ; y<h ; y++ )
+            {
+                const cv::Vec2f *r = response.ptr<cv::Vec2f>(y + b) + b ;
+                float *d = dst.ptr<float>(y) ;
+                for( int x=0 ; x<w ; x++ )
+                    d[x] = ( magnitude(r[x]) - mn ) * scale ;
+            }
+        }
+    }
+}
+
+GaborFeatureExtractor::GaborFeatureExtractor(const vector<cv::Mat> &kernels, const Parameters &params):
+    kernels_(kernels), params_(params)
+{
+    assert( kernels_.size() % 2 == 0 && params_.cell_size_ > 0 && params_.tile_size_ > 0 ) ;
+
+    border_ = maxKernelRadius(kernels_) ;
+
+    // tiles are made of whole cells
+    const int c = params_.cell_size_ ;
+    tile_size_ = ( ( params_.tile_size_ + c - 1 ) / c ) * c ;
+}
+
+cv::Size GaborFeatureExtractor::gridSize(const cv::Size &sz) const
+{
+    const int c = params_.cell_size_ ;
+    return cv::Size(( sz.width + c - 1 ) / c, ( sz.height + c - 1 ) / c) ;
+}
+
+void GaborFeatureExtractor::compute(const cv::Mat &src, cv::Mat &features)
+{
+    features.create(gridSize(src.size()), CV_32FC(size())) ;
+    assert( features.isContinuous() ) ;
+
+    compute(src, features.ptr<float>(), size(), 1) ;
+}
+
+void GaborFeatureExtractor::compute(const cv::Mat &src, float *dst, size_t sample_stride, size_t feature_stride)
+{
+    assert( src.channels() == 1 ) ;
+
+    const int w = src.cols, h = src.rows, b = border_, c = params_.cell_size_, n_pairs = size() ;
+    const int tw = std::min(tile_size_, w), th = std::min(tile_size_, h) ;
+    const int n_tiles_x = ( w + tw - 1 ) / tw, n_tiles_y = ( h + th - 1 ) / th, n_tiles = n_tiles_x * n_tiles_y ;
+    const cv::Size grid = gridSize(src.size()) ;
+
+    // all tiles share the transform size, the ones on the right and bottom border are zero padded
+
+    cv::Size dft_size(cv::getOptimalDFTSize(tw + 2 * b), cv::getOptimalDFTSize(th + 2 * b)) ;
+    if ( dft_size != dft_size_ )
+    {
+        dft_size_ = dft_size ;
+        makeKernelSpectra(kernels_, dft_size_, spectra_) ;
+    }
+
+    vector<float> fmin(n_pairs, std::numeric_limits<float>::max()), fmax(n_pairs, 0) ;
+
+#pragma omp parallel
+    {
+        cv::Mat padded, spectrum, product, response ;
+        vector<float> cell_sum, tmin(n_pairs, std::numeric_limits<float>::max()), tmax(n_pairs, 0) ;
+
+#pragma omp for schedule(dynamic)
+        for( int t=0 ; t<n_tiles ; t++ )
+        {
+            const cv::Rect tile(( t % n_tiles_x ) * tw, ( t / n_tiles_x ) * th, std::min(tw, w - ( t % n_tiles_x ) * tw),
+                                std::min(th, h - ( t / n_tiles_x ) * th)) ;
+
+            // the tile origin is on a cell boundary
+            const int gx0 = tile.x / c, gy0 = tile.y / c ;
+            const int gw = ( tile.width + c - 1 ) / c, gh = ( tile.height + c - 1 ) / c ;
+
+            regionSpectrum(src, tile, b, dft_size_, padded, spectrum) ;
+
+            for( int k=0 ; k<n_pairs ; k++ )
+            {
+                pairResponse(spectrum, spectra_[k], tile.height + 2 * b, product, response) ;
+
+                float mn = tmin[k], mx = tmax[k] ;
+
+                if ( c == 1 )
+                {
+                    for( int y=0 ; y<tile.height ; y++ )
+                    {
+                        const cv::Vec2f *r = response.ptr<cv::Vec2f>(y + b) + b ;
+                        float *d = dst + ( ( tile.y + y ) * (size_t)grid.width + tile.x ) * sample_stride + k * feature_stride ;
+                        for( int x=0 ; x<tile.width ; x++, d += sample_stride )
+                        {
+                            float m = magnitude(r[x]) ;
+                            *d = m ;
+                            mn = std::min(mn, m) ;
+                            mx = std::max(mx, m) ;
+                        }
+                    }
+                }
+                else
+                {
+                    // average magnitude over each cell, cells on the image border are partial
+
+                    cell_sum.assign(gw * gh, 0) ;
+
+                    for( int y=0 ; y<tile.height ; y++ )
+                    {
+                        const cv::Vec2f *r = response.ptr<cv::Vec2f>(y + b) + b ;
+                        float *cs = &cell_sum[( y / c ) * gw] ;
+                        for( int x=0 ; x<tile.width ; x++ )
+                            cs[x / c] += magnitude(r[x]) ;
+                    }
+
+                    for( int gy=0 ; gy<gh ; gy++ )
+                    {
+                        const int ch = std::min(c, tile.height - gy * c) ;
+                        float *d = dst + ( ( gy0 + gy ) * (size_t)grid.width + gx0 ) * sample_stride + k * feature_stride ;
+                        for( int gx=0 ; gx<gw ; gx++, d += sample_stride )
+                        {
+                            const int cw = std::min(c, tile.width - gx * c) ;
+                            float m = cell_sum[gy * gw + gx] / ( cw * ch ) ;
+                            *d = m ;
+                            mn = std::min(mn, m) ;
+                            mx = std::max(mx, m) ;
+                        }
+                    }
+                }
+
+                tmin[k] = mn ; tmax[k] = mx ;
+            }
+
+            if ( params_.normalization_ == L2 )
+            {
+                for( int gy=0 ; gy<gh ; gy++ )
+                {
+                    float *d = dst + ( ( gy0 + gy ) * (size_t)grid.width + gx0 ) * sample_stride ;
+                    for( int gx=0 ; gx<gw ; gx++, d += sample_stride )
+                    {
+                        float n2 = 0 ;
+                        for( int k=0 ; k<n_pairs ; k++ ) n2 += d[k * feature_stride] * d[k * feature_stride] ;
+                        const float scale = ( n2 > 0 ) ? 1.0f / sqrt(n2) : 0.0f ;
+                        for( int k=0 ; k<n_pairs ; k++ ) d[k * feature_stride] *= scale ;
+                    }
+                }
+            }
+        }
+
+#pragma omp critical
+        for( int k=0 ; k<n_pairs ; k++ )
+        {
+            fmin[k] = std::min(fmin[k], tmin[k]) ;
+            fmax[k] = std::max(fmax[k], tmax[k]) ;
+        }
     }
 
+    if ( params_.normalization_ != MinMax ) return ;
+
+    // the range of each feature is only known once all tiles are done
+
+    vector<float> scale(n_pairs) ;
+    for( int k=0 ; k<n_pairs ; k++ )
+        scale[k] = ( fmax[k] > fmin[k] ) ? 1.0f / ( fmax[k] - fmin[k] ) : 0.0f ;
+
+    const int64_t n_samples = (int64_t)grid.width * grid.height ;
+
+#pragma omp parallel for
+    for( int64_t i=0 ; i<n_samples ; i++ )
+    {
+        float *d = dst + i * sample_stride ;
+        for( int k=0 ; k<n_pairs ; k++ )
+            d[k * feature_stride] = ( d[k * feature_stride] - fmin[k] ) * scale[k] ;
+    }
 }
 
 
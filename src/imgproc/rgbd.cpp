@@ -60,215 +60,480 @@ static void hsv2rgb(float h, cv::Vec3i &rgb)
 }
 
 
-cv::Mat depthViz(const cv::Mat &depth, ushort minv_, ushort maxv_)
-{
-    const int nLutColors = 2 << 12 ;
-    static cv::Vec3i hsvlut[nLutColors] ;
-    static bool initLut = false ;
+namespace {
 
-    assert(depth.type() == CV_16UC1) ;
+// tables of DepthVisualizer, indexed by depth scaled to [0, n_lut_colors - 1]
 
-    int w = depth.cols, h = depth.rows ;
+const int n_lut_colors = 1 << 13 ;
 
-    int nc = nLutColors ;
+vector<cv::Vec3b> makeColorMap(DepthVisualizer::ColorMap cmap) {
+    vector<cv::Vec3b> lut(n_lut_colors) ;
 
-    if ( !initLut )
-    {
-        int c ;
-        float h, hmax, hstep ;
+    auto clamp = [](double v) { return (uchar)std::min(255.0, std::max(0.0, 255.0 * v + 0.5)) ; } ;
+
+    // hue in (0, 180], accumulated in float steps like the table of the original depthViz
+    const float hue_step = 180.0f / n_lut_colors ;
+    float hue = hue_step ;
+
+    for( int c=0 ; c<n_lut_colors ; c++, hue += hue_step ) {
+        double t = c / double(n_lut_colors - 1) ;
+        double r, g, b ;
 
-        hmax = 180 ;
-        hstep = hmax/nc ;
+        switch ( cmap ) {
+        case DepthVisualizer::Hue: {
+            cv::Vec3i rgb ;
+            hsv2rgb(hue, rgb) ;
+            lut[c] = cv::Vec3b(rgb[2], rgb[1], rgb[0]) ;
+            continue ;
+        }
+        case DepthVisualizer::Jet:
+            r = 1.5 - std::abs(4 * t - 3) ;
+            g = 1.5 - std::abs(4 * t - 2) ;
+            b = 1.5 - std::abs(4 * t - 1) ;
+            break ;
+        case DepthVisualizer::Gray:
+            r = g = b = t ;
+            break ;
+        case DepthVisualizer::Turbo:
+            // polynomial approximation of the Turbo colormap
+            r = 0.13572138 + t * (4.61539260 + t * (-42.66032258 + t * (132.13108234 + t * (-152.94239396 + t * 59.28637943)))) ;
+            g = 0.09140261 + t * (2.19418839 + t * (4.84296658 + t * (-14.18503333 + t * (4.27729857 + t * 2.82956604)))) ;
+            b = 0.10667330 + t * (12.64194608 + t * (-60.58204836 + t * (110.36276771 + t * (-89.90310912 + t * 27.34824973)))) ;
+            break ;
+        }
 
-        for ( c=0, h=hstep ; c<nc ; c++, h += hstep) hsv2rgb(h, hsvlut[c]) ;
+        lut[c] = cv::Vec3b(clamp(b), clamp(g), clamp(r)) ;
     }
 
-    unsigned short minv, maxv ;
-    int i, j ;
+    return lut ;
+}
 
-    minv = (minv_ == 0 ) ? 0xffff : minv_;
-    maxv = (maxv_ == 0 ) ? 0 : maxv_ ;
+vector<cv::Vec3b> swapRedBlue(vector<cv::Vec3b> lut) {
+    for( cv::Vec3b &c: lut ) std::swap(c[0], c[2]) ;
+    return lut ;
+}
 
-    uchar *ppl = depth.data ;
-    unsigned short *pp = (unsigned short *)ppl ;
-    int lw = depth.step ;
+const cv::Vec3b *colorMap(DepthVisualizer::ColorMap cmap, bool bgr) {
+    static const vector<cv::Vec3b> luts[] = {
+        makeColorMap(DepthVisualizer::Hue), makeColorMap(DepthVisualizer::Jet),
+        makeColorMap(DepthVisualizer::Gray), makeColorMap(DepthVisualizer::Turbo)
+    } ;
+    static const vector<cv::Vec3b> rgb_luts[] = {
+        swapRedBlue(luts[0]), swapRedBlue(luts[1]), swapRedBlue(luts[2]), swapRedBlue(luts[3])
+    } ;
+    return ( bgr ? luts : rgb_luts )[cmap].data() ;
+}
 
-    for ( i=0 ; i<h ; i++, ppl += lw )
-        for ( j=0, pp = (unsigned short *)ppl ; j<w ; j++, pp++ )
-        {
-            if ( *pp == 0 ) continue ;
-            maxv = std::max(*pp, maxv) ;
-            minv = std::min(*pp, minv) ;
+// range of the non-zero depths, (0xffff, 0) if there are none
+void depthRange(const cv::Mat &depth, ushort &minv, ushort &maxv) {
+    ushort lo = 0xffff, hi = 0 ;
+
+#pragma omp parallel for reduction(min:lo) reduction(max:hi)
+    for( int i=0 ; i<depth.rows ; i++ ) {
+        const ushort *src = depth.ptr<ushort>(i) ;
+        for( int j=0 ; j<depth.cols ; j++ ) {
+            ushort v = src[j] ;
+            hi = std::max(hi, v) ;
+            lo = std::min(lo, v ? v : (ushort)0xffff) ;
         }
+    }
 
-    cv::Mat image(h, w, CV_8UC3) ;
+    minv = lo ;
+    maxv = hi ;
+}
 
-    for( i=0 ; i<h ; i++ )
-    {
-        cv::Vec3b *dst = image.ptr<cv::Vec3b>(i) ;
-        unsigned short *src = (unsigned short *)depth.ptr<ushort>(i) ;
+}
 
-        for( j=0 ; j<w ; j++ )
-        {
-            unsigned short val = *src++ ;
+DepthVisualizer::DepthVisualizer(const Parameters &params): params_(params), lut_(colorMap(params.colormap_, params.bgr_)) {}
 
-            if ( val == 0 )
-            {
-                *(cv::Vec3b *)dst = cv::Vec3b(0, 0, 0) ;
-                dst ++ ;
-                continue ;
-            }
-            else val = (nc-1)*float((val - minv)/float(maxv - minv)) ;
+void DepthVisualizer::apply(const cv::Mat &depth, cv::Mat &res) const
+{
+    assert( depth.type() == CV_16UC1 ) ;
 
-            const cv::Vec3i &clr = hsvlut[val] ;
+    const int w = depth.cols, h = depth.rows ;
 
-            *(cv::Vec3b *)dst = cv::Vec3b(clr[0], clr[1], clr[2]) ;
-            dst ++ ;
+    ushort minv = params_.min_depth_, maxv = params_.max_depth_ ;
 
-        }
+    if ( minv == 0 || maxv == 0 ) {
+        ushort lo, hi ;
+        depthRange(depth, lo, hi) ;
+
+        if ( minv == 0 ) minv = lo ;
+        if ( maxv == 0 ) maxv = hi ;
     }
 
-    return image ;
+    if ( res.rows != h || res.cols != w || res.type() != CV_8UC3 ) res.create(h, w, CV_8UC3) ;
+
+    // colour of each depth offset within the range, so that the division is done once per depth value and not per
+    // pixel; the index is rounded as in the original depthViz
+    const uint range = ( maxv > minv ) ? maxv - minv : 0 ;
+    vector<cv::Vec3b> colors(range + 1) ;
+    for( uint d=0 ; d<=range ; d++ )
+        colors[d] = lut_[( range == 0 ) ? 0 : (ushort)(( n_lut_colors - 1 ) * float(d / float(range)))] ;
+    const cv::Vec3b *lut = colors.data() ;
+
+#pragma omp parallel for
+    for( int i=0 ; i<h ; i++ ) {
+        const ushort *src = depth.ptr<ushort>(i) ;
+        cv::Vec3b *dst = res.ptr<cv::Vec3b>(i) ;
+
+        for( int j=0 ; j<w ; j++ ) {
+            ushort v = src[j] ;
+            uint d = std::min<uint>(std::max(v, minv) - minv, range) ;
+            dst[j] = ( v == 0 ) ? cv::Vec3b(0, 0, 0) : lut[d] ;
+        }
+    }
 }
 
-class PtSorter
+cv::Mat depthViz(const cv::Mat &depth, ushort minv, ushort maxv)
 {
-public:
-    PtSorter() {}
+    // the given bounds only widen the range of the image
+    ushort lo, hi ;
+    depthRange(depth, lo, hi) ;
 
-    bool operator () (const cv::Point &p1, const cv::Point &p2) {
-        return p1.x * p1.x + p1.y * p1.y <  p2.x * p2.x + p2.y * p2.y ;
-    }
-};
+    DepthVisualizer::Parameters params ;
+    params.min_depth_ = ( minv == 0 ) ? lo : std::min(minv, lo) ;
+    params.max_depth_ = ( maxv == 0 ) ? hi : std::max(maxv, hi) ;
+    params.bgr_ = false ;
 
-bool sampleNearestNonZeroDepth(const cv::Mat &dim, int x, int y, ushort &z, int ws)
-{
-    assert ( dim.type() == CV_16UC1 ) ;
+    return DepthVisualizer(params).apply(depth) ;
+}
 
-    static vector<cv::Point> dpts ;
+// Offsets of the window [-ws, ws]^2 ordered by distance from the center (ties in row order), so that the first valid
+// pixel found is the nearest one. The tables of small windows are built once, on first use (thread safe).
 
-    if ( dpts.empty() )
-    {
-        for(int i=-ws ; i<=ws ; i++ )
-            for(int j=-ws ; j<=ws ; j++ )
-                dpts.push_back(cv::Point(j, i))  ;
+namespace {
+
+class SpiralOffsets {
+public:
+    static const int max_cached_radius = 16 ;
+
+    static vector<cv::Point> make(int ws) {
+        vector<cv::Point> offsets ;
+        for( int i=-ws ; i<=ws ; i++ )
+            for( int j=-ws ; j<=ws ; j++ )
+                offsets.push_back(cv::Point(j, i)) ;
+
+        std::stable_sort(offsets.begin(), offsets.end(), [](const cv::Point &p1, const cv::Point &p2) {
+            return p1.x * p1.x + p1.y * p1.y < p2.x * p2.x + p2.y * p2.y ;
+        }) ;
+        return offsets ;
+    }
 
-        PtSorter sorter ;
-        std::sort(dpts.begin(), dpts.end(), sorter) ;
+    static const SpiralOffsets &instance() {
+        static const SpiralOffsets offsets ;
+        return offsets ;
     }
 
-    bool found = false ;
+    const vector<cv::Point> &get(int ws) const { return tables_[ws] ; }
 
-    for(int i=0 ; i<dpts.size() ; i++)
-    {
-        const cv::Point &p = dpts[i] ;
+private:
+    SpiralOffsets() {
+        for( int ws=0 ; ws<=max_cached_radius ; ws++ ) tables_[ws] = make(ws) ;
+    }
 
-        int x_ = p.x + x ;
-        int y_ = p.y + y ;
+    vector<cv::Point> tables_[max_cached_radius + 1] ;
+} ;
 
-        if ( x_ < 0 || y_ < 0 || x_ >= dim.cols || y_ >= dim.rows ) continue ;
-        if ( ( z = dim.at<ushort>(y_, x_) ) == 0 ) continue ;
+// offsets for radius ws, either cached or built into tmp
+const vector<cv::Point> &spiralOffsets(int ws, vector<cv::Point> &tmp) {
+    if ( ws <= SpiralOffsets::max_cached_radius ) return SpiralOffsets::instance().get(ws) ;
+    tmp = SpiralOffsets::make(ws) ;
+    return tmp ;
+}
 
-        found = true ;
-        break ;
+bool nearestNonZero(const cv::Mat &dim, int x, int y, int ws, const vector<cv::Point> &offsets, ushort &z)
+{
+    const ushort *base = dim.ptr<ushort>(0) ;
+    const size_t stride = dim.step / sizeof(ushort) ;
+
+    if ( x >= ws && y >= ws && x + ws < dim.cols && y + ws < dim.rows ) {
+        const ushort *c = base + y * stride + x ;
+        for( const cv::Point &p: offsets )
+            if ( ( z = c[p.y * stride + p.x] ) != 0 ) return true ;
+        return false ;
     }
 
-    return found ;
+    for( const cv::Point &p: offsets ) {
+        int x_ = p.x + x, y_ = p.y + y ;
+        if ( x_ < 0 || y_ < 0 || x_ >= dim.cols || y_ >= dim.rows ) continue ;
+        if ( ( z = base[y_ * stride + x_] ) != 0 ) return true ;
+    }
 
+    return false ;
 }
 
-bool sampleBilinearDepth(const cv::Mat &dim, float x, float y, float &z, int ws)
+bool bilinear(const cv::Mat &dim, float x, float y, int ws, const vector<cv::Point> &offsets, float &z)
 {
-    assert ( dim.type() == CV_16UC1 ) ;
-
     int ix = x, iy = y ;
     float hx = x - ix, hy = y - iy ;
 
-    if ( ( ix + 1 < 0 || ix + 1 >= dim.cols ) ||
-         ( iy + 1 < 0 || iy + 1 >= dim.rows ) ||
-         ( ix < 0 ) || ( iy < 0 ) )
-    {
-        ushort uz ;
-        bool res = sampleNearestNonZeroDepth(dim, ix, iy, uz, ws) ;
+    ushort uz ;
+
+    if ( ix < 0 || iy < 0 || ix + 1 >= dim.cols || iy + 1 >= dim.rows ) {
+        bool res = nearestNonZero(dim, ix, iy, ws, offsets, uz) ;
         z = uz ;
         return res ;
     }
 
-    ushort z1 = dim.at<ushort>(iy, ix) ;
-    ushort z2 = dim.at<ushort>(iy, ix+1) ;
-    ushort z3 = dim.at<ushort>(iy+1, ix) ;
-    ushort z4 = dim.at<ushort>(iy+1, ix+1) ;
+    const ushort *r1 = dim.ptr<ushort>(iy) + ix, *r2 = dim.ptr<ushort>(iy + 1) + ix ;
+    ushort z1 = r1[0], z2 = r1[1], z3 = r2[0], z4 = r2[1] ;
 
-    if ( z1 == 0 || z2 == 0 || z3 == 0 || z4 == 0 )
-    {
-        ushort uz ;
-        bool res = sampleNearestNonZeroDepth(dim, ix, iy, uz) ;
+    if ( z1 == 0 || z2 == 0 || z3 == 0 || z4 == 0 ) {
+        bool res = nearestNonZero(dim, ix, iy, ws, offsets, uz) ;
         z = uz ;
         return res ;
     }
-    else
-    {
-        float s1 = (1 - hx) * z1 + hx * z2 ;
-        float s2 = (1 - hx) * z3 + hx * z4 ;
 
-        z = ( 1 - hy ) * s1 + hy * s2 ;
+    float s1 = (1 - hx) * z1 + hx * z2 ;
+    float s2 = (1 - hx) * z3 + hx * z4 ;
 
-        return true ;
-    }
+    z = ( 1 - hy ) * s1 + hy * s2 ;
+
+    return true ;
 }
 
+}
 
-void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model_, PointList3f &coords, uint sampling )
+bool sampleNearestNonZeroDepth(const cv::Mat &dim, int x, int y, ushort &z, int ws)
 {
+    assert ( dim.type() == CV_16UC1 ) ;
 
-    float center_x = model_.cx();
-    float center_y = model_.cy();
+    vector<cv::Point> tmp ;
+    return nearestNonZero(dim, x, y, ws, spiralOffsets(ws, tmp), z) ;
+}
 
-    const double unit_scaling = 0.001 ;
+bool sampleBilinearDepth(const cv::Mat &dim, float x, float y, float &z, int ws)
+{
+    assert ( dim.type() == CV_16UC1 ) ;
 
-    if ( depth.type() == CV_16UC1 )
-    {
+    vector<cv::Point> tmp ;
+    return bilinear(dim, x, y, ws, spiralOffsets(ws, tmp), z) ;
+}
 
-        float constant_x = unit_scaling / model_.fx();
-        float constant_y = unit_scaling / model_.fy();
+void sampleNearestNonZeroDepth(const cv::Mat &dim, const std::vector<cv::Point> &pts, std::vector<ushort> &z, std::vector<uchar> &valid, int ws)
+{
+    assert ( dim.type() == CV_16UC1 ) ;
+
+    vector<cv::Point> tmp ;
+    const vector<cv::Point> &offsets = spiralOffsets(ws, tmp) ;
+    const int n = pts.size() ;
+
+    z.resize(n) ;
+    valid.resize(n) ;
+
+#pragma omp parallel for schedule(static, 1024)
+    for( int i=0 ; i<n ; i++ ) {
+        valid[i] = nearestNonZero(dim, pts[i].x, pts[i].y, ws, offsets, z[i]) ;
+        if ( !valid[i] ) z[i] = 0 ;
+    }
+}
 
-        cv::Mat_<ushort> depth_(depth) ;
+void sampleBilinearDepth(const cv::Mat &dim, const std::vector<cv::Point2f> &pts, std::vector<float> &z, std::vector<uchar> &valid, int ws)
+{
+    assert ( dim.type() == CV_16UC1 ) ;
 
-        for(int i=0 ; i<depth.rows ; i+=sampling)
-            for(int j=0 ; j<depth.cols ; j+=sampling)
-            {
-                ushort val = depth_[i][j] ;
+    vector<cv::Point> tmp ;
+    const vector<cv::Point> &offsets = spiralOffsets(ws, tmp) ;
+    const int n = pts.size() ;
 
-                if ( val == 0 ) continue ;
+    z.resize(n) ;
+    valid.resize(n) ;
 
-                coords.push_back(Vector3f((j - center_x) * val * constant_x,
-                                          (i - center_y) * val * constant_y,
-                                          val * unit_scaling )) ;
+#pragma omp parallel for schedule(static, 1024)
+    for( int i=0 ; i<n ; i++ ) {
+        valid[i] = bilinear(dim, pts[i].x, pts[i].y, ws, offsets, z[i]) ;
+        if ( !valid[i] ) z[i] = 0 ;
+    }
+}
+
+
+// Back-projection: the ray (x/z, y/z) of each pixel is looked up so that a point is just three multiplications with its
+// depth. Without lens distortion rays are separable and computed per column and per row for each call; otherwise they
+// come from the per-pixel ray maps cached by the camera. Rows are independent and processed in parallel; the inner
+// loops are branch free so that they vectorise.
+
+namespace {
+
+class RayFactors {
+public:
+    RayFactors(const PinholeCamera &model, int cols, int rows, uint sampling): step_(sampling) {
+        w_ = ( cols + sampling - 1 ) / sampling ;
+        h_ = ( rows + sampling - 1 ) / sampling ;
+
+        if ( model.hasDistortion() && model.sz() == cv::Size(cols, rows) ) {
+            map_x_ = model.rayMapX() ;
+            map_y_ = model.rayMapY() ;
+        } else if ( model.hasDistortion() ) {
+            // the cached maps are for another image size, undistort the sampled pixels of this one
+            vector<cv::Point2f> pixels, rays ;
+            pixels.reserve((size_t)w_ * h_) ;
+            for( int i=0 ; i<rows ; i += sampling )
+                for( int j=0 ; j<cols ; j += sampling )
+                    pixels.push_back(cv::Point2f(j, i)) ;
+
+            cv::undistortPoints(pixels, rays, model.getMatrix(), model.getDistortion()) ;
+
+            step_ = 1 ;
+            map_x_.create(h_, w_, CV_32FC1) ;
+            map_y_.create(h_, w_, CV_32FC1) ;
+            for( int i=0 ; i<h_ ; i++ )
+                for( int j=0 ; j<w_ ; j++ ) {
+                    map_x_.at<float>(i, j) = rays[(size_t)i * w_ + j].x ;
+                    map_y_.at<float>(i, j) = rays[(size_t)i * w_ + j].y ;
+                }
+        } else {
+            for( int j=0 ; j<cols ; j += sampling ) rx_.push_back((j - model.cx()) / model.fx()) ;
+            for( int i=0 ; i<rows ; i += sampling ) ry_.push_back((i - model.cy()) / model.fy()) ;
+        }
+    }
+
+    int width() const { return w_ ; }
+    int height() const { return h_ ; }
+
+    // x and y of the points of sampled row i, given their depth z (0 for missing values)
+    void backProject(int i, const float *z, float *x, float *y) const {
+        if ( map_x_.empty() ) {
+            const float *rx = rx_.data(), ry = ry_[i] ;
+            for( int j=0 ; j<w_ ; j++ ) {
+                x[j] = rx[j] * z[j] ;
+                y[j] = ry * z[j] ;
             }
+        } else {
+            const float *rx = map_x_.ptr<float>(i * step_), *ry = map_y_.ptr<float>(i * step_) ;
+            for( int j=0 ; j<w_ ; j++ ) {
+                x[j] = rx[j * step_] * z[j] ;
+                y[j] = ry[j * step_] * z[j] ;
+            }
+        }
+    }
 
+private:
+    int w_, h_ ;
+    uint step_ ;                // pixel step between the samples in the ray maps
+    vector<float> rx_, ry_ ;
+    cv::Mat map_x_, map_y_ ;
+} ;
+
+float depthScale(const cv::Mat &depth, float depth_unit) {
+    assert( depth.type() == CV_16UC1 || depth.type() == CV_32FC1 ) ;
+    if ( depth_unit > 0 ) return depth_unit ;
+    return ( depth.type() == CV_16UC1 ) ? 0.001f : 1.0f ;
+}
+
+// every step-th depth value of the row scaled to meters, 0 for missing (zero, negative, NaN or infinite) values
+template<class T>
+void depthRow(const T *src, uint n, uint step, float scale, float *z) {
+    const float inf = std::numeric_limits<float>::infinity() ;
+    for( uint j=0 ; j<n ; j++ ) {
+        float v = src[j * step] * scale ;
+        z[j] = ( v > 0 && v < inf ) ? v : 0.0f ;
     }
-    else if ( depth.type() == CV_32FC1 )
-    {
+}
 
-        float constant_x = 1.0 / model_.fx();
-        float constant_y = 1.0 / model_.fy();
+void depthRow(const cv::Mat &depth, int i, uint n, uint step, float scale, float *z) {
+    if ( depth.type() == CV_16UC1 ) depthRow(depth.ptr<ushort>(i), n, step, scale, z) ;
+    else depthRow(depth.ptr<float>(i), n, step, scale, z) ;
+}
 
-        cv::Mat_<float> depth_(depth) ;
+}
 
-        for(int i=0 ; i<depth.rows ; i+=sampling)
-            for(int j=0 ; j<depth.cols ; j+=sampling)
-            {
-                float val = depth_[i][j] ;
+void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model, PointList3f &coords, uint sampling, float depth_unit)
+{
+    const float scale = depthScale(depth, depth_unit) ;
+    const RayFactors rays(model, depth.cols, depth.rows, sampling) ;
+    const int w = rays.width(), h = rays.height() ;
 
-                if ( std::isnan(val) ) continue ;
+    // count the valid points of each row, then write each row at its offset given by the prefix sum of the counts
 
-                coords.push_back(Vector3f((j - center_x) * val * constant_x,
-                                          (i - center_y) * val * constant_y,
-                                          val * unit_scaling )) ;
+    vector<size_t> offsets(h + 1, 0) ;
+
+#pragma omp parallel
+    {
+        vector<float> x(w), y(w), z(w) ;
+
+#pragma omp for
+        for( int i=0 ; i<h ; i++ ) {
+            depthRow(depth, i * sampling, w, sampling, scale, z.data()) ;
+            size_t count = 0 ;
+            for( int j=0 ; j<w ; j++ ) count += ( z[j] > 0 ) ;
+            offsets[i+1] = count ;
+        }
+
+#pragma omp single
+        {
+            offsets[0] = coords.size() ;
+            for( int i=0 ; i<h ; i++ ) offsets[i+1] += offsets[i] ;
+            coords.resize(offsets[h]) ;
+        }
+
+#pragma omp for
+        for( int i=0 ; i<h ; i++ ) {
+            depthRow(depth, i * sampling, w, sampling, scale, z.data()) ;
+            rays.backProject(i, z.data(), x.data(), y.data()) ;
+
+            Vector3f *dst = coords.data() + offsets[i] ;
+            for( int j=0 ; j<w ; j++ ) {
+                if ( z[j] == 0 ) continue ;
+                *dst++ = Vector3f(x[j], y[j], z[j]) ;
             }
+        }
     }
+}
+
+void depthToVertexMap(const cv::Mat &depth, const PinholeCamera &model, PointList3f &vertices, float depth_unit)
+{
+    const float nan = std::numeric_limits<float>::quiet_NaN() ;
+    const float scale = depthScale(depth, depth_unit) ;
+    const RayFactors rays(model, depth.cols, depth.rows, 1) ;
+    const int w = depth.cols, h = depth.rows ;
+
+    vertices.resize((size_t)w * h) ;
+
+#pragma omp parallel
+    {
+        vector<float> x(w), y(w), z(w) ;
+
+#pragma omp for
+        for( int i=0 ; i<h ; i++ ) {
+            depthRow(depth, i, w, 1, scale, z.data()) ;
+            for( int j=0 ; j<w ; j++ ) z[j] = ( z[j] > 0 ) ? z[j] : nan ;
+            rays.backProject(i, z.data(), x.data(), y.data()) ;
 
+            Vector3f *dst = &vertices[(size_t)i * w] ;
+            for( int j=0 ; j<w ; j++ )
+                dst[j] = Vector3f(x[j], y[j], z[j]) ;
+        }
+    }
 }
 
+void depthToPointCloud(const cv::Mat &depth, const PinholeCamera &model, OrganizedPointCloud &cloud, const cv::Mat &rgb, float depth_unit)
+{
+    assert( rgb.empty() || ( rgb.type() == CV_8UC3 && rgb.size() == depth.size() ) ) ;
+
+    const float scale = depthScale(depth, depth_unit) ;
+    const RayFactors rays(model, depth.cols, depth.rows, 1) ;
+    const int w = depth.cols, h = depth.rows ;
+
+    cloud = OrganizedPointCloud(w, h, !rgb.empty()) ;
+
+    float *px = cloud.xData(), *py = cloud.yData(), *pz = cloud.zData() ;
+    uint8_t *mask = cloud.maskData() ;
+
+#pragma omp parallel for
+    for( int i=0 ; i<h ; i++ ) {
+        size_t offset = (size_t)i * w ;
+        float *z = pz + offset ;
+
+        depthRow(depth, i, w, 1, scale, z) ;
+        rays.backProject(i, z, px + offset, py + offset) ;
+
+        for( int j=0 ; j<w ; j++ )
+            mask[offset + j] = ( z[j] > 0 ) ;
+
+        if ( !rgb.empty() )
+            memcpy(cloud.colorData() + 3 * offset, rgb.ptr<uchar>(i), 3 * w) ;
+    }
+}
 
 }
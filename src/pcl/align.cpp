@@ -43,6 +43,24 @@ Isometry3f alignRigid(const Matrix3Xf &P, const Matrix3Xf &Q) {
     return A;
 }
 
+Isometry3f alignRigid(const Matrix3d &cov, const Vector3d &p, const Vector3d &q) {
+
+    JacobiSVD<Matrix3d> svd(cov, ComputeFullU | ComputeFullV);
+
+    // Find the rotation, and prevent reflections
+    Matrix3d I = Matrix3d::Identity();
+    double d = (svd.matrixV()*svd.matrixU().transpose()).determinant();
+    I(2, 2) = (d > 0.0) ? 1.0 : -1.0;
+
+    Matrix3d R = svd.matrixV()*I*svd.matrixU().transpose();
+
+    Isometry3f A = Isometry3f::Identity() ;
+    A.linear() = R.cast<float>();
+    A.translation() = (q - R*p).cast<float>();
+
+    return A;
+}
+
 Isometry3f alignRigid(const vector<Vector3f> &src, const vector<Vector3f> &dst) {
 
     assert( src.size() == dst.size() ) ;
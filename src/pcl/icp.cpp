@@ -1,5 +1,8 @@
 #include <cvx/pcl/icp.hpp>
 #include <cvx/pcl/align.hpp>
+#include <cvx/pcl/voxel_grid.hpp>
+#include <cvx/pcl/normals.hpp>
+#include <cvx/camera/camera.hpp>
 
 #include <float.h>
 
@@ -8,6 +11,33 @@ using namespace std ;
 
 namespace cvx {
 
+// sums over the correspondences (src point p, target point q) needed for the rigid alignment
+
+struct ICPAccumulator {
+    size_t n_ = 0 ;
+    double sq_dist_ = 0 ;
+    Vector3d sp_ = Vector3d::Zero(), sq_ = Vector3d::Zero() ;
+    Matrix3d spq_ = Matrix3d::Zero() ;
+
+    void add(const Vector3f &p, const Vector3f &q, float sq_dist) {
+        Vector3d pd = p.cast<double>(), qd = q.cast<double>() ;
+        ++n_ ;
+        sq_dist_ += sq_dist ;
+        sp_ += pd ;
+        sq_ += qd ;
+        spq_ += pd * qd.transpose() ;
+    }
+
+    ICPAccumulator &operator += (const ICPAccumulator &other) {
+        n_ += other.n_ ;
+        sq_dist_ += other.sq_dist_ ;
+        sp_ += other.sp_ ;
+        sq_ += other.sq_ ;
+        spq_ += other.spq_ ;
+        return *this ;
+    }
+} ;
+
 float ICPAligner::align(KDTree3 &search, const PointList3f &target_pts, const PointList3f &src, Isometry3f &pose, uint &n_inliers)
 {
     using Eigen::Vector3f ;
@@ -18,43 +48,299 @@ float ICPAligner::align(KDTree3 &search, const PointList3f &target_pts, const Po
 
     float current_error = FLT_MAX, previous_error = FLT_MAX ;
 
+#pragma omp declare reduction(sum : ICPAccumulator : omp_out += omp_in) initializer(omp_priv = ICPAccumulator())
+
     for( uint iter = 0 ; iter < params_.max_iterations_ ; ++iter ) {
 
-        vector<Vector3f> inliers_src, inliers_dst, inliers_trans ;
-        float sum_sq_distance = 0 ;
+        // correspondences are accumulated per thread and never stored
 
-        for( uint i=0 ; i<src.size() ; i++ ) {
+        ICPAccumulator acc ;
+
+#pragma omp parallel for reduction(sum : acc) schedule(dynamic, 1024)
+        for( size_t i=0 ; i<src.size() ; i++ ) {
             const Vector3f &src_pt = src[i] ;
             Vector3f src_pt_trans = current * src_pt ;
 
             float dist ;
-            uint idx = search.nearest(src_pt_trans, dist) ;
+            uint idx ;
+
+            if ( search.nearest(src_pt_trans, sq_distance_threshold, idx, dist) )
+                acc.add(src_pt, target_pts[idx], dist) ;
+        }
+
+        n_inliers = acc.n_ ;
+
+        if ( n_inliers < params_.min_inliers_ ) break ;
+
+        previous_error = current_error ;
+        current_error = acc.sq_dist_ / n_inliers ;
+
+        float delta = fabs(previous_error - current_error) ;
+        if ( delta < params_.epsilon_ ) break ;
+
+        sq_distance_threshold = params_.inlier_threshold_update_factor_ * current_error ;
+
+        // cross-covariance sum (p - mp)(q - mq)^T = sum p q^T - n mp mq^T
+        Vector3d mp = acc.sp_ / n_inliers, mq = acc.sq_ / n_inliers ;
+        Matrix3d cov = acc.spq_ - n_inliers * mp * mq.transpose() ;
+
+        current = alignRigid(cov, mp, mq) ;
+    }
+
+    pose = current ;
+    return current_error ;
+}
+
+// normal equations of the linearised point-to-plane (or symmetric) objective with unknowns x = (rotation, translation).
+// Each correspondence contributes the residual r + J x with J = [c, n].
+
+struct PlaneICPAccumulator {
+    size_t n_ = 0 ;
+    double sq_dist_ = 0 ;
+    Matrix<double, 6, 6> AtA_ = Matrix<double, 6, 6>::Zero() ;
+    Matrix<double, 6, 1> Atb_ = Matrix<double, 6, 1>::Zero() ;
+
+    void add(const Vector3d &c, const Vector3d &n, double r, float sq_dist) {
+        Matrix<double, 6, 1> J ;
+        J << c, n ;
+        AtA_ += J * J.transpose() ;
+        Atb_ += J * r ;
+        ++n_ ;
+        sq_dist_ += sq_dist ;
+    }
+
+    PlaneICPAccumulator &operator += (const PlaneICPAccumulator &other) {
+        n_ += other.n_ ;
+        sq_dist_ += other.sq_dist_ ;
+        AtA_ += other.AtA_ ;
+        Atb_ += other.Atb_ ;
+        return *this ;
+    }
+} ;
+
+float ICPAligner::align(KDTree3 &search, const PointList3f &target_pts, const PointList3f &target_normals, const PointList3f &src,
+                        const PointList3f &src_normals, Isometry3f &pose, uint &n_inliers)
+{
+    using Eigen::Vector3f ;
+
+    if ( params_.metric_ == PointToPoint )
+        return align(search, target_pts, src, pose, n_inliers) ;
+
+    const bool symmetric = ( params_.metric_ == Symmetric ) ;
+
+    assert( target_normals.size() == target_pts.size() ) ;
+    assert( !symmetric || src_normals.size() == src.size() ) ;
+
+    Isometry3f current(pose) ;
+
+    float sq_distance_threshold = params_.inlier_distance_threshold_ * params_.inlier_distance_threshold_ ;
+
+    float current_error = FLT_MAX, previous_error = FLT_MAX ;
+
+#pragma omp declare reduction(sum : PlaneICPAccumulator : omp_out += omp_in) initializer(omp_priv = PlaneICPAccumulator())
+
+    for( uint iter = 0 ; iter < params_.max_iterations_ ; ++iter ) {
+
+        PlaneICPAccumulator acc ;
+
+#pragma omp parallel for reduction(sum : acc) schedule(dynamic, 1024)
+        for( size_t i=0 ; i<src.size() ; i++ ) {
+            Vector3f p = current * src[i] ;
+
+            float dist ;
+            uint idx ;
+
+            if ( !search.nearest(p, sq_distance_threshold, idx, dist) ) continue ;
 
-            if ( dist < sq_distance_threshold ) {
-                inliers_src.push_back(src_pt) ;
-                inliers_dst.push_back(target_pts[idx]) ;
-                inliers_trans.push_back(src_pt_trans) ;
-                sum_sq_distance += dist ;
+            Vector3f n = target_normals[idx] ;
+
+            if ( symmetric ) {
+                // the two normals may be oriented differently
+                Vector3f np = current.linear() * src_normals[i] ;
+                n = ( np.dot(n) < 0 ) ? Vector3f(n - np) : Vector3f(n + np) ;
             }
+
+            // skip points whose normal could not be estimated
+            if ( n.squaredNorm() == 0.0f ) continue ;
+
+            Vector3d pd = p.cast<double>(), qd = target_pts[idx].cast<double>(), nd = n.cast<double>() ;
+            Vector3d c = symmetric ? Vector3d(( pd + qd ).cross(nd)) : Vector3d(pd.cross(nd)) ;
+
+            acc.add(c, nd, ( pd - qd ).dot(nd), dist) ;
         }
 
-        n_inliers = inliers_src.size() ;
+        n_inliers = acc.n_ ;
 
         if ( n_inliers < params_.min_inliers_ ) break ;
 
         previous_error = current_error ;
-        current_error = sum_sq_distance / n_inliers ;
+        current_error = acc.sq_dist_ / n_inliers ;
 
         float delta = fabs(previous_error - current_error) ;
         if ( delta < params_.epsilon_ ) break ;
 
         sq_distance_threshold = params_.inlier_threshold_update_factor_ * current_error ;
 
-        current = alignRigid(inliers_src, inliers_dst) ;
+        // Gauss-Newton step
+
+        Matrix<double, 6, 1> x = acc.AtA_.ldlt().solve(-acc.Atb_) ;
+        Vector3d a = x.head<3>(), t = x.tail<3>() ;
+
+        Isometry3d step = Isometry3d::Identity() ;
+
+        if ( symmetric ) {
+            // the rotation is split between the two clouds: step = R * T * R with R by atan(|a|) (Rusinkiewicz 2019)
+            double theta = atan(a.norm()) ;
+            Matrix3d R = ( theta > 0 ) ? Matrix3d(AngleAxisd(theta, a.normalized())) : Matrix3d::Identity() ;
+            step.linear() = R * R ;
+            step.translation() = R * t * cos(theta) ;
+        } else {
+            double theta = a.norm() ;
+            if ( theta > 0 ) step.linear() = AngleAxisd(theta, a / theta).toRotationMatrix() ;
+            step.translation() = t ;
+        }
+
+        current = step.cast<float>() * current ;
     }
 
     pose = current ;
     return current_error ;
 }
 
+void PyramidICPAligner::makeLevel(const PointList3f &cloud, float voxel_size, PointList3f &points, PointList3f &normals,
+                                  bool need_normals) const {
+    if ( voxel_size > 0 ) {
+        VoxelGridFilter::Parameters vparams ;
+        vparams.voxel_size_ = voxel_size ;
+        VoxelGridFilter(vparams).filter(cloud, points) ;
+    }
+    else
+        points = cloud ;
+
+    if ( need_normals )
+        estimateNormals(points, params_.normal_neighbours_, normals) ;
+}
+
+PyramidICPAligner::PyramidICPAligner(const PointList3f &target, const Parameters &params): params_(params) {
+    bool need_normals = params_.icp_.metric_ != ICPAligner::PointToPoint ;
+
+    for( float voxel_size: params_.voxel_sizes_ ) {
+        std::unique_ptr<Level> level(new Level) ;
+        makeLevel(target, voxel_size, level->points_, level->normals_, need_normals) ;
+        level->tree_.borrow(level->points_) ;
+        levels_.emplace_back(std::move(level)) ;
+    }
+}
+
+float PyramidICPAligner::align(const PointList3f &src, Isometry3f &pose, uint &n_inliers) {
+    bool need_normals = params_.icp_.metric_ == ICPAligner::Symmetric ;
+
+    float threshold = params_.inlier_distance_threshold_ ;
+    float error = FLT_MAX ;
+    n_inliers = 0 ;
+
+    PointList3f points, normals ;
+
+    for( size_t l=0 ; l<levels_.size() ; l++ ) {
+        Level &level = *levels_[l] ;
+
+        makeLevel(src, params_.voxel_sizes_[l], points, normals, need_normals) ;
+
+        ICPAligner::Parameters iparams = params_.icp_ ;
+        iparams.inlier_distance_threshold_ = threshold ;
+
+        ICPAligner icp(iparams) ;
+        error = icp.align(level.tree_, level.points_, level.normals_, points, normals, pose, n_inliers) ;
+
+        threshold *= params_.threshold_scale_ ;
+    }
+
+    return error ;
+}
+
+ProjectiveICPAligner::ProjectiveICPAligner(const PinholeCamera &cam, const Parameters &params):
+    params_(params), fx_(cam.fx()), fy_(cam.fy()), cx_(cam.cx()), cy_(cam.cy()), width_(cam.width()), height_(cam.height()) {}
+
+float ProjectiveICPAligner::align(const PointList3f &target, const PointList3f &target_normals, const PointList3f &src,
+                                  const PointList3f &src_normals, Isometry3f &pose, uint &n_inliers) const
+{
+    using Eigen::Vector3f ;
+
+    assert( target.size() == (size_t)width_ * height_ && src.size() == target.size() ) ;
+    assert( target_normals.size() == target.size() ) ;
+
+    const bool check_normals = !src_normals.empty() ;
+    const float sq_max_distance = params_.max_distance_ * params_.max_distance_ ;
+    const float min_cos = cos(params_.max_normal_angle_) ;
+    const uint step = std::max(1u, params_.sampling_) ;
+    const int w = width_, h = height_ ;
+
+    Isometry3f current(pose) ;
+    float error = FLT_MAX ;
+    n_inliers = 0 ;
+
+#pragma omp declare reduction(sum : PlaneICPAccumulator : omp_out += omp_in) initializer(omp_priv = PlaneICPAccumulator())
+
+    for( uint iter = 0 ; iter < params_.max_iterations_ ; ++iter ) {
+
+        PlaneICPAccumulator acc ;
+        double sq_residual = 0 ;
+
+#pragma omp parallel for reduction(sum : acc) reduction(+ : sq_residual) schedule(static)
+        for( int y=0 ; y<h ; y += step ) {
+            for( int x=0 ; x<w ; x += step ) {
+                size_t idx = (size_t)y * w + x ;
+                const Vector3f &v = src[idx] ;
+                if ( std::isnan(v.z()) ) continue ;
+
+                // project into the target image
+                Vector3f p = current * v ;
+                if ( p.z() <= 0 ) continue ;
+
+                int u = (int)std::lround(fx_ * p.x() / p.z() + cx_) ;
+                int r = (int)std::lround(fy_ * p.y() / p.z() + cy_) ;
+                if ( u < 0 || r < 0 || u >= w || r >= h ) continue ;
+
+                size_t tidx = (size_t)r * w + u ;
+                const Vector3f &q = target[tidx] ;
+                const Vector3f &n = target_normals[tidx] ;
+                if ( std::isnan(q.z()) || std::isnan(n.z()) ) continue ;
+
+                float sq_dist = ( p - q ).squaredNorm() ;
+                if ( sq_dist > sq_max_distance ) continue ;
+
+                if ( check_normals ) {
+                    const Vector3f &ns = src_normals[idx] ;
+                    if ( std::isnan(ns.z()) || ( current.linear() * ns ).dot(n) < min_cos ) continue ;
+                }
+
+                Vector3d pd = p.cast<double>(), nd = n.cast<double>() ;
+                double res = ( pd - q.cast<double>() ).dot(nd) ;
+                acc.add(pd.cross(nd), nd, res, sq_dist) ;
+                sq_residual += res * res ;
+            }
+        }
+
+        if ( acc.n_ < params_.min_inliers_ ) break ;
+
+        n_inliers = acc.n_ ;
+        error = sq_residual / acc.n_ ;
+
+        Matrix<double, 6, 1> x = acc.AtA_.ldlt().solve(-acc.Atb_) ;
+        Vector3d a = x.head<3>() ;
+
+        Isometry3d update = Isometry3d::Identity() ;
+        double theta = a.norm() ;
+        if ( theta > 0 ) update.linear() = AngleAxisd(theta, a / theta).toRotationMatrix() ;
+        update.translation() = x.tail<3>() ;
+
+        current = update.cast<float>() * current ;
+
+        if ( x.norm() < params_.epsilon_ ) break ;
+    }
+
+    pose = current ;
+    return error ;
+}
+
 }
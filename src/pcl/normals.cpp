@@ -0,0 +1,86 @@
+#include <cvx/pcl/normals.hpp>
+
+#include <Eigen/Eigenvalues>
+#include <algorithm>
+#include <cmath>
+
+using namespace std ;
+using namespace Eigen ;
+
+namespace cvx {
+
+void estimateNormals(const KDTree3 &search, const PointList3f &cloud, uint k, PointList3f &normals, const Vector3f &viewpoint) {
+    const size_t n = cloud.size(), block_size = 65536 ;
+
+    normals.resize(n) ;
+
+    vector<uint> indexes ;
+    vector<float> distances ;
+    PointList3f queries ;
+
+    // queries are processed in blocks to bound the size of the neighbour lists
+    for( size_t first = 0 ; first < n ; first += block_size ) {
+        size_t last = std::min(first + block_size, n) ;
+
+        queries.assign(cloud.begin() + first, cloud.begin() + last) ;
+        search.knearest(queries, k, indexes, distances) ;
+
+#pragma omp parallel for
+        for( size_t i=first ; i<last ; i++ ) {
+            const uint *nn = &indexes[( i - first ) * k] ;
+
+            Vector3d mean = Vector3d::Zero() ;
+            Matrix3d cov = Matrix3d::Zero() ;
+            uint count = 0 ;
+
+            for( uint j=0 ; j<k && nn[j] != (uint)-1 ; j++ ) {
+                Vector3d p = cloud[nn[j]].cast<double>() ;
+                mean += p ;
+                cov += p * p.transpose() ;
+                ++count ;
+            }
+
+            if ( count < 3 ) {
+                normals[i].setZero() ;
+                continue ;
+            }
+
+            mean /= count ;
+            cov = cov / count - mean * mean.transpose() ;
+
+            SelfAdjointEigenSolver<Matrix3d> es ;
+            es.computeDirect(cov) ;
+
+            // eigenvalues are sorted in increasing order
+            Vector3f normal = es.eigenvectors().col(0).cast<float>().normalized() ;
+            if ( normal.dot(viewpoint - cloud[i]) < 0 ) normal = -normal ;
+
+            normals[i] = normal ;
+        }
+    }
+}
+
+void estimateNormals(const PointList3f &cloud, uint k, PointList3f &normals, const Vector3f &viewpoint) {
+    KDTree3 search ;
+    search.borrow(cloud) ;
+    estimateNormals(search, cloud, k, normals, viewpoint) ;
+}
+
+void estimateNormalsOrganized(const PointList3f &cloud, uint width, uint height, PointList3f &normals, float max_distance) {
+    assert( cloud.size() == (size_t)width * height ) ;
+
+    const float sq_max_distance = max_distance * max_distance ;
+    const int w = width, h = height ;
+
+    normals.resize(cloud.size()) ;
+
+    auto valid = [&](int x, int y) { return !std::isnan(cloud[(size_t)y * w + x].z()) ; } ;
+    auto point = [&](int x, int y) -> const Vector3f & { return cloud[(size_t)y * w + x] ; } ;
+
+#pragma omp parallel for
+    for( int y=0 ; y<h ; y++ )
+        for( int x=0 ; x<w ; x++ )
+            normals[(size_t)y * w + x] = detail::organizedNormal(x, y, w, h, sq_max_distance, valid, point) ;
+}
+
+}
@@ -0,0 +1,151 @@
+#include <cvx/pcl/organized_cloud.hpp>
+#include <cvx/pcl/normals.hpp>
+
+#include <cassert>
+#include <limits>
+#include <cmath>
+
+using namespace std ;
+using namespace Eigen ;
+
+namespace cvx {
+
+OrganizedPointCloud::OrganizedPointCloud(uint width, uint height, bool with_colors, bool with_normals):
+    data_(new Storage), width_(width), height_(height) {
+    size_t n = (size_t)width * height ;
+
+    data_->width_ = width ;
+    data_->height_ = height ;
+    data_->x_.resize(n) ;
+    data_->y_.resize(n) ;
+    data_->z_.resize(n) ;
+    data_->mask_.resize(n, 0) ;
+
+    if ( with_colors ) allocateColors() ;
+    if ( with_normals ) allocateNormals() ;
+}
+
+void OrganizedPointCloud::allocateColors() {
+    if ( hasColors() ) return ;
+    data_->colors_.resize(3 * data_->mask_.size(), 0) ;
+}
+
+void OrganizedPointCloud::allocateNormals() {
+    if ( hasNormals() ) return ;
+    const float nan = std::numeric_limits<float>::quiet_NaN() ;
+    size_t n = data_->mask_.size() ;
+    data_->nx_.resize(n, nan) ;
+    data_->ny_.resize(n, nan) ;
+    data_->nz_.resize(n, nan) ;
+}
+
+OrganizedPointCloud OrganizedPointCloud::roi(uint x, uint y, uint w, uint h) const {
+    assert( x + w <= width_ && y + h <= height_ ) ;
+
+    OrganizedPointCloud view(*this) ;
+    view.x0_ = x0_ + x * step_ ;
+    view.y0_ = y0_ + y * step_ ;
+    view.width_ = w ;
+    view.height_ = h ;
+    return view ;
+}
+
+OrganizedPointCloud OrganizedPointCloud::subsample(uint step) const {
+    assert( step > 0 ) ;
+
+    OrganizedPointCloud view(*this) ;
+    view.step_ = step_ * step ;
+    view.width_ = ( width_ + step - 1 ) / step ;
+    view.height_ = ( height_ + step - 1 ) / step ;
+    return view ;
+}
+
+OrganizedPointCloud OrganizedPointCloud::clone() const {
+    OrganizedPointCloud res(width_, height_, hasColors(), hasNormals()) ;
+    if ( empty() ) return res ;
+
+    const Storage &src = *data_ ;
+    Storage &dst = *res.data_ ;
+
+#pragma omp parallel for
+    for( int y=0 ; y<(int)height_ ; y++ ) {
+        for( uint x=0 ; x<width_ ; x++ ) {
+            size_t i = index(x, y), j = (size_t)y * width_ + x ;
+            dst.x_[j] = src.x_[i] ; dst.y_[j] = src.y_[i] ; dst.z_[j] = src.z_[i] ;
+            dst.mask_[j] = src.mask_[i] ;
+            if ( !src.colors_.empty() )
+                for( uint c=0 ; c<3 ; c++ ) dst.colors_[3*j + c] = src.colors_[3*i + c] ;
+            if ( !src.nx_.empty() ) {
+                dst.nx_[j] = src.nx_[i] ; dst.ny_[j] = src.ny_[i] ; dst.nz_[j] = src.nz_[i] ;
+            }
+        }
+    }
+
+    return res ;
+}
+
+size_t OrganizedPointCloud::countValid() const {
+    size_t count = 0 ;
+
+#pragma omp parallel for reduction(+:count)
+    for( int y=0 ; y<(int)height_ ; y++ ) {
+        const uint8_t *mask = &data_->mask_[index(0, y)] ;
+        for( uint x=0 ; x<width_ ; x++ )
+            count += ( mask[x * step_] != 0 ) ;
+    }
+
+    return count ;
+}
+
+void OrganizedPointCloud::getPoints(PointList3f &pts) const {
+    pts.clear() ;
+
+    for( uint y=0 ; y<height_ ; y++ )
+        for( uint x=0 ; x<width_ ; x++ ) {
+            if ( isValid(x, y) ) pts.push_back(point(x, y)) ;
+        }
+}
+
+void OrganizedPointCloud::getPoints(PointList3f &pts, PointList3f &normals) const {
+    assert( hasNormals() ) ;
+
+    pts.clear() ;
+    normals.clear() ;
+
+    for( uint y=0 ; y<height_ ; y++ )
+        for( uint x=0 ; x<width_ ; x++ ) {
+            if ( !isValid(x, y) ) continue ;
+            pts.push_back(point(x, y)) ;
+            normals.push_back(normal(x, y)) ;
+        }
+}
+
+void OrganizedPointCloud::getVertexMap(PointList3f &vertices) const {
+    const float nan = std::numeric_limits<float>::quiet_NaN() ;
+
+    vertices.resize((size_t)width_ * height_) ;
+
+#pragma omp parallel for
+    for( int y=0 ; y<(int)height_ ; y++ ) {
+        Vector3f *dst = &vertices[(size_t)y * width_] ;
+        for( uint x=0 ; x<width_ ; x++ )
+            dst[x] = isValid(x, y) ? point(x, y) : Vector3f(nan, nan, nan) ;
+    }
+}
+
+void OrganizedPointCloud::computeNormals(float max_distance) {
+    allocateNormals() ;
+
+    const float sq_max_distance = max_distance * max_distance ;
+    const int w = width_, h = height_ ;
+
+    auto valid = [this](int x, int y) { return isValid(x, y) ; } ;
+    auto point = [this](int x, int y) { return this->point(x, y) ; } ;
+
+#pragma omp parallel for
+    for( int y=0 ; y<h ; y++ )
+        for( int x=0 ; x<w ; x++ )
+            setNormal(x, y, detail::organizedNormal(x, y, w, h, sq_max_distance, valid, point)) ;
+}
+
+}
@@ -0,0 +1,184 @@
+#include <cvx/pcl/voxel_grid.hpp>
+
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+
+using namespace std ;
+using namespace Eigen ;
+
+namespace cvx {
+
+struct VoxelKey {
+    uint64_t key_ ;
+    uint idx_ ;
+} ;
+
+// Stable LSD radix sort on the lowest n_bits of the keys. Each pass counts digits per block of keys in parallel and
+// scatters the blocks in parallel at offsets given by the prefix sum of the counts in (digit, block) order.
+
+static void radixSort(vector<VoxelKey> &keys, uint n_bits) {
+    const uint digit_bits = 11, n_buckets = 1 << digit_bits ;
+    const size_t n = keys.size() ;
+    const size_t n_blocks = std::min<size_t>(64, std::max<size_t>(1, n / 65536)) ;
+    const size_t block_size = ( n + n_blocks - 1 ) / n_blocks ;
+
+    vector<VoxelKey> tmp(n) ;
+    vector<size_t> hist(n_blocks * n_buckets) ;
+
+    for( uint shift = 0 ; shift < n_bits ; shift += digit_bits ) {
+        std::fill(hist.begin(), hist.end(), 0) ;
+
+#pragma omp parallel for
+        for( size_t b=0 ; b<n_blocks ; b++ ) {
+            size_t *h = &hist[b * n_buckets] ;
+            size_t first = std::min(b * block_size, n), last = std::min(first + block_size, n) ;
+            for( size_t i=first ; i<last ; i++ )
+                h[( keys[i].key_ >> shift ) & ( n_buckets - 1 )] ++ ;
+        }
+
+        size_t offset = 0 ;
+        for( uint d=0 ; d<n_buckets ; d++ ) {
+            for( size_t b=0 ; b<n_blocks ; b++ ) {
+                size_t &h = hist[b * n_buckets + d] ;
+                size_t count = h ;
+                h = offset ;
+                offset += count ;
+            }
+        }
+
+#pragma omp parallel for
+        for( size_t b=0 ; b<n_blocks ; b++ ) {
+            size_t *h = &hist[b * n_buckets] ;
+            size_t first = std::min(b * block_size, n), last = std::min(first + block_size, n) ;
+            for( size_t i=first ; i<last ; i++ )
+                tmp[h[( keys[i].key_ >> shift ) & ( n_buckets - 1 )]++] = keys[i] ;
+        }
+
+        keys.swap(tmp) ;
+    }
+}
+
+void VoxelGridFilter::filter(const PointList3f &cloud, PointList3f &res) const {
+    vector<float> attributes ;
+    filter(cloud, nullptr, 0, res, attributes) ;
+}
+
+void VoxelGridFilter::filter(const PointList3f &cloud, const float *attributes, uint n_attributes,
+                             PointList3f &res, vector<float> &res_attributes) const {
+    if ( !( params_.voxel_size_ > 0 ) )
+        throw std::invalid_argument("VoxelGridFilter: voxel size must be positive") ;
+
+    const size_t n = cloud.size() ;
+    const double inv_size = 1.0 / params_.voxel_size_ ;
+
+    res.clear() ;
+    res_attributes.clear() ;
+
+    // bounds of the finite points
+
+    float min_x = std::numeric_limits<float>::max(), min_y = min_x, min_z = min_x ;
+    float max_x = std::numeric_limits<float>::lowest(), max_y = max_x, max_z = max_x ;
+
+#pragma omp parallel for reduction(min:min_x,min_y,min_z) reduction(max:max_x,max_y,max_z)
+    for( size_t i=0 ; i<n ; i++ ) {
+        const Vector3f &p = cloud[i] ;
+        if ( !p.allFinite() ) continue ;
+        min_x = std::min(min_x, p.x()) ; max_x = std::max(max_x, p.x()) ;
+        min_y = std::min(min_y, p.y()) ; max_y = std::max(max_y, p.y()) ;
+        min_z = std::min(min_z, p.z()) ; max_z = std::max(max_z, p.z()) ;
+    }
+
+    if ( min_x > max_x ) return ;
+
+    // dense linear voxel index; non-finite points get the key n_voxels so that they are sorted last
+
+    // counts are checked in double before the conversion, which would overflow for a large extent or a tiny voxel
+    const double cx = std::floor(( (double)max_x - min_x ) * inv_size) + 1 ;
+    const double cy = std::floor(( (double)max_y - min_y ) * inv_size) + 1 ;
+    const double cz = std::floor(( (double)max_z - min_z ) * inv_size) + 1 ;
+
+    if ( cx * cy * cz >= std::ldexp(1.0, 62) )
+        throw std::range_error("VoxelGridFilter: too many voxels for the extent of the cloud") ;
+
+    const uint64_t nx = (uint64_t)cx, ny = (uint64_t)cy, nz = (uint64_t)cz ;
+
+    const uint64_t n_voxels = nx * ny * nz ;
+
+    uint n_bits = 1 ;
+    while ( ( n_voxels >> n_bits ) != 0 ) ++n_bits ;
+
+    vector<VoxelKey> keys(n) ;
+
+#pragma omp parallel for
+    for( size_t i=0 ; i<n ; i++ ) {
+        const Vector3f &p = cloud[i] ;
+        uint64_t key = n_voxels ;
+        if ( p.allFinite() ) {
+            uint64_t ix = std::min<uint64_t>(( p.x() - (double)min_x ) * inv_size, nx - 1) ;
+            uint64_t iy = std::min<uint64_t>(( p.y() - (double)min_y ) * inv_size, ny - 1) ;
+            uint64_t iz = std::min<uint64_t>(( p.z() - (double)min_z ) * inv_size, nz - 1) ;
+            key = ix + nx * ( iy + ny * iz ) ;
+        }
+        keys[i] = VoxelKey{key, (uint)i} ;
+    }
+
+    radixSort(keys, n_bits) ;
+
+    // runs of equal keys are the occupied voxels
+
+    vector<std::pair<size_t, size_t>> voxels ;
+
+    for( size_t i=0 ; i<n && keys[i].key_ != n_voxels ; ) {
+        size_t j = i + 1 ;
+        while ( j < n && keys[j].key_ == keys[i].key_ ) ++j ;
+        if ( j - i >= params_.min_points_ ) voxels.emplace_back(i, j) ;
+        i = j ;
+    }
+
+    res.resize(voxels.size()) ;
+    res_attributes.resize(voxels.size() * n_attributes) ;
+
+#pragma omp parallel for schedule(dynamic, 1024)
+    for( size_t v=0 ; v<voxels.size() ; v++ ) {
+        const size_t first = voxels[v].first, last = voxels[v].second ;
+        const float count = last - first ;
+
+        // the sort is stable so the first point of the voxel is the first one in input order
+        if ( params_.reduction_ == FirstHit )
+            res[v] = cloud[keys[first].idx_] ;
+        else {
+            Vector3d sum(0, 0, 0) ;
+            for( size_t i=first ; i<last ; i++ )
+                sum += cloud[keys[i].idx_].cast<double>() ;
+            Vector3f c = ( sum / count ).cast<float>() ;
+
+            if ( params_.reduction_ == Centroid )
+                res[v] = c ;
+            else {
+                float min_dist = std::numeric_limits<float>::max() ;
+                for( size_t i=first ; i<last ; i++ ) {
+                    const Vector3f &p = cloud[keys[i].idx_] ;
+                    float d = ( p - c ).squaredNorm() ;
+                    if ( d < min_dist ) {
+                        min_dist = d ;
+                        res[v] = p ;
+                    }
+                }
+            }
+        }
+
+        if ( n_attributes > 0 ) {
+            float *dst = &res_attributes[v * n_attributes] ;
+            std::fill(dst, dst + n_attributes, 0.0f) ;
+            for( size_t i=first ; i<last ; i++ ) {
+                const float *src = attributes + (size_t)keys[i].idx_ * n_attributes ;
+                for( uint a=0 ; a<n_attributes ; a++ ) dst[a] += src[a] ;
+            }
+            for( uint a=0 ; a<n_attributes ; a++ ) dst[a] /= count ;
+        }
+    }
+}
+
+}
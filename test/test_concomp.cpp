@@ -0,0 +1,187 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/imgproc/concomp.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+#include <climits>
+
+using namespace std ;
+using namespace cvx ;
+
+// random blobs: thresholded sum of a few random bumps plus salt noise
+static cv::Mat makeMask(int w, int h, RNG &rng) {
+    cv::Mat mask(h, w, CV_8UC1, cv::Scalar(0)) ;
+
+    for( int k=0 ; k<w*h/2000 ; k++ ) {
+        int cx = rng.uniform<float>() * w, cy = rng.uniform<float>() * h, r = 2 + rng.uniform<float>() * 20 ;
+        for( int y = std::max(0, cy - r) ; y < std::min(h, cy + r) ; y++ )
+            for( int x = std::max(0, cx - r) ; x < std::min(w, cx + r) ; x++ )
+                if ( ( x - cx ) * ( x - cx ) + ( y - cy ) * ( y - cy ) < r * r ) mask.at<uchar>(y, x) = 255 ;
+    }
+
+    for( int k=0 ; k<w*h/50 ; k++ )
+        mask.at<uchar>(rng.uniform<float>() * ( h - 1 ), rng.uniform<float>() * ( w - 1 )) = 255 ;
+
+    return mask ;
+}
+
+// flood fill labelling, components numbered in raster order of their first pixel
+static unsigned int referenceLabels(const cv::Mat &mask, cv::Mat &labels, int nc) {
+    const int w = mask.cols, h = mask.rows ;
+    labels = cv::Mat(h, w, CV_32SC1, cv::Scalar(INT_MAX)) ;
+
+    unsigned int count = 0 ;
+    vector<cv::Point> stack ;
+
+    for( int i=0 ; i<h ; i++ )
+        for( int j=0 ; j<w ; j++ ) {
+            if ( !mask.at<uchar>(i, j) || labels.at<int>(i, j) != INT_MAX ) continue ;
+
+            labels.at<int>(i, j) = count ;
+            stack.push_back(cv::Point(j, i)) ;
+
+            while ( !stack.empty() ) {
+                cv::Point p = stack.back() ; stack.pop_back() ;
+                for( int dy=-1 ; dy<=1 ; dy++ )
+                    for( int dx=-1 ; dx<=1 ; dx++ ) {
+                        if ( nc == 4 && dx != 0 && dy != 0 ) continue ;
+                        int x = p.x + dx, y = p.y + dy ;
+                        if ( x < 0 || y < 0 || x >= w || y >= h ) continue ;
+                        if ( !mask.at<uchar>(y, x) || labels.at<int>(y, x) != INT_MAX ) continue ;
+                        labels.at<int>(y, x) = count ;
+                        stack.push_back(cv::Point(x, y)) ;
+                    }
+            }
+            ++count ;
+        }
+
+    return count ;
+}
+
+static bool equal(const cv::Mat &a, const cv::Mat &b) {
+    for( int i=0 ; i<a.rows ; i++ )
+        for( int j=0 ; j<a.cols ; j++ )
+            if ( a.at<int>(i, j) != b.at<int>(i, j) ) return false ;
+    return true ;
+}
+
+static void testLabels(RNG &rng) {
+    // a diagonal touch joins regions only with 8-connectivity
+    cv::Mat small(3, 3, CV_8UC1, cv::Scalar(0)) ;
+    small.at<uchar>(0, 0) = small.at<uchar>(1, 1) = small.at<uchar>(2, 0) = 1 ;
+    cv::Mat labels ;
+    unsigned int n8 = connectedComponents(small, labels, 8) ;
+    assert( n8 == 1 ) ;
+    unsigned int n4 = connectedComponents(small, labels, 4) ;
+    assert( n4 == 3 && labels.at<int>(2, 0) == 2 && labels.at<int>(0, 1) == INT_MAX ) ;
+
+    // spans several strips
+    cv::Mat mask = makeMask(640, 1000, rng) ;
+    for( int nc: { 4, 8 } ) {
+        cv::Mat ref ;
+        unsigned int n_ref = referenceLabels(mask, ref, nc) ;
+        unsigned int n = connectedComponents(mask, labels, nc) ;
+        assert( n == n_ref && equal(labels, ref) ) ;
+    }
+}
+
+// statistics against brute force sums over the label image
+static void testStats(RNG &rng) {
+    cv::Mat mask = makeMask(300, 200, rng), labels ;
+    vector<RegionStats> stats ;
+    vector<RegionRun> runs ;
+
+    unsigned int n = connectedComponents(mask, labels, stats, 8, &runs) ;
+    assert( stats.size() == n ) ;
+
+    vector<double> area(n, 0), sx(n, 0), sy(n, 0), sxx(n, 0), sxy(n, 0), syy(n, 0) ;
+    vector<cv::Point> lo(n, cv::Point(INT_MAX, INT_MAX)), hi(n, cv::Point(-1, -1)) ;
+    for( int i=0 ; i<labels.rows ; i++ )
+        for( int j=0 ; j<labels.cols ; j++ ) {
+            int l = labels.at<int>(i, j) ;
+            if ( l == INT_MAX ) continue ;
+            area[l] ++ ; sx[l] += j ; sy[l] += i ; sxx[l] += j * j ; sxy[l] += i * j ; syy[l] += i * i ;
+            lo[l] = cv::Point(std::min(lo[l].x, j), std::min(lo[l].y, i)) ;
+            hi[l] = cv::Point(std::max(hi[l].x, j), std::max(hi[l].y, i)) ;
+        }
+
+    size_t run_pixels = 0 ;
+    for( unsigned int l=0 ; l<n ; l++ ) {
+        const RegionStats &r = stats[l] ;
+        double cx = sx[l] / area[l], cy = sy[l] / area[l] ;
+        assert( r.label_ == l && r.area_ == area[l] ) ;
+        assert( r.rect_ == cv::Rect(lo[l].x, lo[l].y, hi[l].x - lo[l].x + 1, hi[l].y - lo[l].y + 1) ) ;
+        assert( std::abs(r.centroid_.x - cx) < 1.0e-9 && std::abs(r.centroid_.y - cy) < 1.0e-9 ) ;
+        assert( std::abs(r.mu20_ - ( sxx[l] / area[l] - cx * cx )) < 1.0e-6 ) ;
+        assert( std::abs(r.mu11_ - ( sxy[l] / area[l] - cx * cy )) < 1.0e-6 ) ;
+        assert( std::abs(r.mu02_ - ( syy[l] / area[l] - cy * cy )) < 1.0e-6 ) ;
+
+        for( unsigned int k = r.first_run_ ; k < r.first_run_ + r.n_runs_ ; k++ ) {
+            const RegionRun &run = runs[k] ;
+            for( int x = run.x0_ ; x < run.x1_ ; x++ ) assert( labels.at<int>(run.y_, x) == (int)l ) ;
+            run_pixels += run.x1_ - run.x0_ ;
+        }
+    }
+    size_t total = 0 ;
+    for( double a: area ) total += a ;
+    assert( run_pixels == total ) ;
+
+    // the iterator over a label image gives the same regions
+    RegionIterator it(labels) ;
+    for( unsigned int l=0 ; l<n ; l++, ++it ) {
+        assert( it && it.label() == l && it.area() == stats[l].area_ && it.rect() == stats[l].rect_ ) ;
+        if ( l % 50 ) continue ;
+        cv::Mat m = it.mask() ;
+        for( int i=0 ; i<labels.rows ; i++ )
+            for( int j=0 ; j<labels.cols ; j++ )
+                assert( ( m.at<uchar>(i, j) != 0 ) == ( labels.at<int>(i, j) == (int)l ) ) ;
+    }
+    assert( !it ) ;
+
+    unsigned int max_area = 0 ;
+    for( const RegionStats &r: stats ) max_area = std::max(max_area, r.area_) ;
+    RegionIterator best = findLargestBlob(mask) ;
+    assert( best && best.area() == max_area ) ;
+    RegionIterator none = findLargestBlob(mask, max_area) ;
+    assert( !none ) ;
+
+    // arbitrary label values, e.g. watershed markers, come out by increasing label
+    cv::Mat markers(4, 6, CV_32SC1, cv::Scalar(INT_MAX)) ;
+    markers.at<int>(0, 0) = markers.at<int>(0, 1) = -1 ;
+    markers.at<int>(2, 3) = 2000000000 ;
+    markers.at<int>(3, 1) = markers.at<int>(3, 2) = markers.at<int>(1, 1) = 5 ;
+    RegionIterator mit(markers) ;
+    assert( mit && mit.label() == 5 && mit.area() == 3 && mit.rect() == cv::Rect(1, 1, 2, 3) ) ;
+    ++mit ;
+    assert( mit && mit.label() == 2000000000u && mit.area() == 1 ) ;
+    ++mit ;
+    assert( mit && mit.label() == 0xFFFFFFFFu && mit.area() == 2 && mit.rect() == cv::Rect(0, 0, 2, 1) ) ;
+    ++mit ;
+    assert( !mit ) ;
+}
+
+static void benchmark(RNG &rng) {
+    cv::Mat mask = makeMask(3840, 2160, rng), labels ;
+
+    Timer<> t ;
+    unsigned int n = connectedComponents(mask, labels) ;
+    t.stop() ;
+
+    Timer<> tb ;
+    RegionIterator it = findLargestBlob(mask) ;
+    tb.stop() ;
+
+    cout << "connected components (3840x2160): " << n << " regions in " << t.duration().count() << " ms, largest blob ("
+         << it.area() << " pixels) in " << tb.duration().count() << " ms" << endl ;
+}
+
+int main(int argc, char *argv[]) {
+    RNG rng(1) ;
+
+    testLabels(rng) ;
+    testStats(rng) ;
+    benchmark(rng) ;
+}
@@ -0,0 +1,204 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/imgproc/rgbd.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+// random depth in millimeters with 10% missing values
+static cv::Mat makeDepth(uint w, uint h, RNG &rng) {
+    cv::Mat depth(h, w, CV_16UC1) ;
+    for( uint i=0 ; i<h ; i++ )
+        for( uint j=0 ; j<w ; j++ )
+            depth.at<ushort>(i, j) = ( rng.uniform<float>() < 0.1 ) ? 0 : 500 + rng.uniform<float>() * 4000 ;
+    return depth ;
+}
+
+static Vector3f backProject(const PinholeCamera &cam, float x, float y, float z) {
+    return Vector3f((x - cam.cx()) * z / cam.fx(), (y - cam.cy()) * z / cam.fy(), z) ;
+}
+
+static void testFormats(const PinholeCamera &cam, const cv::Mat &depth) {
+    // 16bit in millimeters and float in meters give the same points
+    cv::Mat fdepth(depth.rows, depth.cols, CV_32FC1) ;
+    for( int i=0 ; i<depth.rows ; i++ )
+        for( int j=0 ; j<depth.cols ; j++ ) {
+            ushort z = depth.at<ushort>(i, j) ;
+            fdepth.at<float>(i, j) = ( z == 0 ) ? NAN : z * 0.001f ;
+        }
+
+    PointList3f a, b ;
+    depthToPointCloud(depth, cam, a, 3) ;
+    depthToPointCloud(fdepth, cam, b, 3) ;
+    assert( a.size() == b.size() ) ;
+
+    size_t k = 0 ;
+    for( int i=0 ; i<depth.rows ; i+=3 )
+        for( int j=0 ; j<depth.cols ; j+=3 ) {
+            ushort z = depth.at<ushort>(i, j) ;
+            if ( z == 0 ) continue ;
+            Vector3f p = backProject(cam, j, i, z * 0.001f) ;
+            assert( ( a[k] - p ).norm() < 1.0e-5 && ( b[k] - p ).norm() < 1.0e-5 ) ;
+            ++k ;
+        }
+    assert( k == a.size() ) ;
+
+    // points are appended, depth unit of 0.1 mm
+    depthToPointCloud(depth, cam, b, 3, 0.0001f) ;
+    assert( b.size() == 2 * a.size() && ( b[a.size()] - a[0] * 0.1f ).norm() < 1.0e-5 ) ;
+
+    PointList3f vertices ;
+    depthToVertexMap(fdepth, cam, vertices) ;
+    assert( std::isnan(vertices[0].z()) == ( depth.at<ushort>(0, 0) == 0 ) ) ;
+    assert( ( vertices[7 * depth.cols + 5] - backProject(cam, 5, 7, fdepth.at<float>(7, 5)) ).norm() < 1.0e-5 || depth.at<ushort>(7, 5) == 0 ) ;
+
+    OrganizedPointCloud cloud ;
+    depthToPointCloud(depth, cam, cloud) ;
+    PointList3f all ;
+    depthToPointCloud(depth, cam, all) ;
+    assert( cloud.countValid() == all.size() ) ;
+    for( uint i=0 ; i<cloud.height() ; i+=5 )
+        for( uint j=0 ; j<cloud.width() ; j+=5 ) {
+            assert( cloud.isValid(j, i) == ( depth.at<ushort>(i, j) != 0 ) ) ;
+            if ( cloud.isValid(j, i) ) assert( ( cloud.point(j, i) - vertices[i * depth.cols + j] ).norm() < 1.0e-5 ) ;
+        }
+}
+
+// with lens distortion points lie on the rays given by the camera's undistortion
+static void testDistortion(const cv::Mat &depth) {
+    cv::Mat dist(5, 1, CV_64F) ;
+    const double k[] = { -0.2, 0.05, 0.001, -0.002, 0 } ;
+    for( int i=0 ; i<5 ; i++ ) dist.at<double>(i, 0) = k[i] ;
+
+    PinholeCamera cam(900, 900, 639.5, 359.5, cv::Size(1280, 720), dist) ;
+
+    Timer<> t ;
+    cam.rayMapX() ;
+    t.stop() ;
+
+    OrganizedPointCloud cloud ;
+    Timer<> tc ;
+    depthToPointCloud(depth, cam, cloud) ;
+    tc.stop() ;
+
+    cout << "distorted: ray maps " << t.duration().count() << " ms (once), organized " << tc.duration().count() << " ms" << endl ;
+
+    for( uint i=0 ; i<cloud.height() ; i+=37 )
+        for( uint j=0 ; j<cloud.width() ; j+=37 ) {
+            if ( !cloud.isValid(j, i) ) continue ;
+            Vector3f p = cam.backProject(j, i, depth.at<ushort>(i, j) * 0.001f) ;
+            assert( ( cloud.point(j, i) - p ).norm() < 1.0e-4 ) ;
+        }
+
+    PointList3f coords ;
+    depthToPointCloud(depth, cam, coords, 4) ;
+    assert( depth.at<ushort>(0, 0) == 0 || ( coords[0] - cam.backProject(0, 0, depth.at<ushort>(0, 0) * 0.001f) ).norm() < 1.0e-4 ) ;
+
+    // the cached ray maps are not used when the camera size differs from that of the depth image
+    PinholeCamera other(900, 900, 639.5, 359.5, cv::Size(640, 360), dist) ;
+    depthToPointCloud(depth, other, cloud) ;
+    for( uint i=0 ; i<cloud.height() ; i+=37 )
+        for( uint j=0 ; j<cloud.width() ; j+=37 ) {
+            if ( !cloud.isValid(j, i) ) continue ;
+            Vector3f p = other.backProject(j, i, depth.at<ushort>(i, j) * 0.001f) ;
+            assert( ( cloud.point(j, i) - p ).norm() < 1.0e-4 ) ;
+        }
+
+    // the camera keeps its own copy of the coefficients
+    dist.at<double>(0, 0) = 0 ;
+    cam.getDistortion().at<double>(1, 0) = 0 ;
+    assert( cam.hasDistortion() && cam.getDistortion().at<double>(0, 0) == k[0] && cam.getDistortion().at<double>(1, 0) == k[1] ) ;
+}
+
+// batch sampling agrees with the per point functions; the window follows ws on every call
+static void testSampling(const cv::Mat &depth, RNG &rng) {
+    cv::Mat sparse(20, 20, CV_16UC1, cv::Scalar(0)) ;
+    sparse.at<ushort>(10, 13) = 700 ;
+    ushort uz ;
+    bool found = sampleNearestNonZeroDepth(sparse, 10, 10, uz, 1) ;
+    assert( !found ) ;
+    found = sampleNearestNonZeroDepth(sparse, 10, 10, uz, 3) ;
+    assert( found && uz == 700 ) ;
+
+    const size_t n = 50000 ;
+    vector<cv::Point2f> pts(n) ;
+    vector<cv::Point> ipts(n) ;
+    for( size_t i=0 ; i<n ; i++ ) {
+        pts[i] = cv::Point2f(rng.uniform<float>() * ( depth.cols + 4 ) - 2, rng.uniform<float>() * ( depth.rows + 4 ) - 2) ;
+        ipts[i] = cv::Point(pts[i].x, pts[i].y) ;
+    }
+
+    vector<float> z ;
+    vector<uchar> valid ;
+
+    Timer<> t ;
+    sampleBilinearDepth(depth, pts, z, valid, 2) ;
+    t.stop() ;
+
+    Timer<> ts ;
+    size_t n_valid = 0 ;
+    for( size_t i=0 ; i<n ; i++ ) {
+        float zi = 0 ;
+        bool v = sampleBilinearDepth(depth, pts[i].x, pts[i].y, zi, 2) ;
+        assert( v == (bool)valid[i] && ( !v || zi == z[i] ) ) ;
+        n_valid += v ;
+    }
+    ts.stop() ;
+
+    vector<ushort> uzs ;
+    sampleNearestNonZeroDepth(depth, ipts, uzs, valid, 2) ;
+    for( size_t i=0 ; i<n ; i+=97 ) {
+        bool v = sampleNearestNonZeroDepth(depth, ipts[i].x, ipts[i].y, uz, 2) ;
+        assert( v == (bool)valid[i] && ( !v || uz == uzs[i] ) ) ;
+    }
+
+    cout << "bilinear sampling of " << n << " points (" << n_valid << " valid): batch " << t.duration().count()
+         << " ms, per point " << ts.duration().count() << " ms" << endl ;
+}
+
+// per frame cost at 1280x720
+static void benchmark(const PinholeCamera &cam, const cv::Mat &depth) {
+    const uint n_frames = 30 ;
+
+    PointList3f coords ;
+    Timer<> t ;
+    for( uint i=0 ; i<n_frames ; i++ ) {
+        coords.clear() ;
+        depthToPointCloud(depth, cam, coords) ;
+    }
+    t.stop() ;
+
+    PointList3f vertices ;
+    Timer<> tv ;
+    for( uint i=0 ; i<n_frames ; i++ ) depthToVertexMap(depth, cam, vertices) ;
+    tv.stop() ;
+
+    OrganizedPointCloud cloud ;
+    Timer<> to ;
+    for( uint i=0 ; i<n_frames ; i++ ) depthToPointCloud(depth, cam, cloud) ;
+    to.stop() ;
+
+    cout << "per frame: point cloud " << t.duration().count() / (float)n_frames << " ms, vertex map "
+         << tv.duration().count() / (float)n_frames << " ms, organized " << to.duration().count() / (float)n_frames << " ms" << endl ;
+}
+
+int main(int argc, char *argv[]) {
+    RNG rng(1) ;
+    PinholeCamera cam(900, 900, 639.5, 359.5, cv::Size(1280, 720), cv::Mat()) ;
+
+    cv::Mat depth = makeDepth(1280, 720, rng) ;
+
+    testFormats(cam, depth) ;
+
+    testDistortion(depth) ;
+
+    testSampling(depth, rng) ;
+
+    benchmark(cam, depth) ;
+}
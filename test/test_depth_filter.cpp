@@ -0,0 +1,177 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/imgproc/depth_filter.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+
+// Synthetic sequence: a sphere moving in front of a wall at 2m. Depth is in millimeters with gaussian noise and small
+// holes; the guide image is red on the sphere and gray on the wall.
+
+struct Frame {
+    cv::Mat depth_, truth_, guide_ ;
+} ;
+
+static Frame makeFrame(uint w, uint h, uint t, float noise, float hole_rate, RNG &rng) {
+    Frame f ;
+    f.depth_ = cv::Mat(h, w, CV_16UC1) ;
+    f.truth_ = cv::Mat(h, w, CV_16UC1) ;
+    f.guide_ = cv::Mat(h, w, CV_8UC3) ;
+
+    const float cx = w * ( 0.3f + 0.01f * t ), cy = h * 0.5f, radius = h * 0.25f ;
+
+    for( uint i=0 ; i<h ; i++ )
+        for( uint j=0 ; j<w ; j++ ) {
+            float dx = j - cx, dy = i - cy, r2 = dx * dx + dy * dy ;
+            bool sphere = r2 < radius * radius ;
+            float z = sphere ? 1200 - 400 * sqrt(1 - r2 / ( radius * radius )) : 2000 ;
+
+            f.truth_.at<ushort>(i, j) = z ;
+            f.guide_.at<cv::Vec3b>(i, j) = sphere ? cv::Vec3b(0, 0, 200) : cv::Vec3b(128, 128, 128) ;
+
+            if ( rng.uniform<float>() < hole_rate ) f.depth_.at<ushort>(i, j) = 0 ;
+            else f.depth_.at<ushort>(i, j) = std::max(1.0f, z + noise * (float)rng.gaussian()) ;
+        }
+    return f ;
+}
+
+// mean absolute error over pixels that are valid in depth
+static float meanError(const cv::Mat &depth, const cv::Mat &truth) {
+    double sum = 0 ; size_t n = 0 ;
+    for( int i=0 ; i<depth.rows ; i++ )
+        for( int j=0 ; j<depth.cols ; j++ ) {
+            ushort z = depth.at<ushort>(i, j) ;
+            if ( z == 0 ) continue ;
+            sum += std::abs((int)z - (int)truth.at<ushort>(i, j)) ;
+            ++n ;
+        }
+    return sum / n ;
+}
+
+static size_t countHoles(const cv::Mat &depth) {
+    size_t n = 0 ;
+    for( int i=0 ; i<depth.rows ; i++ )
+        for( int j=0 ; j<depth.cols ; j++ )
+            n += depth.at<ushort>(i, j) == 0 ;
+    return n ;
+}
+
+static void testHoleFilling() {
+    cv::Mat depth(1, 16, CV_16UC1, cv::Scalar(0)) ;
+    ushort *p = depth.ptr<ushort>(0) ;
+    p[0] = 1000 ; p[4] = 1040 ;     // short gap, interpolated
+    p[6] = 1000 ; p[8] = 2000 ;     // discontinuity, filled with the far depth
+                                    // 9..15 open ended, left empty
+
+    cv::Mat res ;
+    DepthHoleFilling().apply(depth, res) ;
+    const ushort *q = res.ptr<ushort>(0) ;
+    assert( q[1] == 1010 && q[2] == 1020 && q[3] == 1030 ) ;
+    assert( q[5] == 1020 && q[7] == 2000 && q[12] == 0 ) ;
+
+    DepthHoleFilling::Parameters params ;
+    params.max_hole_size_ = 2 ;
+    DepthHoleFilling(params).apply(depth, res) ;
+    assert( res.at<ushort>(0, 2) == 0 && res.at<ushort>(0, 7) == 2000 ) ;
+
+    // columns
+    cv::Mat col(5, 3, CV_16UC1, cv::Scalar(0)) ;
+    col.at<ushort>(0, 1) = 500 ; col.at<ushort>(4, 1) = 540 ;
+    DepthHoleFilling().apply(col, res) ;
+    assert( res.at<ushort>(2, 1) == 520 && res.at<ushort>(2, 0) == 0 ) ;
+}
+
+static void testTemporal() {
+    RNG rng(2) ;
+    TemporalDepthFilter filter ;
+    cv::Mat res ;
+
+    // static wall: noise goes down
+    for( uint t=0 ; t<10 ; t++ ) {
+        Frame f = makeFrame(101, 40, 0, 10, 0, rng) ;
+        f.truth_.setTo(cv::Scalar(2000)) ;
+        f.depth_ = f.truth_.clone() ;
+        for( int i=0 ; i<40 ; i++ )
+            for( int j=0 ; j<101 ; j++ ) f.depth_.at<ushort>(i, j) += 10 * rng.gaussian() ;
+        filter.apply(f.depth_, res) ;
+        if ( t == 9 ) assert( meanError(res, f.truth_) < 0.6 * meanError(f.depth_, f.truth_) ) ;
+    }
+
+    // a jump restarts, missing depth clears (odd width so that both vector and scalar paths run)
+    cv::Mat jump(40, 101, CV_16UC1, cv::Scalar(1500)) ;
+    jump.at<ushort>(3, 100) = 0 ;
+    filter.apply(jump, res) ;
+    assert( res.at<ushort>(0, 0) == 1500 && res.at<ushort>(5, 100) == 1500 && res.at<ushort>(3, 100) == 0 ) ;
+}
+
+static void testUpsampling(RNG &rng) {
+    Frame f = makeFrame(640, 480, 0, 0, 0, rng) ;
+
+    // 4x subsampled depth and its nearest neighbour upsampling
+    cv::Mat low(120, 160, CV_16UC1), nearest(480, 640, CV_16UC1) ;
+    for( int i=0 ; i<120 ; i++ )
+        for( int j=0 ; j<160 ; j++ ) low.at<ushort>(i, j) = f.truth_.at<ushort>(4 * i + 2, 4 * j + 2) ;
+    for( int i=0 ; i<480 ; i++ )
+        for( int j=0 ; j<640 ; j++ ) nearest.at<ushort>(i, j) = low.at<ushort>(i / 4, j / 4) ;
+
+    cv::Mat res ;
+    JointBilateralUpsampling jbu ;
+    Timer<> t ;
+    jbu.apply(low, f.guide_, res) ;
+    t.stop() ;
+
+    float e_nearest = meanError(nearest, f.truth_), e_jbu = meanError(res, f.truth_) ;
+    cout << "joint bilateral upsampling: " << t.duration().count() << " ms, error " << e_jbu << " mm (nearest " << e_nearest << " mm)" << endl ;
+    assert( e_jbu < e_nearest ) ;
+}
+
+// per frame cost of the filter chain on a 640x480 sequence
+static void benchmark(uint n_frames, RNG &rng) {
+    vector<Frame> frames ;
+    for( uint t=0 ; t<n_frames ; t++ ) frames.push_back(makeFrame(640, 480, t, 8, 0.05, rng)) ;
+
+    DepthHoleFilling filling ;
+    TemporalDepthFilter temporal ;
+
+    double t_fill = 0, t_temporal = 0, e_raw = 0, e_res = 0 ;
+    size_t holes_raw = 0, holes_res = 0 ;
+
+    for( const Frame &f: frames ) {
+        cv::Mat filled, smoothed ;
+
+        Timer<> t1 ;
+        filling.apply(f.depth_, filled) ;
+        t1.stop() ;
+
+        Timer<> t2 ;
+        temporal.apply(filled, smoothed) ;
+        t2.stop() ;
+
+        t_fill += t1.duration().count() ;
+        t_temporal += t2.duration().count() ;
+        e_raw += meanError(f.depth_, f.truth_) ;
+        e_res += meanError(smoothed, f.truth_) ;
+        holes_raw += countHoles(f.depth_) ;
+        holes_res += countHoles(smoothed) ;
+    }
+
+    cout << "per frame: hole filling " << t_fill / n_frames << " ms, temporal " << t_temporal / n_frames << " ms" << endl ;
+    cout << "holes " << holes_raw / n_frames << " -> " << holes_res / n_frames << ", error " << e_raw / n_frames << " -> " << e_res / n_frames << " mm" << endl ;
+    assert( holes_res < holes_raw / 10 ) ;
+}
+
+int main(int argc, char *argv[]) {
+    uint n_frames = ( argc > 1 ) ? atoi(argv[1]) : 30 ;
+
+    RNG rng(1) ;
+
+    testHoleFilling() ;
+    testTemporal() ;
+    testUpsampling(rng) ;
+    benchmark(n_frames, rng) ;
+}
@@ -0,0 +1,71 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/imgproc/rgbd.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+
+int main(int argc, char *argv[]) {
+    RNG rng(1) ;
+
+    cv::Mat depth(720, 1280, CV_16UC1) ;
+    for( int i=0 ; i<depth.rows ; i++ )
+        for( int j=0 ; j<depth.cols ; j++ )
+            depth.at<ushort>(i, j) = ( rng.uniform<float>() < 0.1 ) ? 0 : 500 + j * 3 ;
+
+    depth.at<ushort>(0, 0) = 500 ; depth.at<ushort>(0, 1) = 500 + 1279 * 3 ;
+
+    // gray: nearest is black-ish, farthest white, missing black
+    DepthVisualizer::Parameters params ;
+    params.colormap_ = DepthVisualizer::Gray ;
+
+    cv::Mat res ;
+    DepthVisualizer(params).apply(depth, res) ;
+    assert( res.at<cv::Vec3b>(0, 0)[0] == 0 && res.at<cv::Vec3b>(0, 1)[0] == 255 ) ;
+    depth.at<ushort>(1, 1) = 0 ;
+    DepthVisualizer(params).apply(depth, res) ;
+    assert( res.at<cv::Vec3b>(1, 1)[1] == 0 ) ;
+
+    // values outside a fixed range are clamped
+    params.min_depth_ = 1000 ; params.max_depth_ = 2000 ;
+    DepthVisualizer(params).apply(depth, res) ;
+    assert( res.at<cv::Vec3b>(0, 0)[0] == 0 && res.at<cv::Vec3b>(0, 1)[0] == 255 ) ;
+
+    // the output buffer is reused
+    const uchar *data = res.data ;
+    DepthVisualizer(params).apply(depth, res) ;
+    assert( res.data == data ) ;
+
+    // hue map of depthViz in RGB order: near is red
+    cv::Mat viz = depthViz(depth) ;
+    cv::Vec3b near = viz.at<cv::Vec3b>(0, 0) ;
+    assert( near[0] == 255 && near[2] == 0 ) ;
+
+    // the visualizer gives the same colours in BGR order
+    DepthVisualizer().apply(depth, res) ;
+    for( int i=0 ; i<depth.rows ; i+=7 )
+        for( int j=0 ; j<depth.cols ; j+=7 ) {
+            cv::Vec3b c = viz.at<cv::Vec3b>(i, j), d = res.at<cv::Vec3b>(i, j) ;
+            assert( c[0] == d[2] && c[1] == d[1] && c[2] == d[0] ) ;
+        }
+
+    const char *names[] = { "hue", "jet", "gray", "turbo" } ;
+    const uint n_frames = 60 ;
+
+    for( int c = DepthVisualizer::Hue ; c <= DepthVisualizer::Turbo ; c++ ) {
+        DepthVisualizer::Parameters p ;
+        p.colormap_ = (DepthVisualizer::ColorMap)c ;
+        DepthVisualizer viz(p) ;
+
+        Timer<> t ;
+        for( uint i=0 ; i<n_frames ; i++ ) viz.apply(depth, res) ;
+        t.stop() ;
+
+        cout << names[c] << ": " << t.duration().count() / (float)n_frames << " ms per 1280x720 frame" << endl ;
+    }
+}
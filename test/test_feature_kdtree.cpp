@@ -0,0 +1,161 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/ml/kdtree.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+typedef Matrix<float, Dynamic, Dynamic, RowMajor> Descriptors ;
+
+// descriptors of low intrinsic dimension embedded in dim dimensions, closer to real features (e.g. Gabor responses)
+// than uniform noise
+static Descriptors makeDescriptors(size_t n, size_t dim, RNG &rng) {
+    const uint latent = 8 ;
+    Descriptors basis(latent, dim), data(n, dim) ;
+    for( uint c=0 ; c<latent ; c++ )
+        for( size_t j=0 ; j<dim ; j++ ) basis(c, j) = (float)rng.gaussian() ;
+
+    for( size_t i=0 ; i<n ; i++ ) {
+        RowVectorXf z(latent) ;
+        for( uint c=0 ; c<latent ; c++ ) z[c] = (float)rng.gaussian() ;
+        data.row(i) = z * basis ;
+        for( size_t j=0 ; j<dim ; j++ ) data(i, j) += 0.01f * (float)rng.gaussian() ;
+    }
+    return data ;
+}
+
+template <typename Metric>
+static void bruteForce(const Descriptors &data, const float *q, uint k, vector<uint> &indices) {
+    vector<pair<float, uint>> d(data.rows()) ;
+    for( size_t i=0 ; i<(size_t)data.rows() ; i++ )
+        d[i] = make_pair(Metric::distance(q, data.row(i).data(), data.cols(), std::numeric_limits<float>::max()), i) ;
+    std::partial_sort(d.begin(), d.begin() + k, d.end()) ;
+    indices.resize(k) ;
+    for( uint i=0 ; i<k ; i++ ) indices[i] = d[i].second ;
+}
+
+// exact search with both metrics and with a fixed dimension against exhaustive search
+
+static void testExact(const Descriptors &data, const Descriptors &queries) {
+    const uint k = 5 ;
+    typedef FeatureKDTree<float>::map_t map_t ;
+    map_t m(data.data(), data.rows(), data.cols()) ;
+
+    FeatureKDTree<float> l2 ;
+    l2.train(m) ;
+
+    FeatureKDTree<float, Dynamic, L1Metric<float>> l1 ;
+    l1.train(data.data(), data.rows(), data.cols()) ;
+
+    FeatureKDTree<float, 32> fixed ;
+    fixed.train(data.data(), data.rows(), data.cols()) ;
+
+    for( size_t i=0 ; i<(size_t)queries.rows() ; i += 7 ) {
+        const float *q = queries.row(i).data() ;
+        vector<uint> truth, indices ;
+        vector<float> distances ;
+
+        bruteForce<L2Metric<float>>(data, q, k, truth) ;
+        l2.knearest(q, k, indices, distances) ;
+        assert( indices == truth ) ;
+        fixed.knearest(q, k, indices, distances) ;
+        assert( indices == truth ) ;
+
+        bruteForce<L1Metric<float>>(data, q, k, truth) ;
+        l1.knearest(q, k, indices, distances) ;
+        assert( indices == truth ) ;
+    }
+}
+
+// samples of a MatDataset
+
+class TestDataset: public MatDataset<float, int> {
+public:
+    TestDataset(const Descriptors &data) {
+        data_ = data ;
+        targets_.assign(data.rows(), 0) ;
+        labels_.push_back(0) ;
+    }
+} ;
+
+static void testDataset(const Descriptors &data) {
+    TestDataset ds(data) ;
+    FeatureKDTree<float> tree ;
+    tree.train(ds) ;
+    assert( tree.size() == ds.size() && tree.dimensions() == ds.dimensions() ) ;
+
+    for( size_t i=0 ; i<(size_t)data.rows() ; i += 101 ) {
+        uint idx ;
+        float dist ;
+        tree.knearest(data.row(i).data(), 1, &idx, &dist) ;
+        assert( dist == 0 ) ;
+    }
+}
+
+// recall of the nearest neighbour versus throughput of batched queries for several trees/checks settings
+
+static void benchmarkRecall(const Descriptors &data, const Descriptors &queries) {
+    typedef FeatureKDTree<float>::map_t map_t ;
+    map_t m(data.data(), data.rows(), data.cols()), mq(queries.data(), queries.rows(), queries.cols()) ;
+
+    const uint k = 2 ;
+    vector<uint> truth, indices ;
+    vector<float> distances ;
+
+    {
+        FeatureKDTree<float> exact ;
+        exact.train(m) ;
+        Timer<> t ;
+        exact.knearest(mq, k, truth, distances) ;
+        t.stop() ;
+        cout << "exact: " << t.duration().count() << " ms" << endl ;
+    }
+
+    struct Setting { uint n_trees_, max_checks_ ; } ;
+    const Setting settings[] = { {1, 256}, {4, 64}, {4, 256}, {4, 1024}, {8, 256}, {8, 1024} } ;
+
+    cout << "trees checks recall ms" << endl ;
+    for( const Setting &setting: settings ) {
+        FeatureKDTree<float>::Parameters params ;
+        params.n_trees_ = setting.n_trees_ ;
+        params.max_checks_ = setting.max_checks_ ;
+
+        FeatureKDTree<float> tree(params) ;
+        tree.train(m) ;
+
+        Timer<> t ;
+        tree.knearest(mq, k, indices, distances) ;
+        t.stop() ;
+
+        size_t n_correct = 0 ;
+        for( size_t i=0 ; i<(size_t)queries.rows() ; i++ )
+            if ( indices[i * k] == truth[i * k] ) ++n_correct ;
+
+        cout << setting.n_trees_ << ' ' << setting.max_checks_ << ' ' << n_correct/(double)queries.rows() << ' ' << t.duration().count() << endl ;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = ( argc > 1 ) ? atoi(argv[1]) : 100000 ;
+
+    RNG rng(1) ;
+
+    Descriptors small = makeDescriptors(5000, 32, rng) ;
+    testExact(small, makeDescriptors(500, 32, rng)) ;
+    testDataset(small) ;
+
+    // queries are perturbed samples, as when matching descriptors of overlapping images
+    Descriptors data = makeDescriptors(n, 128, rng) ;
+    Descriptors queries(n/10, 128) ;
+    for( size_t i=0 ; i<(size_t)queries.rows() ; i++ ) {
+        queries.row(i) = data.row(rng.uniform<int>(0, n - 1)) ;
+        for( size_t j=0 ; j<128 ; j++ ) queries(i, j) += 0.05f * (float)rng.gaussian() ;
+    }
+    benchmarkRecall(data, queries) ;
+}
@@ -0,0 +1,178 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/imgproc/gabor.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+
+static cv::Mat makeImage(int w, int h, RNG &rng) {
+    cv::Mat img(h, w, CV_8UC1) ;
+    for( int i=0 ; i<h ; i++ )
+        for( int j=0 ; j<w ; j++ )
+            img.at<uchar>(i, j) = 128 + 60 * sin(0.7 * j + 0.3 * i) + 60 * ( rng.uniform<float>() - 0.5 ) ;
+    return img ;
+}
+
+// spatial filtering of each kernel pair followed by magnitude and min/max normalisation
+static void referenceResponses(const cv::Mat &src, const vector<cv::Mat> &kernels, vector<cv::Mat> &responses, bool normalize = true) {
+    responses.resize(kernels.size()/2) ;
+    for( size_t k=0 ; k<kernels.size() ; k+=2 ) {
+        cv::Mat re, im, mag(src.size(), CV_32F) ;
+        cv::filter2D(src, re, CV_32F, kernels[k]) ;
+        cv::filter2D(src, im, CV_32F, kernels[k+1]) ;
+
+        float mn = std::numeric_limits<float>::max(), mx = 0 ;
+        for( int i=0 ; i<src.rows ; i++ )
+            for( int j=0 ; j<src.cols ; j++ ) {
+                float m = sqrt(re.at<float>(i, j) * re.at<float>(i, j) + im.at<float>(i, j) * im.at<float>(i, j)) ;
+                mag.at<float>(i, j) = m ;
+                mn = std::min(mn, m) ; mx = std::max(mx, m) ;
+            }
+        if ( !normalize ) mn = 0, mx = 1 ;
+        for( int i=0 ; i<src.rows ; i++ )
+            for( int j=0 ; j<src.cols ; j++ )
+                mag.at<float>(i, j) = ( mag.at<float>(i, j) - mn ) / ( mx - mn ) ;
+        responses[k/2] = mag ;
+    }
+}
+
+static void testResponses(RNG &rng) {
+    GaborFilterBank bank(2, 4, 2 * M_PI) ;
+    assert( bank.size() == 8 ) ;
+
+    cv::Mat img = makeImage(48, 40, rng) ;
+
+    vector<cv::Mat> ref, res ;
+    referenceResponses(img, bank.kernels(), ref) ;
+    bank.apply(img, res) ;
+
+    assert( res.size() == ref.size() ) ;
+    for( size_t k=0 ; k<res.size() ; k++ ) {
+        assert( res[k].size() == img.size() && res[k].type() == CV_32FC1 ) ;
+        for( int i=0 ; i<img.rows ; i++ )
+            for( int j=0 ; j<img.cols ; j++ )
+                assert( std::abs(res[k].at<float>(i, j) - ref[k].at<float>(i, j)) < 1.0e-3 ) ;
+    }
+
+    // the cached spectra are used for the next frame and the responses are written in place
+    const uchar *data = res[0].data ;
+    img = makeImage(48, 40, rng) ;
+    referenceResponses(img, bank.kernels(), ref) ;
+    bank.apply(img, res) ;
+    assert( res[0].data == data ) ;
+    for( int i=0 ; i<img.rows ; i++ )
+        for( int j=0 ; j<img.cols ; j++ )
+            assert( std::abs(res[3].at<float>(i, j) - ref[3].at<float>(i, j)) < 1.0e-3 ) ;
+
+    // a new image size recomputes them
+    img = makeImage(33, 27, rng) ;
+    referenceResponses(img, bank.kernels(), ref) ;
+    bank.apply(img, res) ;
+    for( int i=0 ; i<img.rows ; i++ )
+        for( int j=0 ; j<img.cols ; j++ )
+            assert( std::abs(res[5].at<float>(i, j) - ref[5].at<float>(i, j)) < 1.0e-3 ) ;
+}
+
+static void testFeatures(RNG &rng) {
+    vector<cv::Mat> kernels ;
+    makeGaborFilterBank(2, 3, 2 * M_PI, kernels) ;
+    const int K = kernels.size() / 2 ;
+
+    cv::Mat img = makeImage(50, 37, rng) ;
+    vector<cv::Mat> ref, raw ;
+    referenceResponses(img, kernels, ref) ;
+    referenceResponses(img, kernels, raw, false) ;
+
+    // per pixel, tiles smaller than the kernels and partial tiles on the border
+    GaborFeatureExtractor::Parameters params ;
+    params.tile_size_ = 16 ;
+    GaborFeatureExtractor fe(kernels, params) ;
+
+    cv::Mat features ;
+    fe.compute(img, features) ;
+    assert( features.rows == img.rows && features.cols == img.cols && features.channels() == K ) ;
+    for( int i=0 ; i<img.rows ; i++ )
+        for( int j=0 ; j<img.cols ; j++ )
+            for( int k=0 ; k<K ; k++ )
+                assert( std::abs(features.ptr<float>(i)[j * K + k] - ref[k].at<float>(i, j)) < 1.0e-3 ) ;
+
+    // straight into the sample matrix of a dataset
+    MatDataset<float, int> ds ;
+    fe.compute(img, ds) ;
+    assert( ds.size() == img.total() && ds.dimensions() == (uint32_t)K ) ;
+    for( int i=0 ; i<img.rows ; i++ )
+        for( int j=0 ; j<img.cols ; j++ )
+            for( int k=0 ; k<K ; k++ )
+                assert( ds.getSampleCoordinate(i * img.cols + j, k) == features.ptr<float>(i)[j * K + k] ) ;
+
+    // cells of 4x4 pixels, tile size rounded up to whole cells
+    params.tile_size_ = 10 ;
+    params.cell_size_ = 4 ;
+    params.normalization_ = GaborFeatureExtractor::None ;
+    GaborFeatureExtractor pooled(kernels, params) ;
+    pooled.compute(img, features) ;
+    assert( features.rows == 10 && features.cols == 13 ) ;
+    for( int gy=0 ; gy<features.rows ; gy++ )
+        for( int gx=0 ; gx<features.cols ; gx++ )
+            for( int k=0 ; k<K ; k++ ) {
+                double sum = 0 ; int n = 0 ;
+                for( int i = gy * 4 ; i < std::min(img.rows, gy * 4 + 4) ; i++ )
+                    for( int j = gx * 4 ; j < std::min(img.cols, gx * 4 + 4) ; j++, n++ )
+                        sum += raw[k].at<float>(i, j) ;
+                assert( std::abs(features.ptr<float>(gy)[gx * K + k] - sum / n) < 1.0e-3 * ( 1 + sum / n ) ) ;
+            }
+
+    // unit feature vectors
+    params.normalization_ = GaborFeatureExtractor::L2 ;
+    GaborFeatureExtractor(kernels, params).compute(img, features) ;
+    for( int gy=0 ; gy<features.rows ; gy++ )
+        for( int gx=0 ; gx<features.cols ; gx++ ) {
+            double n2 = 0 ;
+            for( int k=0 ; k<K ; k++ ) n2 += features.ptr<float>(gy)[gx * K + k] * features.ptr<float>(gy)[gx * K + k] ;
+            assert( std::abs(n2 - 1) < 1.0e-4 ) ;
+        }
+}
+
+static void benchmark(RNG &rng) {
+    GaborFilterBank bank(3, 8, 2 * M_PI) ;
+    cv::Mat img = makeImage(640, 480, rng) ;
+    vector<cv::Mat> res ;
+
+    Timer<> tr ;
+    referenceResponses(img, bank.kernels(), res) ;
+    tr.stop() ;
+
+    bank.apply(img, res) ;
+
+    const uint n_frames = 10 ;
+    Timer<> t ;
+    for( uint i=0 ; i<n_frames ; i++ ) bank.apply(img, res) ;
+    t.stop() ;
+
+    cout << "gabor bank (" << bank.size() << " pairs, 640x480): spatial " << tr.duration().count() << " ms, fft "
+         << t.duration().count() / (float)n_frames << " ms per frame" << endl ;
+
+    cv::Mat big = makeImage(4000, 3000, rng), features ;
+    GaborFeatureExtractor::Parameters params ;
+    params.cell_size_ = 8 ;
+    GaborFeatureExtractor fe(bank.kernels(), params) ;
+
+    Timer<> tf ;
+    fe.compute(big, features) ;
+    tf.stop() ;
+
+    cout << "pooled gabor features (4000x3000, 8x8 cells): " << tf.duration().count() << " ms" << endl ;
+}
+
+int main(int argc, char *argv[]) {
+    RNG rng(1) ;
+
+    testResponses(rng) ;
+    testFeatures(rng) ;
+    benchmark(rng) ;
+}
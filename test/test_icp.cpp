@@ -0,0 +1,204 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/pcl/icp.hpp>
+#include <cvx/pcl/normals.hpp>
+#include <cvx/camera/camera.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+// points on a few planes and a sphere, some structure for the registration to lock onto
+static PointList3f makeScan(size_t n, RNG &rng) {
+    PointList3f cloud(n) ;
+    for( size_t i=0 ; i<n ; i++ ) {
+        float u = rng.uniform<float>(), v = rng.uniform<float>() ;
+        switch ( i % 4 ) {
+        case 0: cloud[i] = Vector3f(u, v, 0) ; break ;
+        case 1: cloud[i] = Vector3f(0, u, v) ; break ;
+        case 2: cloud[i] = Vector3f(u, 0, v) ; break ;
+        default: {
+            Vector3f p(rng.gaussian(), rng.gaussian(), rng.gaussian()) ;
+            cloud[i] = Vector3f(0.5, 0.5, 0.5) + 0.2f * p.normalized() ;
+        }
+        }
+        cloud[i] += 0.001f * Vector3f(rng.gaussian(), rng.gaussian(), rng.gaussian()) ;
+    }
+    return cloud ;
+}
+
+static Isometry3f makePose(float angle, const Vector3f &axis, const Vector3f &t) {
+    Isometry3f pose = Isometry3f::Identity() ;
+    pose.linear() = AngleAxisf(angle, axis.normalized()).toRotationMatrix() ;
+    pose.translation() = t ;
+    return pose ;
+}
+
+static float poseError(const Isometry3f &a, const Isometry3f &b) {
+    return ( a.matrix() - b.matrix() ).norm() ;
+}
+
+// source is the target moved by the inverse of a known pose, which ICP should recover
+
+static void testPointToPoint(const PointList3f &target, const PointList3f &src, const Isometry3f &truth) {
+    KDTree3 tree(target) ;
+
+    ICPAligner::Parameters params ;
+    params.inlier_distance_threshold_ = 0.1 ;
+    params.max_iterations_ = 50 ;
+
+    ICPAligner icp(params) ;
+
+    Isometry3f pose = Isometry3f::Identity() ;
+    uint n_inliers ;
+
+    Timer<> t ;
+    float error = icp.align(tree, target, src, pose, n_inliers) ;
+    t.stop() ;
+
+    cout << "point-to-point: " << t.duration().count() << " ms, error " << error << ", inliers " << n_inliers
+         << ", pose error " << poseError(pose, truth) << endl ;
+    assert( poseError(pose, truth) < 1.0e-2 ) ;
+}
+
+// pose error after a fixed number of iterations for each metric
+
+static void testMetrics(const PointList3f &target, const PointList3f &src, const Isometry3f &truth) {
+    KDTree3 tree(target) ;
+
+    PointList3f target_normals, src_normals ;
+    Timer<> tn ;
+    estimateNormals(tree, target, 10, target_normals, Vector3f(-1, -1, -1)) ;
+    tn.stop() ;
+    estimateNormals(src, 10, src_normals, truth.inverse() * Vector3f(-1, -1, -1)) ;
+    cout << "normals: " << tn.duration().count() << " ms" << endl ;
+
+    // points on the z = 0 plane (every 4th) have normal (0, 0, -1) when seen from below
+    float mean_z = 0 ;
+    for( size_t i=0 ; i<target.size() ; i += 4 ) mean_z += target_normals[i].z() ;
+    mean_z /= ( target.size() + 3 ) / 4 ;
+    assert( mean_z < -0.9 ) ;
+
+    const char *names[] = { "point-to-point", "point-to-plane", "symmetric" } ;
+
+    for( uint iterations: { 4u, 8u } ) {
+        for( int m = ICPAligner::PointToPoint ; m <= ICPAligner::Symmetric ; m++ ) {
+            ICPAligner::Parameters params ;
+            params.inlier_distance_threshold_ = 0.1 ;
+            params.max_iterations_ = iterations ;
+            params.metric_ = (ICPAligner::Metric)m ;
+
+            Isometry3f pose = Isometry3f::Identity() ;
+            uint n_inliers ;
+
+            Timer<> t ;
+            ICPAligner(params).align(tree, target, target_normals, src, src_normals, pose, n_inliers) ;
+            t.stop() ;
+
+            cout << names[m] << ", " << iterations << " iterations: " << t.duration().count() << " ms, pose error " << poseError(pose, truth) << endl ;
+            if ( m != ICPAligner::PointToPoint && iterations == 8 ) assert( poseError(pose, truth) < 1.0e-3 ) ;
+        }
+    }
+}
+
+// coarse-to-fine alignment against a model that is built once and reused
+
+static void testPyramid(const PointList3f &target, const PointList3f &src, const Isometry3f &truth) {
+    PyramidICPAligner::Parameters params ;
+    params.icp_.max_iterations_ = 8 ;
+
+    Timer<> tb ;
+    PyramidICPAligner aligner(target, params) ;
+    tb.stop() ;
+
+    for( uint i=0 ; i<3 ; i++ ) {
+        Isometry3f pose = Isometry3f::Identity() ;
+        uint n_inliers ;
+
+        Timer<> t ;
+        float error = aligner.align(src, pose, n_inliers) ;
+        t.stop() ;
+
+        cout << "pyramid (" << aligner.numLevels() << " levels, build " << tb.duration().count() << " ms): " << t.duration().count()
+             << " ms, error " << error << ", pose error " << poseError(pose, truth) << endl ;
+        assert( poseError(pose, truth) < 1.0e-3 ) ;
+    }
+}
+
+// vertex map of a room (three walls and the floor) seen by a camera at pose (camera to world)
+static PointList3f renderRoom(const PinholeCamera &cam, const Isometry3f &pose) {
+    const Vector3f normals[] = { {0, 0, 1}, {1, 0, 0}, {1, 0, 0}, {0, 1, 0} } ;
+    const float offsets[] = { 3, -1.5, 1.5, 1 } ;
+
+    const float nan = std::numeric_limits<float>::quiet_NaN() ;
+    PointList3f vertices(cam.width() * cam.height()) ;
+
+    for( uint y=0 ; y<cam.height() ; y++ )
+        for( uint x=0 ; x<cam.width() ; x++ ) {
+            Vector3f d((x - cam.cx())/cam.fx(), (y - cam.cy())/cam.fy(), 1) ;
+            Vector3f o = pose.translation(), dw = pose.linear() * d ;
+
+            float t = std::numeric_limits<float>::max() ;
+            for( int i=0 ; i<4 ; i++ ) {
+                float nd = normals[i].dot(dw) ;
+                if ( nd == 0 ) continue ;
+                float ti = ( offsets[i] - normals[i].dot(o) ) / nd ;
+                if ( ti > 0 ) t = std::min(t, ti) ;
+            }
+            vertices[y * cam.width() + x] = ( t < 10 ) ? Vector3f(t * d) : Vector3f(nan, nan, nan) ;
+        }
+    return vertices ;
+}
+
+// frame to frame odometry with projective association
+
+static void testProjective() {
+    PinholeCamera cam(525, 525, 319.5, 239.5, cv::Size(640, 480), cv::Mat()) ;
+
+    Isometry3f motion = makePose(0.02, Vector3f(0, 1, 0.2), Vector3f(0.03, 0.01, -0.02)) ;
+
+    PointList3f target = renderRoom(cam, Isometry3f::Identity()), src = renderRoom(cam, motion) ;
+    PointList3f target_normals, src_normals ;
+    estimateNormalsOrganized(target, cam.width(), cam.height(), target_normals) ;
+    estimateNormalsOrganized(src, cam.width(), cam.height(), src_normals) ;
+
+    ProjectiveICPAligner::Parameters params ;
+    ProjectiveICPAligner icp(cam, params) ;
+
+    Isometry3f pose = Isometry3f::Identity() ;
+    uint n_inliers ;
+
+    Timer<> t ;
+    float error = icp.align(target, target_normals, src, src_normals, pose, n_inliers) ;
+    t.stop() ;
+
+    cout << "projective: " << t.duration().count() << " ms, error " << error << ", inliers " << n_inliers
+         << ", pose error " << poseError(pose, motion) << endl ;
+    assert( poseError(pose, motion) < 1.0e-3 ) ;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = ( argc > 1 ) ? atoi(argv[1]) : 300000 ;
+
+    RNG rng(1) ;
+    PointList3f target = makeScan(n, rng) ;
+
+    Isometry3f truth = makePose(0.05, Vector3f(1, 2, 3), Vector3f(0.02, -0.01, 0.03)) ;
+    Isometry3f inv = truth.inverse() ;
+
+    PointList3f src(n) ;
+    for( size_t i=0 ; i<n ; i++ ) src[i] = inv * target[i] ;
+
+    testPointToPoint(target, src, truth) ;
+
+    testMetrics(target, src, truth) ;
+
+    testPyramid(target, src, truth) ;
+
+    testProjective() ;
+}
@@ -0,0 +1,306 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/geometry/kdtree.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <numeric>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+// resident set size of the process in kB (Linux only)
+static size_t residentMemory() {
+    ifstream strm("/proc/self/status") ;
+    string line ;
+    while ( std::getline(strm, line) ) {
+        if ( line.compare(0, 6, "VmRSS:") == 0 ) {
+            istringstream s(line.substr(6)) ;
+            size_t kb ;
+            s >> kb ;
+            return kb ;
+        }
+    }
+    return 0 ;
+}
+
+static PointList3f makeCloud(size_t n, RNG &rng) {
+    PointList3f cloud(n) ;
+    for( size_t i=0 ; i<n ; i++ )
+        cloud[i] = Vector3f(rng.uniform<float>(), rng.uniform<float>(), rng.uniform<float>()) ;
+    return cloud ;
+}
+
+// build time and memory of a borrowing index versus one that holds a private copy of the cloud
+
+static void benchmarkBuild(const PointList3f &cloud) {
+    Vector3f q(0.5, 0.5, 0.5) ;
+
+    {
+        size_t rss = residentMemory() ;
+        Timer<> t ;
+        KDTree3 tree ;
+        tree.borrow(cloud) ;
+        t.stop() ;
+        cout << "borrowed: build " << t.duration().count() << " ms, rss +" << ( residentMemory() - rss )/1024 << " MB, nearest " << tree.nearest(q) << endl ;
+    }
+
+    {
+        size_t rss = residentMemory() ;
+        Timer<> t ;
+        KDTree3 tree(cloud) ;
+        t.stop() ;
+        cout << "copied:   build " << t.duration().count() << " ms, rss +" << ( residentMemory() - rss )/1024 << " MB, nearest " << tree.nearest(q) << endl ;
+    }
+
+    {
+        ConstMap<float, 3> m(cloud.data()->data(), cloud.size(), 3) ;
+        KDTree3 tree(m) ;
+        assert( tree.nearest(q) == KDTree3(cloud.data()->data(), cloud.size()).nearest(q) ) ;
+    }
+}
+
+// a tree trained on a point list keeps its own copy, a borrowing one sees the changes of the caller
+
+static void testOwnership() {
+    PointList3f pts { {0, 0, 0}, {1, 0, 0}, {2, 0, 0} } ;
+    KDTree3 copied(pts), borrowed ;
+    borrowed.borrow(pts) ;
+    PointList2f pts2 { {0, 0}, {1, 0} } ;
+    KDTree2 copied2(pts2) ;
+
+    pts[0] = Vector3f(5, 0, 0) ;
+    pts2[1] = Vector2f(9, 0) ;
+    assert( copied.nearest(Vector3f(0, 0, 0)) == 0 ) ;
+    assert( borrowed.nearest(Vector3f(5, 0, 0)) == 0 ) ;
+    assert( copied2.nearest(Vector2f(0.9, 0)) == 1 ) ;
+}
+
+// batched knn/radius queries against the equivalent loop of single queries
+
+static void benchmarkBatch(const PointList3f &cloud, const PointList3f &queries) {
+    KDTree3 tree(cloud) ;
+
+    const uint k = 8 ;
+    const float radius = 1.0e-4 ; // squared distance
+
+    {
+        Timer<> t ;
+        vector<uint> indexes ;
+        vector<float> distances ;
+        for( const Vector3f &q: queries )
+            tree.knearest(q, k, indexes, distances) ;
+        t.stop() ;
+        cout << "knn single: " << t.duration().count() << " ms" << endl ;
+    }
+
+    vector<uint> indexes ;
+    vector<float> distances ;
+
+    {
+        Timer<> t ;
+        tree.knearest(queries, k, indexes, distances) ;
+        t.stop() ;
+        cout << "knn batch:  " << t.duration().count() << " ms" << endl ;
+    }
+
+    vector<size_t> offsets ;
+    vector<uint> r_indexes ;
+    vector<float> r_distances ;
+
+    {
+        Timer<> t ;
+        tree.withinRadius(queries, radius, offsets, r_indexes, r_distances) ;
+        t.stop() ;
+        cout << "radius batch: " << t.duration().count() << " ms, " << r_indexes.size() << " matches" << endl ;
+    }
+
+    for( size_t i=0 ; i<queries.size() ; i += 997 ) {
+        vector<uint> idx ;
+        vector<float> dist ;
+        tree.knearest(queries[i], k, idx, dist) ;
+        assert( std::equal(idx.begin(), idx.end(), indexes.begin() + i * k) ) ;
+
+        idx.clear() ; dist.clear() ;
+        tree.withinRadius(queries[i], radius, idx, dist) ;
+        assert( idx.size() == offsets[i+1] - offsets[i] ) ;
+        assert( std::equal(idx.begin(), idx.end(), r_indexes.begin() + offsets[i]) ) ;
+    }
+}
+
+// cost of a single nearest neighbour query, unbounded and bounded by a small distance
+
+static void benchmarkNearest(const PointList3f &cloud, const PointList3f &queries) {
+    KDTree3 tree(cloud) ;
+
+    const float max_dist = 1.0e-5 ;
+    uint sum = 0 ;
+
+    {
+        Timer<std::chrono::nanoseconds> t ;
+        for( const Vector3f &q: queries )
+            sum += tree.nearest(q) ;
+        t.stop() ;
+        cout << "nearest: " << t.duration().count() / queries.size() << " ns/query" << endl ;
+    }
+
+    {
+        uint n_found = 0 ;
+        Timer<std::chrono::nanoseconds> t ;
+        for( const Vector3f &q: queries ) {
+            uint idx ;
+            float dist ;
+            if ( tree.nearest(q, max_dist, idx, dist) ) {
+                sum += idx ;
+                ++n_found ;
+            }
+        }
+        t.stop() ;
+        cout << "nearest bounded: " << t.duration().count() / queries.size() << " ns/query, " << n_found << " found" << endl ;
+    }
+
+    for( size_t i=0 ; i<queries.size() ; i += 997 ) {
+        uint idx ;
+        float dist, bdist ;
+        uint nn = tree.nearest(queries[i], dist) ;
+        bool found = tree.nearest(queries[i], max_dist, idx, bdist) ;
+        assert( found == ( dist < max_dist ) ) ;
+        assert( !found || idx == nn ) ;
+    }
+}
+
+// streaming insertion of frames into a dynamic index, removing the oldest frame once the map holds more than
+// max_frames, and verification against exhaustive search
+
+static void benchmarkDynamic(size_t frame_size, uint n_frames, RNG &rng) {
+    const uint max_frames = 10 ;
+    DynamicKDTree3 map ;
+    vector<uint> frame_ids ;
+    PointList3f all ;
+
+    Timer<> t ;
+    for( uint f=0 ; f<n_frames ; f++ ) {
+        PointList3f frame = makeCloud(frame_size, rng) ;
+        frame_ids.push_back(map.insert(frame)) ;
+        all.insert(all.end(), frame.begin(), frame.end()) ;
+
+        if ( frame_ids.size() > max_frames ) {
+            uint first = frame_ids[frame_ids.size() - max_frames - 1] ;
+            vector<uint> ids(frame_size) ;
+            std::iota(ids.begin(), ids.end(), first) ;
+            map.remove(ids) ;
+        }
+    }
+    t.stop() ;
+    cout << "dynamic: " << n_frames << " frame updates in " << t.duration().count() << " ms, " << map.size() << " points" << endl ;
+
+    // ids are consecutive so they index the concatenation of all frames; the live ones are those of the last frames
+    uint first_live = frame_ids[std::max<int>(0, frame_ids.size() - max_frames)] ;
+
+    for( uint i=0 ; i<100 ; i++ ) {
+        Vector3f q(rng.uniform<float>(), rng.uniform<float>(), rng.uniform<float>()) ;
+        uint best = 0 ;
+        float best_dist = std::numeric_limits<float>::max() ;
+        for( uint j=first_live ; j<all.size() ; j++ ) {
+            float d = ( all[j] - q ).squaredNorm() ;
+            if ( d < best_dist ) { best_dist = d ; best = j ; }
+        }
+
+        vector<uint> ids ;
+        vector<float> distances ;
+        map.knearest(q, 4, ids, distances) ;
+        assert( ids[0] == best && map.nearest(q) == best ) ;
+        assert( map.point(best) == all[best] ) ;
+    }
+}
+
+// read cloud from text file with one "x y z" point per line
+static PointList3f loadCloud(const string &fname) {
+    PointList3f cloud ;
+    ifstream strm(fname) ;
+    float x, y, z ;
+    while ( strm >> x >> y >> z ) cloud.emplace_back(x, y, z) ;
+    return cloud ;
+}
+
+// points on the surface of a sphere with some noise, closer to the distribution of range data than a uniform cloud
+static PointList3f makeSurfaceCloud(size_t n, RNG &rng) {
+    PointList3f cloud(n) ;
+    for( size_t i=0 ; i<n ; i++ ) {
+        Vector3f p(rng.gaussian(), rng.gaussian(), rng.gaussian()) ;
+        cloud[i] = p.normalized() * ( 1.0f + 0.005f * (float)rng.gaussian() ) ;
+    }
+    return cloud ;
+}
+
+// recall of the nearest neighbour versus query throughput for approximate search settings
+
+static void benchmarkRecall(const string &name, const PointList3f &cloud, const PointList3f &queries) {
+    KDTree3 exact(cloud) ;
+
+    vector<uint> truth(queries.size()) ;
+    for( size_t i=0 ; i<queries.size() ; i++ )
+        truth[i] = exact.nearest(queries[i]) ;
+
+    struct Setting { uint leaf_size_ ; float eps_ ; uint max_checks_ ; } ;
+    const Setting settings[] = { {10, 0, 0}, {20, 0, 0}, {10, 0.5, 0}, {10, 1, 0}, {10, 2, 0}, {10, 5, 0},
+                                 {10, 0, 64}, {10, 0, 32}, {10, 0, 16}, {20, 1, 32} } ;
+
+    cout << name << ": leaf eps checks recall queries/sec" << endl ;
+    for( const Setting &setting: settings ) {
+        KDTree3::Parameters params ;
+        params.leaf_size_ = setting.leaf_size_ ;
+        params.eps_ = setting.eps_ ;
+        params.max_checks_ = setting.max_checks_ ;
+
+        KDTree3 tree(cloud, params) ;
+
+        size_t n_correct = 0 ;
+        Timer<std::chrono::microseconds> t ;
+        for( size_t i=0 ; i<queries.size() ; i++ )
+            if ( tree.nearest(queries[i]) == truth[i] ) ++n_correct ;
+        t.stop() ;
+
+        cout << setting.leaf_size_ << ' ' << setting.eps_ << ' ' << setting.max_checks_ << ' '
+             << n_correct/(double)queries.size() << ' ' << 1.0e6 * queries.size() / t.duration().count() << endl ;
+    }
+}
+
+int main(int argc, char *argv[]) {
+
+    size_t n = ( argc > 1 ) ? atoi(argv[1]) : 2000000 ;
+
+    RNG rng(1) ;
+    PointList3f cloud = makeCloud(n, rng) ;
+
+    testOwnership() ;
+
+    benchmarkBuild(cloud) ;
+
+    PointList3f queries = makeCloud(n/4, rng) ;
+
+    benchmarkBatch(cloud, queries) ;
+
+    benchmarkNearest(cloud, queries) ;
+
+    benchmarkDynamic(n/20, 100, rng) ;
+
+    benchmarkRecall("uniform", cloud, queries) ;
+
+    PointList3f surface = makeSurfaceCloud(n, rng) ;
+    benchmarkRecall("surface", surface, makeSurfaceCloud(n/4, rng)) ;
+
+    // optionally a real scan given as a text file of points, queried with a perturbed subset of its own points
+    if ( argc > 2 ) {
+        PointList3f scan = loadCloud(argv[2]) ;
+        PointList3f scan_queries ;
+        for( size_t i=0 ; i<scan.size() ; i += 4 )
+            scan_queries.push_back(scan[i] + 0.001f * Vector3f(rng.gaussian(), rng.gaussian(), rng.gaussian())) ;
+        benchmarkRecall(argv[2], scan, scan_queries) ;
+    }
+}
@@ -0,0 +1,173 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/geometry/octree.hpp>
+#include <cvx/camera/camera.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+// points in [0, 1) as required by Octree::insert
+static PointList3f makeCloud(size_t n, RNG &rng) {
+    PointList3f cloud(n) ;
+    for( size_t i=0 ; i<n ; i++ )
+        cloud[i] = Vector3f(rng.uniform<float>(), rng.uniform<float>(), rng.uniform<float>()).cwiseMin(0.999f) ;
+    return cloud ;
+}
+
+// the linear octree should visit the same leaves in the same order as the pointer based one
+
+static void testTraversal(const PointList3f &cloud, float cell_size) {
+    Vector3f bmin(0, 0, 0), bmax(1, 1, 1), cell(cell_size, cell_size, cell_size) ;
+
+    vector<vector<uint>> leaves ;
+    {
+        OctreeIndexed tree(bmin, bmax, cell) ;
+        Timer<> t ;
+        for( uint i=0 ; i<cloud.size() ; i++ )
+            tree.insert(cloud[i], i) ;
+        t.stop() ;
+        cout << "pointer octree: build " << t.duration().count() << " ms" << endl ;
+
+        tree.traverse([&](const Vector3f &, const Vector3f &, const vector<uint> &data) {
+            if ( data.empty() ) return true ;
+            leaves.push_back(data) ;
+            return false ;
+        }) ;
+    }
+
+    LinearOctreeIndexed tree(bmin, bmax, cell) ;
+    Timer<> t ;
+    tree.build(cloud) ;
+    t.stop() ;
+    cout << "linear octree: build " << t.duration().count() << " ms, " << tree.numNodes() << " nodes, " << tree.numLeaves() << " leaves" << endl ;
+
+    size_t n_leaves = 0, n_mismatch = 0 ;
+    tree.traverse([&](const Vector3f &cmin, const Vector3f &cmax, const LinearOctreeIndexed::Range &data) {
+        if ( data.empty() ) return true ;
+
+        vector<uint> ids(data.begin(), data.end()) ;
+        vector<uint> &expected = leaves[n_leaves++] ;
+        std::sort(ids.begin(), ids.end()) ;
+        std::sort(expected.begin(), expected.end()) ;
+        if ( ids != expected ) ++n_mismatch ;
+
+        for( uint idx: data ) {
+            const Vector3f &p = cloud[idx] ;
+            assert( p.x() >= cmin.x() - 1.0e-5 && p.x() <= cmax.x() + 1.0e-5 ) ;
+        }
+        return false ;
+    }) ;
+
+    assert( n_leaves == leaves.size() && n_leaves == tree.numLeaves() ) ;
+    // points exactly on a cell boundary may be assigned differently due to rounding
+    assert( n_mismatch < 1 + leaves.size() / 1000 ) ;
+
+    // subtree payloads are contiguous: the root holds all points
+    assert( tree.nodeData(tree.node(0)).size() == cloud.size() ) ;
+
+    size_t n_points = 0 ;
+    for( const LinearOctreeIndexed::Leaf &leaf: tree )
+        n_points += leaf.data_.size() ;
+    assert( n_points == cloud.size() ) ;
+}
+
+// spatial queries against exhaustive search
+
+static void testQueries(const PointList3f &cloud, RNG &rng) {
+    OctreeIndexed tree(Vector3f(0, 0, 0), Vector3f(1, 1, 1), Vector3f(0.02, 0.02, 0.02)) ;
+    for( uint i=0 ; i<cloud.size() ; i++ )
+        tree.insert(cloud[i], i) ;
+
+    auto pos = [&](uint idx) -> const Vector3f & { return cloud[idx] ; } ;
+
+    auto check = [&](vector<uint> &res, const std::function<bool (const Vector3f &)> &inside) {
+        vector<uint> truth ;
+        for( uint i=0 ; i<cloud.size() ; i++ )
+            if ( inside(cloud[i]) ) truth.push_back(i) ;
+        std::sort(res.begin(), res.end()) ;
+        assert( res == truth ) ;
+    } ;
+
+    vector<uint> res ;
+    size_t n_results = 0 ;
+
+    Timer<std::chrono::microseconds> t ;
+    for( uint i=0 ; i<20 ; i++ ) {
+        Vector3f c(rng.uniform<float>(), rng.uniform<float>(), rng.uniform<float>()) ;
+        Vector3f qmin = c - Vector3f(0.05, 0.1, 0.02), qmax = c + Vector3f(0.05, 0.02, 0.1) ;
+
+        tree.boxQuery(qmin, qmax, res, pos) ;
+        n_results += res.size() ;
+        check(res, [&](const Vector3f &p) { return ( p.array() >= qmin.array() ).all() && ( p.array() <= qmax.array() ).all() ; }) ;
+
+        tree.radiusQuery(c, 0.1, res, pos) ;
+        n_results += res.size() ;
+        check(res, [&](const Vector3f &p) { return ( p - c ).norm() <= 0.1 ; }) ;
+
+        uint nn[4] ;
+        float dist[4] ;
+        uint n_found = tree.knearest(c, 4, nn, dist, std::numeric_limits<float>::max(), pos) ;
+        assert( n_found == 4 ) ;
+        for( uint j=0 ; j<cloud.size() ; j++ )
+            assert( ( cloud[j] - c ).norm() >= dist[0] ) ;
+        assert( dist[0] <= dist[1] && dist[1] <= dist[2] && dist[2] <= dist[3] ) ;
+
+        uint idx ;
+        float d ;
+        bool found = tree.nearest(c, idx, d, 1.0f, pos) ;
+        assert( found && idx == nn[0] ) ;
+        found = tree.nearest(c, idx, d, dist[0] * 0.5f, pos) ;
+        assert( !found ) ;
+    }
+    t.stop() ;
+    cout << "queries: " << n_results << " results in " << t.duration().count() / 1000.0 << " ms (including checks)" << endl ;
+
+    // camera at (0.5, 0.5, -1) looking along z
+    PinholeCamera cam(500, 500, 320, 240, cv::Size(640, 480), cv::Mat()) ;
+    Eigen::Isometry3f pose = Eigen::Isometry3f::Identity() ;
+    pose.translation() = Vector3f(0.5, 0.5, -1) ;
+    Frustum frustum(cam, pose, 1.2, 1.8) ;
+
+    tree.frustumQuery(frustum, res, pos) ;
+    check(res, [&](const Vector3f &p) {
+        Vector3f pc = p - pose.translation() ;
+        float u = 500 * pc.x() / pc.z() + 320, v = 500 * pc.y() / pc.z() + 240 ;
+        return pc.z() >= 1.2 && pc.z() <= 1.8 && u >= 0 && u <= 640 && v >= 0 && v <= 480 ;
+    }) ;
+    assert( !res.empty() ) ;
+
+    // point payloads need no position functor
+    OctreeCloud pts(Vector3f(0, 0, 0), Vector3f(1, 1, 1), Vector3f(0.02, 0.02, 0.02)) ;
+    for( const Vector3f &p: cloud ) pts.insert(p, p) ;
+    PointList3f pres ;
+    pts.radiusQuery(Vector3f(0.5, 0.5, 0.5), 0.1, pres) ;
+    tree.radiusQuery(Vector3f(0.5, 0.5, 0.5), 0.1, res, pos) ;
+    assert( pres.size() == res.size() ) ;
+}
+
+static void benchmarkSampling(const PointList3f &cloud, float cell_size) {
+    PointList3f centers ;
+    Timer<> t ;
+    sampleCloudCenters(cloud, cell_size, centers, Vector3f(0, 0, 0), Vector3f(1, 1, 1)) ;
+    t.stop() ;
+    cout << "sampleCloudCenters: " << cloud.size() << " -> " << centers.size() << " points in " << t.duration().count() << " ms" << endl ;
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = ( argc > 1 ) ? atoi(argv[1]) : 10000000 ;
+
+    RNG rng(1) ;
+    PointList3f cloud = makeCloud(n, rng) ;
+
+    testTraversal(cloud, 0.01) ;
+
+    testQueries(makeCloud(100000, rng), rng) ;
+
+    benchmarkSampling(cloud, 0.01) ;
+}
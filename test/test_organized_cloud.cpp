@@ -0,0 +1,100 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/pcl/organized_cloud.hpp>
+#include <cvx/pcl/normals.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+// tilted plane z = 2 + 0.5 x seen by a 640x480 camera, with a hole in the middle
+static OrganizedPointCloud makePlane(uint w, uint h) {
+    OrganizedPointCloud cloud(w, h, true) ;
+    const float f = 525, cx = ( w - 1 )/2.0f, cy = ( h - 1 )/2.0f ;
+
+    for( uint y=0 ; y<h ; y++ )
+        for( uint x=0 ; x<w ; x++ ) {
+            if ( x >= w/2 - 10 && x < w/2 + 10 && y >= h/2 - 10 && y < h/2 + 10 ) continue ;
+            float dx = ( x - cx )/f, dy = ( y - cy )/f ;
+            float z = 2 / ( 1 - 0.5f * dx ) ;
+            cloud.setPoint(x, y, Vector3f(dx * z, dy * z, z)) ;
+            cloud.setColor(x, y, OrganizedPointCloud::color_t(x % 256, y % 256, 0)) ;
+        }
+    return cloud ;
+}
+
+static void testViews(const OrganizedPointCloud &cloud) {
+    OrganizedPointCloud roi = cloud.roi(100, 50, 200, 100) ;
+    assert( roi.width() == 200 && roi.height() == 100 ) ;
+    assert( roi.point(3, 4) == cloud.point(103, 54) ) ;
+    assert( roi.color(3, 4) == cloud.color(103, 54) ) ;
+
+    OrganizedPointCloud sub = roi.subsample(4) ;
+    assert( sub.width() == 50 && sub.height() == 25 ) ;
+    assert( sub.point(2, 3) == cloud.point(108, 62) ) ;
+
+    // views share the data
+    OrganizedPointCloud copy(cloud) ;
+    copy.subsample(2).setPoint(1, 1, Vector3f(1, 2, 3)) ;
+    assert( cloud.point(2, 2) == Vector3f(1, 2, 3) ) ;
+
+    OrganizedPointCloud c = sub.clone() ;
+    c.setPoint(0, 0, Vector3f(0, 0, 0)) ;
+    assert( sub.point(0, 0) != Vector3f(0, 0, 0) && c.point(2, 3) == sub.point(2, 3) ) ;
+
+    assert( cloud.countValid() == cloud.width() * cloud.height() - 400 ) ;
+    assert( cloud.subsample(2).countValid() == 320 * 240 - 100 ) ;
+}
+
+static void testNormals(OrganizedPointCloud &cloud) {
+    Vector3f expected = Vector3f(0.5, 0, -1).normalized() ;
+
+    Timer<> t ;
+    cloud.computeNormals() ;
+    t.stop() ;
+
+    for( uint y=0 ; y<cloud.height() ; y+=7 )
+        for( uint x=0 ; x<cloud.width() ; x+=7 )
+            if ( cloud.isValid(x, y) ) assert( ( cloud.normal(x, y) - expected ).norm() < 1.0e-3 ) ;
+
+    // same as the vertex map version
+    PointList3f vertices, normals ;
+    cloud.getVertexMap(vertices) ;
+
+    Timer<> tv ;
+    estimateNormalsOrganized(vertices, cloud.width(), cloud.height(), normals) ;
+    tv.stop() ;
+
+    for( uint y=0 ; y<cloud.height() ; y++ )
+        for( uint x=0 ; x<cloud.width() ; x++ )
+            if ( cloud.isValid(x, y) ) assert( ( normals[y * cloud.width() + x] - cloud.normal(x, y) ).norm() < 1.0e-5 ) ;
+
+    // on a subsampled view the neighbours are the subsampled ones
+    OrganizedPointCloud sub = cloud.subsample(2).clone() ;
+    sub.computeNormals() ;
+    assert( ( sub.normal(10, 10) - expected ).norm() < 1.0e-3 ) ;
+
+    // unorganised estimation for comparison
+    PointList3f pts, pts_normals ;
+    cloud.getPoints(pts) ;
+
+    Timer<> tk ;
+    estimateNormals(pts, 10, pts_normals) ;
+    tk.stop() ;
+
+    cout << "normals: organized " << t.duration().count() << " ms, vertex map " << tv.duration().count()
+         << " ms, kd-tree " << tk.duration().count() << " ms" << endl ;
+}
+
+int main(int argc, char *argv[]) {
+    OrganizedPointCloud cloud = makePlane(640, 480) ;
+
+    testViews(cloud) ;
+
+    cloud = makePlane(640, 480) ;
+    testNormals(cloud) ;
+}
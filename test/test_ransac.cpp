@@ -0,0 +1,208 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/math/ransac.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <Eigen/Core>
+#include <iostream>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std ;
+using namespace cvx ;
+
+// 2D line n.p = d, |n| = 1
+struct Line2 {
+    Eigen::Vector2d n_ ;
+    double d_ = 0 ;
+};
+
+struct LineModel {
+    static const int minSamples = 2 ;
+
+    LineModel(const vector<Eigen::Vector2d> &pts, double thresh): pts_(pts), thresh_(thresh) {}
+
+    bool fit(const vector<size_t> &subset, Line2 &line) const {
+        // total least squares
+        Eigen::Vector2d c(0, 0) ;
+        for( size_t i: subset ) c += pts_[i] ;
+        c /= subset.size() ;
+        Eigen::Matrix2d cov = Eigen::Matrix2d::Zero() ;
+        for( size_t i: subset ) cov += ( pts_[i] - c ) * ( pts_[i] - c ).transpose() ;
+
+        double a = cov(0, 0), b = cov(0, 1), e = cov(1, 1) ;
+        double lmin = 0.5 * ( a + e - sqrt(( a - e ) * ( a - e ) + 4 * b * b)) ;
+        Eigen::Vector2d n = ( std::abs(b) > 1.0e-12 ) ? Eigen::Vector2d(b, lmin - a) : ( a < e ? Eigen::Vector2d(1, 0) : Eigen::Vector2d(0, 1) ) ;
+        if ( n.norm() < 1.0e-12 ) return false ;
+        line.n_ = n.normalized() ;
+        line.d_ = line.n_.dot(c) ;
+        return true ;
+    }
+
+    bool isInlier(const Line2 &line, size_t i) const {
+        return std::abs(line.n_.dot(pts_[i]) - line.d_) < thresh_ ;
+    }
+
+    void findInliers(const Line2 &line, vector<size_t> &inliers) const {
+        for( size_t i=0 ; i<pts_.size() ; i++ )
+            if ( isInlier(line, i) ) inliers.push_back(i) ;
+    }
+
+    // favours hypotheses with many inliers
+    float computeResidual(const vector<size_t> &inliers) const {
+        return pts_.size() - inliers.size() ;
+    }
+
+    const vector<Eigen::Vector2d> &pts_ ;
+    double thresh_ ;
+};
+
+// y = 0.5 x + 2 with noise, quality is higher for inliers but only on average
+static void makePoints(size_t n, double outlier_ratio, RNG &rng, vector<Eigen::Vector2d> &pts, vector<float> *quality = nullptr) {
+    pts.clear() ;
+    if ( quality ) quality->clear() ;
+    for( size_t i=0 ; i<n ; i++ ) {
+        double x = rng.uniform<double>(-10, 10) ;
+        bool outlier = rng.uniform<double>() < outlier_ratio ;
+        if ( outlier )
+            pts.emplace_back(x, rng.uniform<double>(-10, 10)) ;
+        else
+            pts.emplace_back(x, 0.5 * x + 2 + rng.gaussian(0, 0.01)) ;
+        if ( quality ) quality->push_back(rng.uniform<float>() + ( outlier ? 0.0f : 0.5f )) ;
+    }
+}
+
+static bool isTrueLine(const Line2 &l) {
+    Eigen::Vector2d n = Eigen::Vector2d(0.5, -1).normalized() ;
+    double s = ( l.n_.dot(n) > 0 ) ? 1 : -1 ;
+    return ( s * l.n_ - n ).norm() < 1.0e-2 && std::abs(s * l.d_ - n.dot(Eigen::Vector2d(0, 2))) < 1.0e-2 ;
+}
+
+int main(int argc, char *argv[]) {
+    RNG rng(1) ;
+
+    vector<Eigen::Vector2d> pts ;
+    makePoints(2000, 0.6, rng, pts) ;
+    LineModel model(pts, 0.05) ;
+
+    // the same seed gives the same result
+    vector<size_t> inliers, inliers2 ;
+    Line2 line, line2 ;
+    bool ok = RANSAC(500, 100, 7).estimate(pts.size(), model, inliers, line) ;
+    assert( ok && isTrueLine(line) ) ;
+    ok = RANSAC(500, 100, 7).estimate(pts.size(), model, inliers2, line2) ;
+    assert( ok && inliers == inliers2 && line.n_ == line2.n_ && line.d_ == line2.d_ ) ;
+
+    RANSAC ransac(500, 100, 8) ;
+    ok = ransac.estimate(pts.size(), model, inliers2, line2) ;
+    assert( ok && isTrueLine(line2) ) ;
+
+#ifdef _OPENMP
+    // and does not depend on the number of threads, all trials are run so that every random stream counts
+    RANSAC::Parameters all ;
+    all.max_trials_ = 500 ;
+    all.min_inliers_ = 100 ;
+    all.confidence_ = 1 ;
+    all.lo_iterations_ = all.lo_refits_ = 0 ;
+    const int n_threads = omp_get_max_threads() ;
+    for( int t: { 1, 2, 4, 8 } ) {
+        omp_set_num_threads(t) ;
+        ok = RANSAC(all).estimate(pts.size(), model, inliers, line) ;
+        if ( t == 1 ) { inliers2 = inliers ; line2 = line ; }
+        assert( ok && inliers == inliers2 && line.n_ == line2.n_ && line.d_ == line2.d_ ) ;
+    }
+    omp_set_num_threads(n_threads) ;
+#endif
+
+    // no hypothesis has enough inliers
+    ok = RANSAC(50, 1900).estimate(pts.size(), model, inliers, line) ;
+    assert( !ok ) ;
+
+    // all trials when adaptive termination, local optimisation and preemptive verification are disabled
+    RANSAC::Parameters fixed ;
+    fixed.max_trials_ = 300 ;
+    fixed.min_inliers_ = 100 ;
+    fixed.confidence_ = 1 ;
+    fixed.lo_iterations_ = fixed.lo_refits_ = 0 ;
+    fixed.sprt_ = false ;
+    RANSAC plain(fixed) ;
+    ok = plain.estimate(pts.size(), model, inliers, line) ;
+    assert( ok && isTrueLine(line) ) ;
+    assert( plain.stats().trials_ == 300 && plain.stats().sprt_rejected_ == 0 && plain.stats().lo_runs_ == 0 ) ;
+
+    // adaptive termination
+    RANSAC::Parameters params = fixed ;
+    params.max_trials_ = 100000 ;
+    params.confidence_ = 0.99 ;
+    RANSAC adaptive(params) ;
+    ok = adaptive.estimate(pts.size(), model, inliers, line) ;
+    assert( ok && isTrueLine(line) ) ;
+    assert( adaptive.stats().trials_ < 100 ) ;
+
+    // most wrong hypotheses are abandoned early
+    params.sprt_ = true ;
+    params.lo_iterations_ = 10 ; params.lo_refits_ = 4 ;
+    RANSAC sprt(params) ;
+    ok = sprt.estimate(pts.size(), model, inliers, line) ;
+    assert( ok && isTrueLine(line) ) ;
+    assert( sprt.stats().sprt_rejected_ > 0 && sprt.stats().lo_runs_ > 0 ) ;
+
+    // with few inliers good models pass the preemptive test, which starts from min_inliers_ / n
+    for( uint64_t seed: { 1, 2, 4 } ) {
+        RNG data_rng(seed) ;
+        vector<Eigen::Vector2d> sparse ;
+        makePoints(5000, 0.98, data_rng, sparse) ;
+        LineModel few(sparse, 0.05) ;
+        RANSAC::Parameters low ;
+        low.max_trials_ = 20000 ;
+        low.min_inliers_ = 50 ;
+        RANSAC ransac(low) ;
+        ok = ransac.estimate(sparse.size(), few, inliers, line) ;
+        assert( ok && isTrueLine(line) ) ;
+        assert( ransac.stats().sprt_rejected_ > 0 ) ;
+        cout << "5000 points, 98% outliers: " << ransac.stats().trials_ << " trials (" << ransac.stats().sprt_rejected_ << " rejected by SPRT)" << endl ;
+    }
+
+    // ordered sampling finds the model in a few trials
+    vector<float> quality ;
+    makePoints(20000, 0.8, rng, pts, &quality) ;
+    LineModel hard(pts, 0.05) ;
+    RANSAC uniform(params), prosac(params) ;
+    prosac.setQuality(quality) ;
+    ok = uniform.estimate(pts.size(), hard, inliers, line) ;
+    assert( ok && isTrueLine(line) ) ;
+    ok = prosac.estimate(pts.size(), hard, inliers2, line2) ;
+    assert( ok && isTrueLine(line2) ) ;
+    assert( prosac.stats().trials_ < uniform.stats().trials_ ) ;
+
+    cout << "20000 points, 80% outliers: uniform " << uniform.stats().trials_ << " trials (" << uniform.stats().sprt_rejected_
+         << " rejected by SPRT), PROSAC " << prosac.stats().trials_ << " trials" << endl ;
+
+    makePoints(100000, 0.5, rng, pts) ;
+    LineModel big(pts, 0.05) ;
+
+    fixed.max_trials_ = 2000 ;
+    fixed.min_inliers_ = 1000 ;
+    RANSAC full(fixed) ;
+
+    Timer<> tf ;
+    ok = full.estimate(pts.size(), big, inliers, line) ;
+    tf.stop() ;
+    assert( ok && isTrueLine(line) ) ;
+
+    RANSAC fast(2000, 1000, 1) ;
+
+    Timer<> t ;
+    ok = fast.estimate(pts.size(), big, inliers, line) ;
+    t.stop() ;
+    assert( ok && isTrueLine(line) ) ;
+
+    cout.precision(12) ;
+    cout << "ransac (100000 points): " << tf.duration().count() << " ms for 2000 trials, adaptive "
+         << t.duration().count() << " ms for " << fast.stats().trials_ << " trials, " << inliers.size() << " inliers, line "
+         << line.n_.transpose() << " " << line.d_ << endl ;
+}
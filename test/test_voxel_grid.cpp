@@ -0,0 +1,123 @@
+#undef NDEBUG
+#include <cassert>
+
+#include <cvx/pcl/voxel_grid.hpp>
+#include <cvx/geometry/octree.hpp>
+#include <cvx/math/rng.hpp>
+#include <cvx/misc/timer.hpp>
+
+#include <iostream>
+#include <set>
+#include <tuple>
+#include <stdexcept>
+
+using namespace std ;
+using namespace cvx ;
+using namespace Eigen ;
+
+static PointList3f makeCloud(size_t n, RNG &rng) {
+    PointList3f cloud(n) ;
+    for( size_t i=0 ; i<n ; i++ )
+        cloud[i] = Vector3f(rng.uniform<float>(), rng.uniform<float>(), rng.uniform<float>()).cwiseMin(0.999f) ;
+    return cloud ;
+}
+
+// small cloud with known voxels, a non-finite point and attributes
+
+static void testReduction() {
+    PointList3f cloud { {0.1, 0.1, 0.1}, {0.3, 0.3, 0.3}, {1.2, 0.1, 0.1}, {NAN, 0, 0}, {0.2, 0.2, 0.2}, {1.4, 0.1, 0.1} } ;
+    vector<float> colors { 1, 0, 0,  0, 1, 0,  0, 0, 1,  9, 9, 9,  0, 0, 1,  0, 0, 1 } ;
+
+    VoxelGridFilter::Parameters params ;
+    params.voxel_size_ = 1.0 ;
+
+    PointList3f res ;
+    vector<float> res_colors ;
+
+    params.reduction_ = VoxelGridFilter::Centroid ;
+    VoxelGridFilter(params).filter(cloud, colors.data(), 3, res, res_colors) ;
+    assert( res.size() == 2 ) ;
+    assert( ( res[0] - Vector3f(0.2, 0.2, 0.2) ).norm() < 1.0e-6 ) ;
+    assert( ( res[1] - Vector3f(1.3, 0.1, 0.1) ).norm() < 1.0e-6 ) ;
+    assert( std::abs(res_colors[0] - 1/3.0f) < 1.0e-6 && std::abs(res_colors[5] - 1.0f) < 1.0e-6 ) ;
+
+    params.reduction_ = VoxelGridFilter::ClosestToCentroid ;
+    VoxelGridFilter(params).filter(cloud, res) ;
+    assert( res[0] == cloud[4] ) ;
+
+    params.reduction_ = VoxelGridFilter::FirstHit ;
+    VoxelGridFilter(params).filter(cloud, res) ;
+    assert( res[0] == cloud[0] && res[1] == cloud[2] ) ;
+
+    params.min_points_ = 3 ;
+    VoxelGridFilter(params).filter(cloud, res) ;
+    assert( res.size() == 1 ) ;
+
+    // a zero, negative or NaN voxel size is rejected
+    for( float sz : { 0.0f, -1.0f, (float)NAN } ) {
+        params.voxel_size_ = sz ;
+        bool thrown = false ;
+        try {
+            VoxelGridFilter(params).filter(cloud, res) ;
+        } catch ( std::invalid_argument & ) {
+            thrown = true ;
+        }
+        assert( thrown ) ;
+    }
+
+    // too many voxels, also when the extent overflows a float
+    PointList3f huge { {-3.0e38f, 0, 0}, {3.0e38f, 1, 1} } ;
+    for( float sz : { 1.0e-30f, 1.0f } ) {
+        params.voxel_size_ = sz ;
+        bool thrown = false ;
+        try {
+            VoxelGridFilter(params).filter(huge, res) ;
+        } catch ( std::range_error & ) {
+            thrown = true ;
+        }
+        assert( thrown ) ;
+    }
+}
+
+// throughput against octree based sampling
+
+static void benchmark(const PointList3f &cloud, float cell_size) {
+    PointList3f centers ;
+    {
+        Timer<> t ;
+        sampleCloudCenters(cloud, cell_size, centers, Vector3f(0, 0, 0), Vector3f(1, 1, 1)) ;
+        t.stop() ;
+        cout << "sampleCloudCenters: " << centers.size() << " points in " << t.duration().count() << " ms" << endl ;
+    }
+
+    {
+        OctreeIndexed tree(Vector3f(0, 0, 0), Vector3f(1, 1, 1), Vector3f(cell_size, cell_size, cell_size)) ;
+        Timer<> t ;
+        for( uint i=0 ; i<cloud.size() ; i++ )
+            tree.insert(cloud[i], i) ;
+        t.stop() ;
+        cout << "pointer octree build: " << t.duration().count() << " ms" << endl ;
+    }
+
+    VoxelGridFilter::Parameters params ;
+    params.voxel_size_ = cell_size ;
+
+    const char *names[] = { "centroid", "closest", "first" } ;
+    for( int r = VoxelGridFilter::Centroid ; r <= VoxelGridFilter::FirstHit ; r++ ) {
+        params.reduction_ = (VoxelGridFilter::Reduction)r ;
+        PointList3f res ;
+        Timer<> t ;
+        VoxelGridFilter(params).filter(cloud, res) ;
+        t.stop() ;
+        cout << "voxel grid " << names[r] << ": " << res.size() << " points in " << t.duration().count() << " ms" << endl ;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    size_t n = ( argc > 1 ) ? atoi(argv[1]) : 10000000 ;
+
+    testReduction() ;
+
+    RNG rng(1) ;
+    benchmark(makeCloud(n, rng), 0.01) ;
+}